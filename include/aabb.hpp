@@ -0,0 +1,79 @@
+#ifndef AABB_HPP
+#define AABB_HPP
+
+#include <algorithm>
+#include <limits>
+#include "vec3.hpp"
+
+struct AABB
+{
+    Vec3 min = Vec3(std::numeric_limits<Real>::infinity(),
+                    std::numeric_limits<Real>::infinity(),
+                    std::numeric_limits<Real>::infinity());
+    Vec3 max = Vec3(-std::numeric_limits<Real>::infinity(),
+                    -std::numeric_limits<Real>::infinity(),
+                    -std::numeric_limits<Real>::infinity());
+
+    void grow(const Vec3 &p)
+    {
+        min = Vec3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+        max = Vec3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+    }
+
+    void grow(const AABB &box)
+    {
+        min = Vec3(std::min(min.x, box.min.x), std::min(min.y, box.min.y), std::min(min.z, box.min.z));
+        max = Vec3(std::max(max.x, box.max.x), std::max(max.y, box.max.y), std::max(max.z, box.max.z));
+    }
+
+    bool empty() const { return min.x > max.x; }
+
+    Real area() const
+    {
+        if (empty())
+            return 0;
+        Vec3 e = max - min;
+        return 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+};
+
+// Distance along the ray to the box entry, or infinity if the slab test misses.
+inline Real intersect_aabb(const AABB &box, const Vec3 &origin, const Vec3 &inv_dir,
+                           Real t_min, Real t_max)
+{
+    Real tx1 = (box.min.x - origin.x) * inv_dir.x;
+    Real tx2 = (box.max.x - origin.x) * inv_dir.x;
+    Real tmin = std::min(tx1, tx2);
+    Real tmax = std::max(tx1, tx2);
+
+    Real ty1 = (box.min.y - origin.y) * inv_dir.y;
+    Real ty2 = (box.max.y - origin.y) * inv_dir.y;
+    tmin = std::max(tmin, std::min(ty1, ty2));
+    tmax = std::min(tmax, std::max(ty1, ty2));
+
+    Real tz1 = (box.min.z - origin.z) * inv_dir.z;
+    Real tz2 = (box.max.z - origin.z) * inv_dir.z;
+    tmin = std::max(tmin, std::min(tz1, tz2));
+    tmax = std::min(tmax, std::max(tz1, tz2));
+
+    // Rounding can put the exit a hair before the entry for rays grazing the
+    // box; widen it by the bound from Ize, "Robust BVH Ray Traversal" (2013)
+    const Real eps = std::numeric_limits<Real>::epsilon() / 2;
+    tmax *= 1 + 2 * (3 * eps / (1 - 3 * eps));
+
+    tmin = std::max(tmin, t_min);
+    tmax = std::min(tmax, t_max);
+    return tmin <= tmax ? tmin : std::numeric_limits<Real>::infinity();
+}
+
+// Lower bound on the distance any unit-length ray from origin travels before
+// reaching the box
+inline Real distance_to_box_squared(const AABB &box, const Vec3 &origin)
+{
+    Real x = std::max({box.min.x - origin.x, Real(0), origin.x - box.max.x});
+    Real y = std::max({box.min.y - origin.y, Real(0), origin.y - box.max.y});
+    Real z = std::max({box.min.z - origin.z, Real(0), origin.z - box.max.z});
+    return x * x + y * y + z * z;
+}
+
+#endif
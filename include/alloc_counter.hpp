@@ -0,0 +1,13 @@
+#ifndef ALLOC_COUNTER_HPP
+#define ALLOC_COUNTER_HPP
+
+#include <cstdint>
+
+// Heap allocations made through the global operator new since startup, for
+// checking that the frame loop does not allocate. Counting replaces operator
+// new and is only compiled in with -DRAYTRACER_COUNT_ALLOCS=ON; otherwise
+// allocation_count() is always 0.
+bool allocation_counting_enabled();
+uint64_t allocation_count();
+
+#endif
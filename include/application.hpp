@@ -1,31 +1,46 @@
 #ifndef APPLICATION_HPP
 #define APPLICATION_HPP
 
+#include <array>
+#include <cstdio>
+#include <cstring>
 #include <memory>
 #include <iostream>
 #include <GLFW/glfw3.h>
 #include "camera.hpp"
 #include "scene.hpp"
+#include "scene_io.hpp"
+#include "scenes.hpp"
 #include "renderer.hpp"
 #include "render_buffer.hpp"
+#include "resolution_controller.hpp"
+#include "frame_pipeline.hpp"
+#include "instrumentation.hpp"
 #include "config.hpp"
 
+static_assert(!Config::PIPELINED_PRESENT || Config::PRESENT_BUFFERS >= 2,
+              "pipelined presentation needs a buffer to show while the next one traces");
+
 class Application
 {
 public:
     Application();
     ~Application();
 
+    // A scene file to show instead of the default scene (see scene_io.hpp)
+    void set_scene_path(const std::string &path) { scene_path_ = path; }
     bool initialize();
     void run();
     void cleanup();
 
 private:
+    std::string scene_path_;
     GLFWwindow *window_;
     std::unique_ptr<Camera> camera_;
     std::unique_ptr<Scene> scene_;
     std::unique_ptr<Renderer> renderer_;
     std::unique_ptr<RenderBuffer> render_buffer_;
+    std::unique_ptr<FramePipeline> pipeline_; // null when presenting synchronously
 
     // Window state
     int window_width_;
@@ -33,6 +48,10 @@ private:
     int render_width_;
     int render_height_;
 
+    // Adapts the render scale to the frame-time budget when enabled
+    ResolutionController resolution_;
+    bool dynamic_resolution_;
+
     // Input state
     float last_x_;
     float last_y_;
@@ -45,6 +64,36 @@ private:
     int frame_count_;
     int current_fps_;
 
+    // Traced frame waiting to be shown, and when its input was sampled
+    int pending_slot_;
+    double pending_input_time_;
+
+    // Input-to-photon latency: from sampling input for a frame to the swap
+    // that shows it, over the last LATENCY_HISTORY frames
+    static constexpr size_t LATENCY_HISTORY = 120;
+    std::array<double, LATENCY_HISTORY> latency_ms_;
+    size_t latency_count_;
+    size_t latency_next_;
+
+    // Where each frame's time went, for the overlay (F3). F4 writes the
+    // instrumentation trace once the current frame is done.
+    struct FrameTiming
+    {
+        float trace_ms = 0.0f;
+        float denoise_ms = 0.0f;
+        float upload_ms = 0.0f;
+        float present_ms = 0.0f;
+        float wait_ms = 0.0f; // blocked on the pipeline thread
+    };
+    static constexpr size_t TIMING_HISTORY = 120;
+    std::array<FrameTiming, TIMING_HISTORY> timings_;
+    size_t timing_next_;
+    FrameTiming current_timing_;
+    bool overlay_;
+    bool trace_requested_;
+    bool toggle_path_trace_;
+    bool toggle_denoise_;
+
     // Methods
     bool setup_opengl();
     void setup_callbacks();
@@ -52,20 +101,25 @@ private:
     void process_input();
     void update_render_size();
     void render_frame();
+    void present(double input_time);
+    void after_frame(int slot);
+    void record_phase(const char *name, Instrumentation::Clock::time_point start, float FrameTiming::*field);
     void draw_fullscreen_quad() const;
+    void draw_overlay() const;
     void update_fps();
 
     // Static callback functions
     static void framebuffer_size_callback(GLFWwindow *window, int width, int height);
     static void mouse_callback(GLFWwindow *window, double xpos, double ypos);
     static void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
+    static void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 
     // Helper to get Application instance from GLFW window
     static Application *get_app(GLFWwindow *window);
 };
 
 inline Application::Application()
-    : window_(nullptr), window_width_(Config::DEFAULT_WIDTH), window_height_(Config::DEFAULT_HEIGHT), last_x_(Config::DEFAULT_WIDTH / 2.0f), last_y_(Config::DEFAULT_HEIGHT / 2.0f), first_mouse_(true), delta_time_(0.0f), last_frame_(0.0f), fps_update_time_(0.0), frame_count_(0), current_fps_(0)
+    : window_(nullptr), window_width_(Config::DEFAULT_WIDTH), window_height_(Config::DEFAULT_HEIGHT), dynamic_resolution_(Config::DYNAMIC_RESOLUTION), last_x_(Config::DEFAULT_WIDTH / 2.0f), last_y_(Config::DEFAULT_HEIGHT / 2.0f), first_mouse_(true), delta_time_(0.0f), last_frame_(0.0f), fps_update_time_(0.0), frame_count_(0), current_fps_(0), pending_slot_(-1), pending_input_time_(0.0), latency_ms_{}, latency_count_(0), latency_next_(0), timings_{}, timing_next_(0), overlay_(false), trace_requested_(false), toggle_path_trace_(false), toggle_denoise_(false)
 {
 }
 
@@ -99,6 +153,7 @@ inline bool Application::initialize()
     }
 
     glfwMakeContextCurrent(window_);
+    Instrumentation::name_thread("main");
 
     int fb_width, fb_height;
     glfwGetFramebufferSize(window_, &fb_width, &fb_height);
@@ -115,11 +170,26 @@ inline bool Application::initialize()
     camera_ = std::make_unique<Camera>(Vec3(0.0f, 0.0f, 3.0f));
     camera_->aspect_ratio = static_cast<double>(window_width_) / window_height_;
 
-    scene_ = std::make_unique<Scene>(create_default_scene());
+    scene_ = std::make_unique<Scene>();
+    if (scene_path_.empty())
+        *scene_ = create_default_scene();
+    else if (!open_scene(scene_path_, *scene_))
+        return false;
+    // Binary scene files come with theirs
+    if (!scene_->has_acceleration())
+        scene_->build_acceleration();
     renderer_ = std::make_unique<Renderer>();
 
     update_render_size();
 
+    if (Config::PIPELINED_PRESENT)
+    {
+        pipeline_ = std::make_unique<FramePipeline>(*renderer_);
+    }
+    std::cout << "Texture upload: "
+              << (render_buffer_->uses_persistent_buffers() ? "persistently mapped pixel buffers" : "glTexSubImage2D")
+              << (pipeline_ ? ", pipelined" : "") << std::endl;
+
     return true;
 }
 
@@ -133,13 +203,13 @@ inline void Application::run()
         render_frame();
         update_fps();
 
-        glfwSwapBuffers(window_);
         glfwPollEvents();
     }
 }
 
 inline void Application::cleanup()
 {
+    pipeline_.reset();
     render_buffer_.reset();
     renderer_.reset();
     scene_.reset();
@@ -165,16 +235,13 @@ inline void Application::setup_callbacks()
     glfwSetFramebufferSizeCallback(window_, framebuffer_size_callback);
     glfwSetCursorPosCallback(window_, mouse_callback);
     glfwSetScrollCallback(window_, scroll_callback);
+    glfwSetKeyCallback(window_, key_callback);
     glfwSetInputMode(window_, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 }
 
 inline Scene Application::create_default_scene() const
 {
-    Scene scene;
-    scene.add_sphere(Sphere(Vec3(0, 0, -5), 1.0, Vec3(1.0, 0.2, 0.2)));  // Red
-    scene.add_sphere(Sphere(Vec3(2, 0, -6), 1.0, Vec3(0.2, 1.0, 0.2)));  // Green
-    scene.add_sphere(Sphere(Vec3(-2, 0, -4), 1.0, Vec3(0.2, 0.2, 1.0))); // Blue
-    return scene;
+    return ::create_default_scene();
 }
 
 inline void Application::process_input()
@@ -200,8 +267,9 @@ inline void Application::process_input()
 
 inline void Application::update_render_size()
 {
-    render_width_ = static_cast<int>(window_width_ * Config::RENDER_SCALE);
-    render_height_ = static_cast<int>(window_height_ * Config::RENDER_SCALE);
+    const double scale = dynamic_resolution_ ? resolution_.get_scale() : Config::RENDER_SCALE;
+    render_width_ = std::max(1, static_cast<int>(window_width_ * scale));
+    render_height_ = std::max(1, static_cast<int>(window_height_ * scale));
 
     if (render_buffer_)
     {
@@ -211,16 +279,116 @@ inline void Application::update_render_size()
     {
         render_buffer_ = std::make_unique<RenderBuffer>(render_width_, render_height_);
     }
+
+    // Room for the largest scale, so scale changes don't reallocate
+    const double max_scale = dynamic_resolution_ ? resolution_.get_max_scale() : Config::RENDER_SCALE;
+    render_buffer_->reserve(static_cast<int>(window_width_ * max_scale), static_cast<int>(window_height_ * max_scale));
 }
 
 inline void Application::render_frame()
 {
+    const int slot = render_buffer_->begin_frame();
+    const double input_time = glfwGetTime();
+
+    if (!pipeline_)
+    {
+        renderer_->render_with_fps(*scene_, *camera_, *render_buffer_, current_fps_);
+        if (renderer_->get_last_stats().tile_count == 0)
+            render_buffer_->invalidate_frame(slot);
+        const auto upload_start = Instrumentation::Clock::now();
+        const bool shown = render_buffer_->present_frame(slot);
+        record_phase("upload", upload_start, &FrameTiming::upload_ms);
+        present(shown ? input_time : -1.0);
+        after_frame(slot);
+        return;
+    }
+
+    // Frame N+1 traces on the pipeline thread while frame N uploads, draws
+    // and waits for the swap here
+    pipeline_->submit(*scene_, *camera_, *render_buffer_);
+    const double shown_input_time = pending_input_time_;
+    const auto upload_start = Instrumentation::Clock::now();
+    const bool shown = render_buffer_->present_frame(pending_slot_);
+    record_phase("upload", upload_start, &FrameTiming::upload_ms);
+    present(shown ? shown_input_time : -1.0);
+    const auto wait_start = Instrumentation::Clock::now();
+    pipeline_->wait();
+    record_phase("wait", wait_start, &FrameTiming::wait_ms);
+
+    pending_slot_ = slot;
+    pending_input_time_ = input_time;
+    after_frame(slot);
+}
+
+// Draws the texture and swaps; input_time < 0 means no new frame was shown
+inline void Application::present(double input_time)
+{
+    const auto present_start = Instrumentation::Clock::now();
     glClear(GL_COLOR_BUFFER_BIT);
+    if (render_buffer_->has_shown_frame())
+    {
+        draw_fullscreen_quad();
+    }
+    if (overlay_)
+    {
+        draw_overlay();
+    }
+    glfwSwapBuffers(window_);
+    record_phase("present", present_start, &FrameTiming::present_ms);
+
+    if (input_time >= 0.0)
+    {
+        latency_ms_[latency_next_] = (glfwGetTime() - input_time) * 1000.0;
+        latency_next_ = (latency_next_ + 1) % LATENCY_HISTORY;
+        latency_count_ = std::min(latency_count_ + 1, LATENCY_HISTORY);
+    }
+}
+
+// Runs once the frame in slot has finished tracing
+inline void Application::after_frame(int slot)
+{
+    const RenderStats &stats = renderer_->get_last_stats();
+    current_timing_.trace_ms = static_cast<float>(stats.frame_ms - stats.denoise_ms);
+    current_timing_.denoise_ms = static_cast<float>(stats.denoise_ms);
+    timings_[timing_next_] = current_timing_;
+    timing_next_ = (timing_next_ + 1) % TIMING_HISTORY;
+    current_timing_ = FrameTiming{};
+
+    // No frame is rendering now, so the trace buffers are safe to read
+    if (trace_requested_)
+    {
+        trace_requested_ = false;
+        const char *path = "raytracer_trace.json";
+        if (Instrumentation::write_chrome_trace(path))
+            std::cout << "Wrote " << path << std::endl;
+        else
+            std::cerr << "Could not write " << path << " (is RAYTRACER_INSTRUMENTATION on?)" << std::endl;
+    }
 
-    renderer_->render_with_fps(*scene_, *camera_, *render_buffer_, current_fps_);
-    render_buffer_->update_texture();
+    if (toggle_path_trace_)
+    {
+        toggle_path_trace_ = false;
+        renderer_->set_render_mode(renderer_->get_render_mode() == RenderMode::PathTrace ? RenderMode::Direct
+                                                                                         : RenderMode::PathTrace);
+    }
+    if (toggle_denoise_)
+    {
+        toggle_denoise_ = false;
+        renderer_->set_denoising(!renderer_->get_denoising());
+    }
 
-    draw_fullscreen_quad();
+    // Frames skipped because accumulation converged leave the slot stale and
+    // say nothing about cost
+    if (stats.tile_count == 0)
+    {
+        render_buffer_->invalidate_frame(slot);
+        return;
+    }
+
+    if (dynamic_resolution_ && resolution_.add_frame(stats.frame_ms))
+    {
+        update_render_size();
+    }
 }
 
 inline void Application::draw_fullscreen_quad() const
@@ -228,20 +396,91 @@ inline void Application::draw_fullscreen_quad() const
     glEnable(GL_TEXTURE_2D);
     render_buffer_->bind_texture();
 
+    const float u = render_buffer_->get_texcoord_u();
+    const float v = render_buffer_->get_texcoord_v();
+
     glBegin(GL_QUADS);
     glTexCoord2f(0.0f, 0.0f);
     glVertex2f(-1.0f, -1.0f);
-    glTexCoord2f(1.0f, 0.0f);
+    glTexCoord2f(u, 0.0f);
     glVertex2f(1.0f, -1.0f);
-    glTexCoord2f(1.0f, 1.0f);
+    glTexCoord2f(u, v);
     glVertex2f(1.0f, 1.0f);
-    glTexCoord2f(0.0f, 1.0f);
+    glTexCoord2f(0.0f, v);
     glVertex2f(-1.0f, 1.0f);
     glEnd();
 
     glDisable(GL_TEXTURE_2D);
 }
 
+inline void Application::record_phase(const char *name, Instrumentation::Clock::time_point start,
+                                      float FrameTiming::*field)
+{
+    const auto end = Instrumentation::Clock::now();
+    current_timing_.*field += std::chrono::duration<float, std::milli>(end - start).count();
+    if (Instrumentation::enabled())
+        Instrumentation::record_span(name, start, end);
+}
+
+// Lower left: one column per recent frame, trace (green), denoise (purple),
+// upload (yellow), present (blue) and pipeline wait (red) stacked, full height at twice the
+// frame budget with a line at the budget. Next to it, each render thread's
+// busy time in the last frame; uneven bars mean load imbalance.
+inline void Application::draw_overlay() const
+{
+    const float left = -0.98f;
+    const float bottom = -0.98f;
+    const float width = 0.6f;
+    const float height = 0.35f;
+    const float full_ms = 2.0f * static_cast<float>(Config::TARGET_FRAME_MS);
+    auto quad = [](float x0, float y0, float x1, float y1)
+    {
+        glVertex2f(x0, y0);
+        glVertex2f(x1, y0);
+        glVertex2f(x1, y1);
+        glVertex2f(x0, y1);
+    };
+
+    glBegin(GL_QUADS);
+    glColor3f(0.1f, 0.1f, 0.1f);
+    quad(left, bottom, left + width + 0.34f, bottom + height);
+
+    const float column = width / TIMING_HISTORY;
+    for (size_t i = 0; i < TIMING_HISTORY; ++i)
+    {
+        const FrameTiming &timing = timings_[(timing_next_ + i) % TIMING_HISTORY];
+        const float phases[5] = {timing.trace_ms, timing.denoise_ms, timing.upload_ms, timing.present_ms, timing.wait_ms};
+        const float colors[5][3] = {{0.3f, 0.9f, 0.3f}, {0.7f, 0.4f, 0.9f}, {0.9f, 0.9f, 0.2f}, {0.3f, 0.5f, 1.0f},
+                                    {1.0f, 0.3f, 0.3f}};
+        const float x = left + i * column;
+        float y = bottom;
+        for (int phase = 0; phase < 5; ++phase)
+        {
+            const float top = std::min(bottom + height, y + phases[phase] / full_ms * height);
+            glColor3f(colors[phase][0], colors[phase][1], colors[phase][2]);
+            quad(x, y, x + column * 0.8f, top);
+            y = top;
+        }
+    }
+    glColor3f(1.0f, 1.0f, 1.0f);
+    quad(left, bottom + height / 2 - 0.002f, left + width, bottom + height / 2 + 0.002f);
+
+    const RenderStats &stats = renderer_->get_last_stats();
+    const size_t threads = stats.worker_busy_ms.size();
+    const float bar = 0.3f / std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i)
+    {
+        const float busy = stats.frame_ms > 0.0 ? static_cast<float>(stats.worker_busy_ms[i] / stats.frame_ms) : 0.0f;
+        const float x = left + width + 0.02f + i * bar;
+        glColor3f(0.9f, 0.6f, 0.2f);
+        quad(x, bottom, x + bar * 0.8f, bottom + std::min(1.0f, busy) * height);
+    }
+    glEnd();
+
+    // The texture is modulated by the current color
+    glColor3f(1.0f, 1.0f, 1.0f);
+}
+
 inline void Application::framebuffer_size_callback(GLFWwindow *window, int width, int height)
 {
     Application *app = get_app(window);
@@ -277,6 +516,32 @@ inline void Application::scroll_callback(GLFWwindow *window, double xoffset, dou
     app->camera_->process_scroll(yoffset);
 }
 
+inline void Application::key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+    if (action != GLFW_PRESS)
+        return;
+
+    Application *app = get_app(window);
+    if (key == GLFW_KEY_F2)
+    {
+        // Applied between frames, while the renderer is idle
+        app->toggle_path_trace_ = true;
+    }
+    else if (key == GLFW_KEY_F3)
+    {
+        app->overlay_ = !app->overlay_;
+        Instrumentation::set_enabled(app->overlay_);
+    }
+    else if (key == GLFW_KEY_F4)
+    {
+        app->trace_requested_ = true;
+    }
+    else if (key == GLFW_KEY_F5)
+    {
+        app->toggle_denoise_ = true;
+    }
+}
+
 inline void Application::update_fps()
 {
     frame_count_++;
@@ -287,6 +552,34 @@ inline void Application::update_fps()
         current_fps_ = frame_count_;
         frame_count_ = 0;
         fps_update_time_ = current_time;
+
+        double latency_sum = 0.0;
+        double latency_max = 0.0;
+        for (size_t i = 0; i < latency_count_; ++i)
+        {
+            latency_sum += latency_ms_[i];
+            latency_max = std::max(latency_max, latency_ms_[i]);
+        }
+        const double latency_mean = latency_count_ > 0 ? latency_sum / latency_count_ : 0.0;
+
+        const RenderStats &stats = renderer_->get_last_stats();
+        char title[256];
+        int length = std::snprintf(title, sizeof(title), "Ray Tracer - %d fps, %dx%d (%.0f%%), render %.1f ms, input to photon %.1f ms avg %.1f max",
+                                   current_fps_, render_width_, render_height_,
+                                   100.0 * render_width_ / window_width_, stats.frame_ms,
+                                   latency_mean, latency_max);
+        if (overlay_ && stats.counters.rays > 0 && length > 0 && length < static_cast<int>(sizeof(title)))
+        {
+            const uint64_t shaded = std::max<uint64_t>(1, stats.counters.hits + stats.counters.misses);
+            std::snprintf(title + length, sizeof(title) - length, " | %.1f Mrays/s, %.1f tests/ray, %.0f%% hit",
+                          stats.counters.rays / (stats.frame_ms * 1000.0),
+                          static_cast<double>(stats.counters.sphere_tests + stats.counters.triangle_tests) / stats.counters.rays,
+                          100.0 * stats.counters.hits / shaded);
+        }
+        length = static_cast<int>(std::strlen(title));
+        if (stats.reused > 0 && length < static_cast<int>(sizeof(title)))
+            std::snprintf(title + length, sizeof(title) - length, " | reuse %.0f%%", 100.0 * stats.reuse_ratio());
+        glfwSetWindowTitle(window_, title);
     }
 }
 
@@ -0,0 +1,48 @@
+#ifndef ARRAY_STORE_HPP
+#define ARRAY_STORE_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Elements that are either owned, in a std::vector, or borrowed from memory
+// kept alive elsewhere, such as a mapped scene file (see scene_io.hpp).
+// Copies stay valid either way: a copy owns a copy of owned elements and
+// borrows the same memory as a borrowing original.
+template <class T, class Allocator = std::allocator<T>>
+class ArrayStore
+{
+public:
+    // The owned elements, for building. Drops any borrowed view first.
+    std::vector<T, Allocator> &vector()
+    {
+        borrowed_ = nullptr;
+        borrowed_size_ = 0;
+        return owned_;
+    }
+
+    // Frees the owned elements and reads data[0, size) from now on
+    void borrow(const T *data, size_t size)
+    {
+        owned_ = std::vector<T, Allocator>();
+        borrowed_ = data;
+        borrowed_size_ = size;
+    }
+
+    void clear() { vector().clear(); }
+
+    bool borrowed() const { return borrowed_ != nullptr; }
+    const T *data() const { return borrowed_ ? borrowed_ : owned_.data(); }
+    size_t size() const { return borrowed_ ? borrowed_size_ : owned_.size(); }
+    bool empty() const { return size() == 0; }
+    const T &operator[](size_t i) const { return data()[i]; }
+    const T *begin() const { return data(); }
+    const T *end() const { return data() + size(); }
+
+private:
+    std::vector<T, Allocator> owned_;
+    const T *borrowed_ = nullptr;
+    size_t borrowed_size_ = 0;
+};
+
+#endif
@@ -0,0 +1,687 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "vec3.hpp"
+#include "ray.hpp"
+#include "aabb.hpp"
+#include "array_store.hpp"
+#include "frustum.hpp"
+#include "ray_packet.hpp"
+#include "sphere.hpp"
+#include "sphere_soa.hpp"
+#include "simd.hpp"
+#include "instrumentation.hpp"
+#include "thread_pool.hpp"
+
+// 64 bytes so each node sits in exactly one cache line. Children of an
+// interior node are stored next to each other: left_first and left_first + 1.
+struct alignas(64) BVHNode
+{
+    AABB bounds;
+    int32_t left_first; // left child for interior nodes, first index for leaves
+    int32_t count;      // primitive count, 0 for interior nodes
+    int32_t axis;       // split axis of an interior node
+};
+
+static_assert(sizeof(BVHNode) == 64, "BVHNode should fill one cache line");
+
+class BVH
+{
+public:
+    static constexpr int SAH_BINS = 16;
+    static constexpr int MAX_LEAF_SIZE = 8;
+    static constexpr int MAX_DEPTH = 64;
+
+    void build(const Sphere *spheres, size_t count);
+    // Over any primitives, split by the centers of their boxes
+    void build(const AABB *bounds, size_t count);
+    void clear();
+
+    // Uses nodes and indices kept alive elsewhere (a mapped scene file)
+    void borrow(const BVHNode *nodes, size_t node_count, const uint32_t *indices, size_t count);
+
+    // Keeping a sphere BVH current as spheres move (see
+    // Scene::update_acceleration). Neither works on a borrowed tree.
+
+    // Adds a leaf for primitive, at index primitive_count(), as the sibling
+    // of the node found by descending from the root toward the child whose
+    // area the box grows least. Boxes above the leaf are left to refit().
+    void insert(const AABB &box, uint32_t primitive);
+
+    // Recomputes every box from the spheres' slots, children first; slots
+    // with a NaN radius count for nothing. Subtrees below the top levels are
+    // spread over pool. On the way up each interior node swaps a child with
+    // a grandchild when that shrinks the other child most (Kensler, "Tree
+    // Rotations for Improving Bounding Volume Hierarchies", 2008). Returns
+    // the depth of the deepest leaf, the root's being 0, as the builder
+    // limits it to MAX_DEPTH.
+    int refit(const SphereSpan &spheres, ThreadPool &pool);
+
+    // Surface area heuristic cost of a ray: node visits and primitive tests
+    // weighted by their box area over the root's
+    double sah_cost() const;
+
+    bool empty() const { return nodes_.empty(); }
+    bool borrowed() const { return nodes_.borrowed(); }
+    size_t primitive_count() const { return indices_.size(); }
+    const ArrayStore<BVHNode> &nodes() const { return nodes_; }
+    const ArrayStore<uint32_t> &indices() const { return indices_; }
+
+    // Leaves index into SoA slots laid out in indices() order. Returns the
+    // nearest slot hit in (t_min, t_closest) and updates t_closest.
+    bool hit(const SphereSpan &spheres, const Ray &ray,
+             Real t_min, Real &t_closest, size_t &slot) const;
+
+    // Visits leaves near to far, calling leaf(begin, end, t_closest) for
+    // primitives [begin, end) of indices() order. leaf returns whether it hit
+    // something and lowers t_closest when it does, which culls the rest.
+    template <class Leaf>
+    bool traverse(const Ray &ray, Real t_min, Real &t_closest, Leaf &&leaf) const;
+
+    // Whether leaf(begin, end) reports a hit for any leaf the ray reaches
+    // within (t_min, t_max). Children are visited in stored order without
+    // sorting, and the walk ends at the first hit.
+    template <class Leaf>
+    bool any_hit(const Ray &ray, Real t_min, Real t_max, Leaf &&leaf) const;
+
+    // Whether any sphere is hit in (t_min, t_max)
+    bool occluded(const SphereSpan &spheres, const Ray &ray, Real t_min, Real t_max) const;
+
+    // Traces a coherent packet, culling nodes and spheres against the packet
+    // frustum so a whole packet skips them in one test.
+    void hit_packet(const SphereSpan &spheres, RayPacket &packet, const PacketFrustum &frustum) const;
+
+private:
+    ArrayStore<BVHNode> nodes_;
+    ArrayStore<uint32_t> indices_;
+
+    // Scratch used only while building
+    std::vector<AABB> prim_bounds_;
+    std::vector<Vec3> centroids_;
+
+    // Scratch used by refit
+    std::vector<int> heights_;     // levels of the subtree below each node
+    std::vector<int> refit_top_;   // interior nodes above the subtrees refit in parallel
+    std::vector<int> refit_roots_; // those subtrees
+    std::vector<int> refit_next_;
+
+    void build_nodes(size_t count);
+    void update_bounds(BVHNode &node) const;
+    void subdivide(int node_index, int depth);
+    double find_split(const BVHNode &node, int &axis, double &split_pos) const;
+
+    void refit_subtree(BVHNode *nodes, const SphereSpan &spheres, int index);
+    void refit_interior(BVHNode *nodes, int index);
+    void rotate(BVHNode *nodes, int index);
+    void order_children(BVHNode *nodes, int index);
+};
+
+inline void BVH::build(const Sphere *spheres, size_t count)
+{
+    clear();
+    if (count == 0)
+        return;
+
+    prim_bounds_.assign(count, AABB());
+    centroids_.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Sphere &s = spheres[i];
+        Vec3 r(s.radius, s.radius, s.radius);
+        prim_bounds_[i].grow(s.center - r);
+        prim_bounds_[i].grow(s.center + r);
+        centroids_[i] = s.center;
+    }
+    build_nodes(count);
+}
+
+inline void BVH::build(const AABB *bounds, size_t count)
+{
+    clear();
+    if (count == 0)
+        return;
+
+    prim_bounds_.assign(bounds, bounds + count);
+    centroids_.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        centroids_[i] = (bounds[i].min + bounds[i].max) * Real(0.5);
+    build_nodes(count);
+}
+
+inline void BVH::build_nodes(size_t count)
+{
+    std::vector<BVHNode> &nodes = nodes_.vector();
+    std::vector<uint32_t> &indices = indices_.vector();
+    indices.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        indices[i] = static_cast<uint32_t>(i);
+
+    // A binary tree with N leaves has at most 2N - 1 nodes
+    nodes.reserve(2 * count - 1);
+    nodes.push_back(BVHNode{AABB(), 0, static_cast<int32_t>(count), 0});
+    update_bounds(nodes[0]);
+    subdivide(0, 0);
+
+    nodes.shrink_to_fit();
+    prim_bounds_.clear();
+    prim_bounds_.shrink_to_fit();
+    centroids_.clear();
+    centroids_.shrink_to_fit();
+}
+
+inline void BVH::clear()
+{
+    nodes_.clear();
+    indices_.clear();
+}
+
+inline void BVH::borrow(const BVHNode *nodes, size_t node_count, const uint32_t *indices, size_t count)
+{
+    nodes_.borrow(nodes, node_count);
+    indices_.borrow(indices, count);
+}
+
+inline void BVH::update_bounds(BVHNode &node) const
+{
+    node.bounds = AABB();
+    for (int i = 0; i < node.count; ++i)
+    {
+        node.bounds.grow(prim_bounds_[indices_[node.left_first + i]]);
+    }
+}
+
+inline double BVH::find_split(const BVHNode &node, int &axis, double &split_pos) const
+{
+    double best_cost = std::numeric_limits<double>::infinity();
+
+    AABB centroid_bounds;
+    for (int i = 0; i < node.count; ++i)
+    {
+        centroid_bounds.grow(centroids_[indices_[node.left_first + i]]);
+    }
+
+    for (int a = 0; a < 3; ++a)
+    {
+        const double lo = a == 0 ? centroid_bounds.min.x : a == 1 ? centroid_bounds.min.y : centroid_bounds.min.z;
+        const double hi = a == 0 ? centroid_bounds.max.x : a == 1 ? centroid_bounds.max.y : centroid_bounds.max.z;
+        if (hi <= lo)
+            continue;
+
+        AABB bin_bounds[SAH_BINS];
+        int bin_count[SAH_BINS] = {};
+        const double scale = SAH_BINS / (hi - lo);
+
+        for (int i = 0; i < node.count; ++i)
+        {
+            uint32_t prim = indices_[node.left_first + i];
+            const Vec3 &c = centroids_[prim];
+            double v = a == 0 ? c.x : a == 1 ? c.y : c.z;
+            int bin = std::min(SAH_BINS - 1, static_cast<int>((v - lo) * scale));
+            bin_count[bin]++;
+            bin_bounds[bin].grow(prim_bounds_[prim]);
+        }
+
+        // Sweep from both sides to get the cost of every bin boundary
+        double left_area[SAH_BINS - 1], right_area[SAH_BINS - 1];
+        int left_count[SAH_BINS - 1], right_count[SAH_BINS - 1];
+        AABB left_box, right_box;
+        int left_sum = 0, right_sum = 0;
+        for (int i = 0; i < SAH_BINS - 1; ++i)
+        {
+            left_sum += bin_count[i];
+            left_count[i] = left_sum;
+            left_box.grow(bin_bounds[i]);
+            left_area[i] = left_box.area();
+
+            right_sum += bin_count[SAH_BINS - 1 - i];
+            right_count[SAH_BINS - 2 - i] = right_sum;
+            right_box.grow(bin_bounds[SAH_BINS - 1 - i]);
+            right_area[SAH_BINS - 2 - i] = right_box.area();
+        }
+
+        for (int i = 0; i < SAH_BINS - 1; ++i)
+        {
+            if (left_count[i] == 0 || right_count[i] == 0)
+                continue;
+            double cost = left_count[i] * left_area[i] + right_count[i] * right_area[i];
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                axis = a;
+                split_pos = lo + (i + 1) / scale;
+            }
+        }
+    }
+
+    return best_cost;
+}
+
+inline void BVH::subdivide(int node_index, int depth)
+{
+    std::vector<BVHNode> &nodes = nodes_.vector();
+    std::vector<uint32_t> &indices = indices_.vector();
+    BVHNode &node = nodes[node_index];
+    if (node.count <= 1 || depth >= MAX_DEPTH)
+        return;
+
+    int axis = 0;
+    double split_pos = 0.0;
+    double split_cost = find_split(node, axis, split_pos);
+
+    // Traversal step costs roughly one intersection test
+    double leaf_cost = node.count * node.bounds.area();
+    double parent_cost = node.bounds.area();
+    bool should_split = split_cost + parent_cost < leaf_cost || node.count > MAX_LEAF_SIZE;
+    if (!should_split || split_cost == std::numeric_limits<double>::infinity())
+        return;
+
+    // Partition indices in place around the split plane
+    int i = node.left_first;
+    int j = i + node.count - 1;
+    while (i <= j)
+    {
+        const Vec3 &c = centroids_[indices[i]];
+        double v = axis == 0 ? c.x : axis == 1 ? c.y : c.z;
+        if (v < split_pos)
+            i++;
+        else
+            std::swap(indices[i], indices[j--]);
+    }
+
+    const int first = node.left_first;
+    const int count = node.count;
+    const int left_count = i - first;
+    if (left_count == 0 || left_count == count)
+        return;
+
+    // Turn the node into an interior node before nodes grows
+    const int left_child = static_cast<int>(nodes.size());
+    node.left_first = left_child;
+    node.count = 0;
+    node.axis = axis;
+
+    nodes.push_back(BVHNode{AABB(), first, left_count, 0});
+    nodes.push_back(BVHNode{AABB(), i, count - left_count, 0});
+
+    update_bounds(nodes[left_child]);
+    update_bounds(nodes[left_child + 1]);
+    subdivide(left_child, depth + 1);
+    subdivide(left_child + 1, depth + 1);
+}
+
+inline void BVH::insert(const AABB &box, uint32_t primitive)
+{
+    std::vector<BVHNode> &nodes = nodes_.vector();
+    std::vector<uint32_t> &indices = indices_.vector();
+    const int32_t first = static_cast<int32_t>(indices.size());
+    indices.push_back(primitive);
+    if (nodes.empty())
+    {
+        nodes.push_back(BVHNode{box, first, 1, 0});
+        return;
+    }
+
+    // Pairing with a node adds a parent of their merged area, and every
+    // ancestor grows to take the box in; stop where going deeper costs more
+    int index = 0;
+    while (nodes[index].count == 0)
+    {
+        const BVHNode &node = nodes[index];
+        AABB merged = node.bounds;
+        merged.grow(box);
+        const Real here = 2 * merged.area();
+        const Real inherited = 2 * (merged.area() - node.bounds.area());
+
+        Real below[2];
+        for (int k = 0; k < 2; ++k)
+        {
+            const BVHNode &child = nodes[node.left_first + k];
+            AABB with_box = child.bounds;
+            with_box.grow(box);
+            below[k] = with_box.area() + inherited - (child.count > 0 ? 0 : child.bounds.area());
+        }
+        if (here < std::min(below[0], below[1]))
+            break;
+        index = node.left_first + (below[1] < below[0] ? 1 : 0);
+    }
+
+    // The sibling moves down beside the new leaf and its node becomes their parent
+    const BVHNode sibling = nodes[index];
+    const int32_t child = static_cast<int32_t>(nodes.size());
+    nodes.push_back(sibling);
+    nodes.push_back(BVHNode{box, first, 1, 0});
+    BVHNode &parent = nodes[index];
+    parent.bounds.grow(box);
+    parent.left_first = child;
+    parent.count = 0;
+    heights_.resize(nodes.size());
+    order_children(nodes.data(), index);
+}
+
+inline int BVH::refit(const SphereSpan &spheres, ThreadPool &pool)
+{
+    if (nodes_.empty())
+        return 0;
+    BVHNode *nodes = nodes_.vector().data();
+    heights_.resize(nodes_.size());
+
+    // Split the top of the tree level by level into a few subtrees per thread
+    const size_t wanted = 4 * (pool.size() + 1);
+    // Levels at most double, and the lists trade places as they go
+    refit_roots_.reserve(2 * wanted);
+    refit_next_.reserve(2 * wanted);
+    refit_top_.clear();
+    refit_roots_.assign(1, 0);
+    while (refit_roots_.size() < wanted)
+    {
+        refit_next_.clear();
+        for (int index : refit_roots_)
+        {
+            if (nodes[index].count > 0)
+            {
+                refit_next_.push_back(index);
+                continue;
+            }
+            refit_top_.push_back(index);
+            refit_next_.push_back(nodes[index].left_first);
+            refit_next_.push_back(nodes[index].left_first + 1);
+        }
+        if (refit_next_.size() == refit_roots_.size())
+            break;
+        refit_roots_.swap(refit_next_);
+    }
+
+    pool.parallel_for(0, refit_roots_.size(), 1, [&](size_t begin, size_t end)
+                      {
+        for (size_t i = begin; i < end; ++i)
+            refit_subtree(nodes, spheres, refit_roots_[i]); });
+
+    // Deeper levels were listed later
+    for (size_t i = refit_top_.size(); i > 0; --i)
+        refit_interior(nodes, refit_top_[i - 1]);
+    // Heights count the leaf as a level
+    return heights_[0] - 1;
+}
+
+inline void BVH::refit_subtree(BVHNode *nodes, const SphereSpan &spheres, int index)
+{
+    BVHNode &node = nodes[index];
+    if (node.count == 0)
+    {
+        refit_subtree(nodes, spheres, node.left_first);
+        refit_subtree(nodes, spheres, node.left_first + 1);
+        refit_interior(nodes, index);
+        return;
+    }
+
+    node.bounds = AABB();
+    for (int32_t slot = node.left_first; slot < node.left_first + node.count; ++slot)
+    {
+        const Real r = spheres.radius[slot];
+        if (!(r >= 0))
+            continue;
+        const Vec3 center(spheres.cx[slot], spheres.cy[slot], spheres.cz[slot]);
+        node.bounds.grow(center - Vec3(r, r, r));
+        node.bounds.grow(center + Vec3(r, r, r));
+    }
+    heights_[index] = 1;
+}
+
+inline void BVH::refit_interior(BVHNode *nodes, int index)
+{
+    rotate(nodes, index);
+    BVHNode &node = nodes[index];
+    node.bounds = nodes[node.left_first].bounds;
+    node.bounds.grow(nodes[node.left_first + 1].bounds);
+    heights_[index] = 1 + std::max(heights_[node.left_first], heights_[node.left_first + 1]);
+}
+
+inline void BVH::rotate(BVHNode *nodes, int index)
+{
+    // Swapping child a with grandchild b leaves b's old parent holding a and
+    // b's sibling; take the swap that shrinks that parent most
+    const int left = nodes[index].left_first;
+    int best_a = -1, best_b = -1, best_parent = -1;
+    Real best_gain = 0;
+    for (int side = 0; side < 2; ++side)
+    {
+        const int a = left + side;
+        const int parent = left + 1 - side;
+        if (nodes[parent].count > 0)
+            continue;
+        for (int k = 0; k < 2; ++k)
+        {
+            AABB box = nodes[a].bounds;
+            box.grow(nodes[nodes[parent].left_first + 1 - k].bounds);
+            const Real gain = nodes[parent].bounds.area() - box.area();
+            if (gain > best_gain)
+            {
+                best_gain = gain;
+                best_a = a;
+                best_b = nodes[parent].left_first + k;
+                best_parent = parent;
+            }
+        }
+    }
+    if (best_a < 0)
+        return;
+
+    std::swap(nodes[best_a], nodes[best_b]);
+    std::swap(heights_[best_a], heights_[best_b]);
+    BVHNode &parent = nodes[best_parent];
+    parent.bounds = nodes[parent.left_first].bounds;
+    parent.bounds.grow(nodes[parent.left_first + 1].bounds);
+    heights_[best_parent] = 1 + std::max(heights_[parent.left_first], heights_[parent.left_first + 1]);
+    order_children(nodes, best_parent);
+    order_children(nodes, index);
+}
+
+inline void BVH::order_children(BVHNode *nodes, int index)
+{
+    // hit_packet expects the left child on the low side of the split axis;
+    // take the axis that separates the children's centers most
+    const int left = nodes[index].left_first;
+    const AABB &low = nodes[left].bounds;
+    const AABB &high = nodes[left + 1].bounds;
+    if (low.empty() || high.empty())
+        return;
+
+    const Vec3 d = (high.min + high.max) - (low.min + low.max);
+    const Real extent[3] = {std::abs(d.x), std::abs(d.y), std::abs(d.z)};
+    const int axis = extent[0] >= extent[1] && extent[0] >= extent[2] ? 0 : extent[1] >= extent[2] ? 1 : 2;
+    if ((axis == 0 ? d.x : axis == 1 ? d.y : d.z) < 0)
+    {
+        std::swap(nodes[left], nodes[left + 1]);
+        std::swap(heights_[left], heights_[left + 1]);
+    }
+    nodes[index].axis = axis;
+}
+
+inline double BVH::sah_cost() const
+{
+    if (nodes_.empty() || nodes_[0].bounds.area() <= 0)
+        return 0.0;
+
+    double cost = 0.0;
+    for (const BVHNode &node : nodes_)
+        cost += static_cast<double>(node.bounds.area()) * (node.count > 0 ? node.count : 1);
+    return cost / nodes_[0].bounds.area();
+}
+
+template <class Leaf>
+bool BVH::traverse(const Ray &ray, Real t_min, Real &t_closest, Leaf &&leaf) const
+{
+    if (nodes_.empty())
+        return false;
+
+    const Vec3 inv_dir(1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z);
+    const Real inf = std::numeric_limits<Real>::infinity();
+    const BVHNode *nodes = nodes_.data();
+
+    if (intersect_aabb(nodes[0].bounds, ray.origin, inv_dir, t_min, t_closest) == inf)
+        return false;
+
+    int stack[MAX_DEPTH + 1];
+    int stack_size = 0;
+    int node_index = 0;
+    bool hit_anything = false;
+
+    for (;;)
+    {
+        const BVHNode &node = nodes[node_index];
+        if (node.count > 0)
+        {
+            if (leaf(static_cast<size_t>(node.left_first), static_cast<size_t>(node.left_first + node.count), t_closest))
+            {
+                hit_anything = true;
+            }
+        }
+        else
+        {
+            // Visit the nearer child first so the farther one can be culled by t_closest
+            int near_child = node.left_first;
+            int far_child = node.left_first + 1;
+            Real near_t = intersect_aabb(nodes[near_child].bounds, ray.origin, inv_dir, t_min, t_closest);
+            Real far_t = intersect_aabb(nodes[far_child].bounds, ray.origin, inv_dir, t_min, t_closest);
+            if (far_t < near_t)
+            {
+                std::swap(near_child, far_child);
+                std::swap(near_t, far_t);
+            }
+
+            if (near_t != inf)
+            {
+                if (far_t != inf)
+                    stack[stack_size++] = far_child;
+                node_index = near_child;
+                continue;
+            }
+        }
+
+        // Pop, skipping nodes that are now behind the closest hit
+        bool found = false;
+        while (stack_size > 0)
+        {
+            int candidate = stack[--stack_size];
+            if (intersect_aabb(nodes[candidate].bounds, ray.origin, inv_dir, t_min, t_closest) != inf)
+            {
+                node_index = candidate;
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            break;
+    }
+
+    return hit_anything;
+}
+
+template <class Leaf>
+bool BVH::any_hit(const Ray &ray, Real t_min, Real t_max, Leaf &&leaf) const
+{
+    if (nodes_.empty())
+        return false;
+
+    const Vec3 inv_dir(1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z);
+    const Real inf = std::numeric_limits<Real>::infinity();
+    const BVHNode *nodes = nodes_.data();
+
+    int stack[MAX_DEPTH + 2];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
+    {
+        const BVHNode &node = nodes[stack[--stack_size]];
+        if (intersect_aabb(node.bounds, ray.origin, inv_dir, t_min, t_max) == inf)
+            continue;
+
+        if (node.count > 0)
+        {
+            if (leaf(static_cast<size_t>(node.left_first), static_cast<size_t>(node.left_first + node.count)))
+                return true;
+        }
+        else
+        {
+            stack[stack_size++] = node.left_first + 1;
+            stack[stack_size++] = node.left_first;
+        }
+    }
+    return false;
+}
+
+inline bool BVH::occluded(const SphereSpan &spheres, const Ray &ray, Real t_min, Real t_max) const
+{
+    const OccludedSphereFn occluded_sphere = simd_kernels().occluded_sphere;
+    return any_hit(ray, t_min, t_max, [&](size_t begin, size_t end)
+                   {
+        Instrumentation::count_sphere_tests(end - begin);
+        return occluded_sphere(spheres, begin, end, ray, t_min, t_max); });
+}
+
+inline bool BVH::hit(const SphereSpan &spheres, const Ray &ray,
+                     Real t_min, Real &t_closest, size_t &slot) const
+{
+    const NearestSphereFn nearest_sphere = simd_kernels().nearest_sphere;
+    return traverse(ray, t_min, t_closest, [&](size_t begin, size_t end, Real &t)
+                    {
+        Instrumentation::count_sphere_tests(end - begin);
+        return nearest_sphere(spheres, begin, end, ray, t_min, t, slot); });
+}
+
+inline void BVH::hit_packet(const SphereSpan &spheres, RayPacket &packet, const PacketFrustum &frustum) const
+{
+    if (nodes_.empty() || packet.count == 0)
+        return;
+
+    const PacketSphereFn packet_sphere = simd_kernels().packet_sphere;
+    const BVHNode *nodes = nodes_.data();
+    Real max_t = packet.max_t();
+
+    int stack[MAX_DEPTH + 2];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0)
+    {
+        const BVHNode &node = nodes[stack[--stack_size]];
+
+        // Whole packet misses the node, or every ray already hit something closer
+        if (frustum.cull_box(node.bounds) ||
+            distance_to_box_squared(node.bounds, packet.origin) > max_t * max_t * (1 + PacketFrustum::SLACK))
+            continue;
+
+        if (node.count > 0)
+        {
+            bool tested = false;
+            for (int i = 0; i < node.count; ++i)
+            {
+                size_t slot = node.left_first + i;
+                Vec3 center(spheres.cx[slot], spheres.cy[slot], spheres.cz[slot]);
+                if (frustum.cull_sphere(center, spheres.radius[slot]))
+                    continue;
+                packet_sphere(spheres, slot, packet);
+                Instrumentation::count_sphere_tests(packet.count);
+                tested = true;
+            }
+            if (tested)
+                max_t = packet.max_t();
+        }
+        else
+        {
+            // Front to back along the split axis, judged by the packet's central direction
+            const Vec3 &d = frustum.direction;
+            Real along = node.axis == 0 ? d.x : node.axis == 1 ? d.y : d.z;
+            int near_child = along >= 0 ? node.left_first : node.left_first + 1;
+            int far_child = along >= 0 ? node.left_first + 1 : node.left_first;
+            stack[stack_size++] = far_child;
+            stack[stack_size++] = near_child;
+        }
+    }
+}
+
+#endif
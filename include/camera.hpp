@@ -3,7 +3,78 @@
 
 #include "vec3.hpp"
 #include "ray.hpp"
+#include "sampling.hpp"
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+
+// The camera as one frame sees it, for a given resolution: the direction
+// through the center of pixel (0, 0) and the steps to the next pixel across
+// and down, so a ray costs a few adds and one normalize. Taken once per frame
+// and immutable, so render threads never read a Camera that input callbacks
+// are moving.
+struct CameraSnapshot
+{
+    Vec3 position;
+    Vec3T<double> corner; // not normalized
+    Vec3T<double> step_x;
+    Vec3T<double> step_y;
+    uint64_t revision = 0;
+
+    // Most pixels row_directions() handles per call
+    static constexpr int BATCH = 64;
+
+    // Unit direction through pixel coordinates (x, y), pixel centers at integers
+    Vec3 direction(double x, double y) const
+    {
+        return Vec3((corner + step_x * x + step_y * y).normalize());
+    }
+
+    Ray ray(double x, double y) const
+    {
+        return Ray::from_unit(position, direction(x, y));
+    }
+
+    // Unit directions of pixels [x0, x1) in row y for the given sample,
+    // jittered like pixel_jitter(). Walks the row by adding step_x, then
+    // normalizes the batch in a separate loop the compiler can vectorize.
+    void row_directions(int x0, int x1, int y, uint32_t sample, Vec3 *out) const
+    {
+        const int count = std::min(x1 - x0, BATCH);
+        double xs[BATCH], ys[BATCH], zs[BATCH];
+        Vec3T<double> d = corner + step_x * x0 + step_y * y;
+        for (int k = 0; k < count; ++k)
+        {
+            double dx, dy;
+            pixel_jitter(x0 + k, y, sample, dx, dy);
+            const Vec3T<double> p = d + step_x * dx + step_y * dy;
+            xs[k] = p.x;
+            ys[k] = p.y;
+            zs[k] = p.z;
+            d = d + step_x;
+        }
+        for (int k = 0; k < count; ++k)
+        {
+            const double inv_length = 1.0 / std::sqrt(xs[k] * xs[k] + ys[k] * ys[k] + zs[k] * zs[k]);
+            xs[k] *= inv_length;
+            ys[k] *= inv_length;
+            zs[k] *= inv_length;
+        }
+        for (int k = 0; k < count; ++k)
+            out[k] = Vec3(static_cast<Real>(xs[k]), static_cast<Real>(ys[k]), static_cast<Real>(zs[k]));
+    }
+
+    // Rows of the inverse of [corner step_x step_y]. For an offset v from
+    // position, s = v.dot(r0) is its depth along the view (positive in front)
+    // and (v.dot(r1) / s, v.dot(r2) / s) its pixel coordinates.
+    void projection_rows(Vec3T<double> &r0, Vec3T<double> &r1, Vec3T<double> &r2) const
+    {
+        const double inv_det = 1.0 / corner.dot(step_x.cross(step_y));
+        r0 = step_x.cross(step_y) * inv_det;
+        r1 = step_y.cross(corner) * inv_det;
+        r2 = corner.cross(step_x) * inv_det;
+    }
+};
 
 class Camera
 {
@@ -30,6 +101,11 @@ public:
     double zoom;
     double aspect_ratio;
 
+    // Bumped by every method that changes the view, so the renderer knows
+    // when accumulated samples are stale. Bump it after writing the fields
+    // above directly.
+    uint64_t revision = 0;
+
     Camera(Vec3 position = Vec3(0.0, 0.0, 0.0))
         : position(position), world_up(Vec3(0.0, 1.0, 0.0)), yaw(-90.0), pitch(0.0), movement_speed(5.0), mouse_sensitivity(0.05), zoom(45.0), aspect_ratio(1.0)
     {
@@ -47,6 +123,7 @@ public:
             position = position - right * velocity;
         if (direction == RIGHT)
             position = position + right * velocity;
+        revision++;
     }
 
     void process_mouse(double xoffset, double yoffset, bool constrain_pitch = true)
@@ -66,14 +143,26 @@ public:
         }
 
         update_camera_vectors();
+        revision++;
+    }
+
+    void set_orientation(double new_yaw, double new_pitch)
+    {
+        yaw = new_yaw;
+        pitch = new_pitch;
+        update_camera_vectors();
+        revision++;
     }
 
     void process_scroll(double yoffset)
     {
         zoom -= yoffset;
         zoom = std::max(1.0, std::min(zoom, 90.0));
+        revision++;
     }
 
+    // Works in double whatever Real is: the direction is rounded once, after
+    // normalizing, so float rays don't drift from the pixel they belong to
     Ray get_ray(double u, double v) const
     {
         double theta = radians(zoom);
@@ -81,8 +170,28 @@ public:
         double viewport_height = 2.0 * h;
         double viewport_width = aspect_ratio * viewport_height;
 
-        Vec3 rd = front + right * (u * viewport_width) + up * (v * viewport_height);
-        return Ray(position, rd.normalize());
+        Vec3T<double> rd = Vec3T<double>(front) + Vec3T<double>(right) * (u * viewport_width) +
+                           Vec3T<double>(up) * (v * viewport_height);
+        return Ray::from_unit(position, Vec3(rd.normalize()));
+    }
+
+    // Pixel (x, y) of a width x height image maps to u = 2x / (width - 1) - 1
+    // and v = 1 - 2y / (height - 1), as in get_ray()
+    CameraSnapshot snapshot(int width, int height) const
+    {
+        double h = tan(radians(zoom) / 2);
+        double viewport_height = 2.0 * h;
+        double viewport_width = aspect_ratio * viewport_height;
+        Vec3T<double> horizontal = Vec3T<double>(right) * viewport_width;
+        Vec3T<double> vertical = Vec3T<double>(up) * viewport_height;
+
+        CameraSnapshot snap;
+        snap.position = position;
+        snap.corner = Vec3T<double>(front) - horizontal + vertical;
+        snap.step_x = horizontal * (2.0 / std::max(1, width - 1));
+        snap.step_y = vertical * (-2.0 / std::max(1, height - 1));
+        snap.revision = revision;
+        return snap;
     }
 
 private:
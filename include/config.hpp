@@ -8,11 +8,38 @@ struct Config
     static constexpr unsigned int DEFAULT_WIDTH = 800;
     static constexpr unsigned int DEFAULT_HEIGHT = 600;
 
+    // Internal resolution relative to the window. With DYNAMIC_RESOLUTION the
+    // scale starts here and moves within [MIN, MAX] to render in TARGET_FRAME_MS.
     static constexpr float RENDER_SCALE = 0.5f;
+    static constexpr bool DYNAMIC_RESOLUTION = true;
+    static constexpr double TARGET_FRAME_MS = 16.6;
+    static constexpr float MIN_RENDER_SCALE = 0.25f;
+    static constexpr float MAX_RENDER_SCALE = 1.0f;
+    // New jittered samples per pixel each frame; a still camera keeps adding
+    // them until MAX_ACCUMULATED_SAMPLES, after which frames are skipped
     static constexpr int SAMPLES_PER_PIXEL = 1;
+    static constexpr int MAX_ACCUMULATED_SAMPLES = 256;
+    // Adaptive sampling: once every pixel has ADAPTIVE_MIN_SAMPLES, only
+    // ADAPTIVE_BLOCK squares whose noisiest pixel's relative error is above
+    // ADAPTIVE_ERROR get more, up to ADAPTIVE_MAX_BOOST times
+    // SAMPLES_PER_PIXEL per frame. The block size keeps 8x8 packets whole.
+    static constexpr int ADAPTIVE_MIN_SAMPLES = 8;
+    static constexpr int ADAPTIVE_BLOCK = 8;
+    static constexpr float ADAPTIVE_ERROR = 0.02f;
+    static constexpr int ADAPTIVE_MAX_BOOST = 4;
     static constexpr double RAY_T_MIN = 0.001;
     static constexpr double RAY_T_MAX = 1000.0;
 
+    // Primary rays are traced in PACKET_SIZE x PACKET_SIZE packets (2, 4 or 8; 1 disables)
+    static constexpr int PACKET_SIZE = 8;
+    // Frames are split into TILE_SIZE x TILE_SIZE tiles handed out dynamically
+    static constexpr int TILE_SIZE = 32;
+
+    // Trace the next frame while the previous one uploads and displays,
+    // through PRESENT_BUFFERS (2 or 3) staging buffers
+    static constexpr bool PIPELINED_PRESENT = true;
+    static constexpr int PRESENT_BUFFERS = 3;
+
     static inline const int NUM_THREADS = std::thread::hardware_concurrency();
 
     static constexpr float DEFAULT_CAMERA_SPEED = 5.0f;
@@ -20,6 +47,23 @@ struct Config
     static constexpr double DEFAULT_FOV = 45.0;
 
     static constexpr double AMBIENT_STRENGTH = 0.1;
+
+    // Path tracing: surface hits per path, and hits after which Russian
+    // roulette may end a path early
+    static constexpr int MAX_PATH_DEPTH = 4;
+    static constexpr int RUSSIAN_ROULETTE_DEPTH = 2;
+
+    // Denoiser: a-trous passes, each spreading its taps twice as far, and
+    // the widths of its edge-stopping terms. Color differences are measured
+    // in standard deviations of the pixel's noise, estimated from its
+    // samples once it has DENOISE_TEMPORAL_SAMPLES and from its neighbours
+    // before; depth is relative to the pixel's own.
+    static constexpr int DENOISE_PASSES = 5;
+    static constexpr int DENOISE_TEMPORAL_SAMPLES = 4;
+    static constexpr float DENOISE_COLOR_SIGMA = 8.0f;
+    static constexpr float DENOISE_NORMAL_SIGMA = 1.0f;
+    static constexpr float DENOISE_DEPTH_SIGMA = 0.02f;
+    static constexpr float DENOISE_ALBEDO_SIGMA = 0.1f;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,250 @@
+#ifndef DENOISER_HPP
+#define DENOISER_HPP
+
+#include <algorithm>
+#include <limits>
+#include "aligned_allocator.hpp"
+#include "config.hpp"
+#include "framebuffer.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include "vec3.hpp"
+
+// Sums over samples of a pixel's primary hit features: normal, distance
+// along the ray and albedo. Rays that leave the scene add no normal or
+// albedo, at Config::RAY_T_MAX.
+struct PixelGuides
+{
+    Vec3 normal;
+    Real depth = 0;
+    Vec3 albedo;
+
+    void add_hit(const Vec3 &hit_normal, Real t, const Vec3 &hit_albedo)
+    {
+        normal = normal + hit_normal;
+        depth += t;
+        albedo = albedo + hit_albedo;
+    }
+    void add_miss() { depth += static_cast<Real>(Config::RAY_T_MAX); }
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al., "Edge-Avoiding
+// A-Trous Wavelet Transform for fast Global Illumination Filtering", HPG
+// 2010) over a framebuffer's mean colors. Each of Config::DENOISE_PASSES
+// passes averages every pixel with the 3x3 pixels around it, spaced twice
+// as far apart as in the pass before, so five passes reach 31 pixels for 9
+// taps each. A tap counts for less the further its normal, depth, albedo and
+// color are from the centre's, which keeps edges sharp. Color differences
+// count in units of the centre's noise, estimated from its samples, and
+// tighten with every pass, so converged pixels come out as they went in.
+// The cost depends only on the resolution, not on the scene or the sample
+// count.
+//
+// The guides are the mean normal, depth and albedo of each pixel's primary
+// hits, accumulated alongside its color. A pixel on a silhouette has guides
+// between those of both sides, so neither pulls its blended color over.
+class Denoiser
+{
+public:
+    // Sizes the planes for a width x height image. Guides are kept while
+    // the size stays the same, and resizing within the largest size seen
+    // does not allocate.
+    void resize(int width, int height);
+
+    // Folds samples new samples of pixel (x, y)'s guides into their means,
+    // like Framebuffer::accumulate_pixel; call it before the samples' colors
+    // are added to buffer
+    void accumulate_guides(const Framebuffer &buffer, int x, int y, const PixelGuides &sum, int samples);
+
+    // Filters the mean colors of buffer, which must be the size last given
+    // to resize(), into output(). Workers filter bands of band rows.
+    void denoise(const Framebuffer &buffer, ThreadPool &pool, int band);
+    // Filtered colors, laid out like buffer.get_means()
+    const float *output() const { return output_.data(); }
+
+private:
+    // Reach of the last pass; a multiple of 16 keeps rows aligned
+    static constexpr int BORDER = std::max(16, 1 << (Config::DENOISE_PASSES - 1));
+
+    enum Plane
+    {
+        COLOR = 0,   // three planes, and three more to filter into
+        COLOR_WEIGHT = 6,
+        NORMAL = 7,  // three
+        DEPTH = 10,
+        ALBEDO = 11, // three
+        PLANE_COUNT = 14
+    };
+
+    int width_ = 0;
+    int height_ = 0;
+    size_t pitch_ = 0;       // floats per plane row, border included
+    size_t plane_size_ = 0;  // floats per plane
+    AlignedVector<float> planes_;
+    AlignedVector<float> output_;
+
+    float *plane(int index) { return planes_.data() + index * plane_size_; }
+    size_t index(int x, int y) const { return static_cast<size_t>(y + BORDER) * pitch_ + static_cast<size_t>(x + BORDER); }
+};
+
+inline void Denoiser::resize(int width, int height)
+{
+    if (width == width_ && height == height_)
+        return;
+
+    width_ = width;
+    height_ = height;
+    pitch_ = (static_cast<size_t>(width) + 2 * BORDER + 15) & ~static_cast<size_t>(15);
+    plane_size_ = pitch_ * (static_cast<size_t>(height) + 2 * BORDER);
+
+    // The border is never written again: no color, and infinitely far, so
+    // taps landing there get no weight
+    planes_.assign(plane_size_ * PLANE_COUNT, 0.0f);
+    std::fill(plane(DEPTH), plane(DEPTH) + plane_size_, std::numeric_limits<float>::infinity());
+    output_.assign(static_cast<size_t>((width + 3) & ~3) * height * 4, 0.0f);
+}
+
+inline void Denoiser::accumulate_guides(const Framebuffer &buffer, int x, int y, const PixelGuides &sum, int samples)
+{
+    // Guide planes outlive a reset of the framebuffer; its first samples
+    // start the means afresh
+    const float before = buffer.get_accumulated_samples() == 0 ? 0.0f : static_cast<float>(buffer.get_sample_count(x, y));
+    const float inv_total = 1.0f / (before + samples);
+    const size_t i = index(x, y);
+    auto fold = [&](int p, Real value)
+    {
+        float &mean = plane(p)[i];
+        mean = before == 0.0f ? static_cast<float>(value) * inv_total
+                              : mean + (static_cast<float>(value) - samples * mean) * inv_total;
+    };
+    fold(NORMAL, sum.normal.x);
+    fold(NORMAL + 1, sum.normal.y);
+    fold(NORMAL + 2, sum.normal.z);
+    fold(DEPTH, sum.depth);
+    fold(ALBEDO, sum.albedo.x);
+    fold(ALBEDO + 1, sum.albedo.y);
+    fold(ALBEDO + 2, sum.albedo.z);
+}
+
+inline void Denoiser::denoise(const Framebuffer &buffer, ThreadPool &pool, int band)
+{
+    const float *means = buffer.get_means();
+    const size_t stride = static_cast<size_t>(buffer.get_stride());
+    const size_t rows = static_cast<size_t>(height_);
+    band = std::max(1, band);
+
+    // Into planes, with each pixel's color weight from how noisy its mean
+    // is: the variance of the mean from its samples' moments once it has
+    // DENOISE_TEMPORAL_SAMPLES, before that from the spread of its
+    // neighbours' luminances
+    const float *moments = buffer.get_moments();
+    pool.parallel_for(0, rows, static_cast<size_t>(band), [&](size_t y0, size_t y1)
+                      {
+        float *r = plane(COLOR), *g = plane(COLOR + 1), *b = plane(COLOR + 2);
+        float *variance = plane(COLOR_WEIGHT);
+        for (size_t y = y0; y < y1; ++y)
+        {
+            const float *mean = means + y * stride * 4;
+            const float *moment = moments + y * stride;
+            const size_t row = index(0, static_cast<int>(y));
+            for (int x = 0; x < width_; ++x, mean += 4)
+            {
+                r[row + x] = mean[0];
+                g[row + x] = mean[1];
+                b[row + x] = mean[2];
+                const float l = luminance(Vec3(mean[0], mean[1], mean[2]));
+                variance[row + x] = mean[3] >= Config::DENOISE_TEMPORAL_SAMPLES
+                                        ? std::max(0.0f, moment[x] - l * l) / (mean[3] - 1.0f)
+                                        : -1.0f;
+            }
+        } });
+
+    // Noiseless pixels still let differences of about 1% through
+    const float color_sigma2 = Config::DENOISE_COLOR_SIGMA * Config::DENOISE_COLOR_SIGMA;
+    const float noise_floor = 1e-4f;
+    pool.parallel_for(0, rows, static_cast<size_t>(band), [&](size_t y0, size_t y1)
+                      {
+        const float *r = plane(COLOR), *g = plane(COLOR + 1), *b = plane(COLOR + 2);
+        float *weight = plane(COLOR_WEIGHT);
+        for (int y = static_cast<int>(y0); y < static_cast<int>(y1); ++y)
+        {
+            for (int x = 0; x < width_; ++x)
+            {
+                float &w = weight[index(x, y)];
+                if (w < 0.0f)
+                {
+                    float sum = 0.0f, squares = 0.0f;
+                    int count = 0;
+                    for (int v = std::max(0, y - 1); v <= std::min(height_ - 1, y + 1); ++v)
+                    {
+                        for (int u = std::max(0, x - 1); u <= std::min(width_ - 1, x + 1); ++u)
+                        {
+                            const size_t i = index(u, v);
+                            const float l = luminance(Vec3(r[i], g[i], b[i]));
+                            sum += l;
+                            squares += l * l;
+                            count++;
+                        }
+                    }
+                    const float l = sum / count;
+                    w = std::max(0.0f, squares / count - l * l);
+                }
+                w = 1.0f / (color_sigma2 * w + noise_floor);
+            }
+        } });
+
+    const DenoiseRowFn denoise_row = simd_kernels().denoise_row;
+    DenoisePlanes planes{};
+    planes.color_weight = plane(COLOR_WEIGHT);
+    planes.depth = plane(DEPTH);
+    for (int c = 0; c < 3; ++c)
+    {
+        planes.normal[c] = plane(NORMAL + c);
+        planes.albedo[c] = plane(ALBEDO + c);
+    }
+    DenoiseWeights weights{1.0f, 1.0f / (Config::DENOISE_NORMAL_SIGMA * Config::DENOISE_NORMAL_SIGMA),
+                           1.0f / (Config::DENOISE_DEPTH_SIGMA * Config::DENOISE_DEPTH_SIGMA),
+                           1.0f / (Config::DENOISE_ALBEDO_SIGMA * Config::DENOISE_ALBEDO_SIGMA)};
+
+    // Passes alternate between the two sets of color planes; every pass
+    // needs the whole of the last one, so each waits for it
+    for (int pass = 0; pass < Config::DENOISE_PASSES; ++pass)
+    {
+        const int from = pass % 2 == 0 ? COLOR : COLOR + 3;
+        const int to = pass % 2 == 0 ? COLOR + 3 : COLOR;
+        for (int c = 0; c < 3; ++c)
+        {
+            planes.color[c] = plane(from + c);
+            planes.out[c] = plane(to + c);
+        }
+        const size_t step = static_cast<size_t>(1) << pass;
+        pool.parallel_for(0, rows, static_cast<size_t>(band), [&](size_t y0, size_t y1)
+                          {
+            for (size_t y = y0; y < y1; ++y)
+                denoise_row(planes, index(0, static_cast<int>(y)), static_cast<size_t>(width_), step, step * pitch_,
+                            weights); });
+        // Halving the color width each pass, as the noise left shrinks
+        weights.color *= 4.0f;
+    }
+
+    // Back to RGBA; alpha keeps the sample count
+    const int last = Config::DENOISE_PASSES % 2 == 0 ? COLOR : COLOR + 3;
+    pool.parallel_for(0, rows, static_cast<size_t>(band), [&](size_t y0, size_t y1)
+                      {
+        const float *r = plane(last), *g = plane(last + 1), *b = plane(last + 2);
+        for (size_t y = y0; y < y1; ++y)
+        {
+            const float *mean = means + y * stride * 4;
+            float *out = output_.data() + y * stride * 4;
+            const size_t row = index(0, static_cast<int>(y));
+            for (int x = 0; x < width_; ++x, mean += 4, out += 4)
+            {
+                out[0] = r[row + x];
+                out[1] = g[row + x];
+                out[2] = b[row + x];
+                out[3] = mean[3];
+            }
+        } });
+}
+
+#endif
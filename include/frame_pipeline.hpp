@@ -0,0 +1,110 @@
+#ifndef FRAME_PIPELINE_HPP
+#define FRAME_PIPELINE_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "camera.hpp"
+#include "framebuffer.hpp"
+#include "instrumentation.hpp"
+#include "renderer.hpp"
+#include "scene.hpp"
+
+// Runs Renderer::render on a thread of its own, so the caller can upload and
+// present the previous frame while the next one traces. One frame is in
+// flight at a time; the thread sleeps in between and nothing is allocated
+// per frame.
+class FramePipeline
+{
+public:
+    explicit FramePipeline(Renderer &renderer);
+    ~FramePipeline();
+
+    FramePipeline(const FramePipeline &) = delete;
+    FramePipeline &operator=(const FramePipeline &) = delete;
+
+    // Starts a frame. The camera is snapshotted, so the caller may keep moving it;
+    // the scene, buffer and renderer must be left alone until wait() returns.
+    void submit(const Scene &scene, const Camera &camera, Framebuffer &buffer);
+
+    // Blocks until the submitted frame is done (returns at once if none is)
+    void wait();
+
+private:
+    Renderer &renderer_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+
+    CameraSnapshot camera_;
+    const Scene *scene_;
+    Framebuffer *buffer_;
+    bool pending_;
+    bool stop_;
+
+    void run();
+};
+
+inline FramePipeline::FramePipeline(Renderer &renderer)
+    : renderer_(renderer), scene_(nullptr), buffer_(nullptr), pending_(false), stop_(false)
+{
+    thread_ = std::thread([this]
+                          { run(); });
+}
+
+inline FramePipeline::~FramePipeline()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this]
+                        { return !pending_; });
+        stop_ = true;
+    }
+    condition_.notify_all();
+    thread_.join();
+}
+
+inline void FramePipeline::submit(const Scene &scene, const Camera &camera, Framebuffer &buffer)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this]
+                        { return !pending_; });
+        camera_ = camera.snapshot(buffer.get_width(), buffer.get_height());
+        scene_ = &scene;
+        buffer_ = &buffer;
+        pending_ = true;
+    }
+    condition_.notify_all();
+}
+
+inline void FramePipeline::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this]
+                    { return !pending_; });
+}
+
+inline void FramePipeline::run()
+{
+    Instrumentation::name_thread("frame pipeline");
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;)
+    {
+        condition_.wait(lock, [this]
+                        { return pending_ || stop_; });
+        if (stop_)
+            return;
+
+        // The submitter waits for pending_ to clear before touching any of
+        // this, so the lock can be dropped while tracing
+        lock.unlock();
+        renderer_.render(*scene_, camera_, *buffer_);
+        lock.lock();
+
+        pending_ = false;
+        condition_.notify_all();
+    }
+}
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef FRAMEBUFFER_HPP
+#define FRAMEBUFFER_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "aligned_allocator.hpp"
+#include "simd.hpp"
+#include "vec3.hpp"
+
+// How resolve() turns the linear color into 8-bit pixels
+struct ToneMapping
+{
+    float exposure = 1.0f;
+    bool gamma = false;  // encode with gamma 2 (a square root) before quantizing
+    bool dither = false; // 4x4 ordered dither instead of truncation banding
+};
+
+// Rec. 709 luma of a linear color, what adaptive sampling measures noise in
+inline float luminance(const Vec3 &color)
+{
+    return static_cast<float>(0.2126 * color.x + 0.7152 * color.y + 0.0722 * color.z);
+}
+
+// CPU-only pixel storage the Renderer writes into. RenderBuffer layers the
+// OpenGL texture on top of this; the headless tool uses it directly.
+//
+// Workers only update float RGBA running means in a 64-byte-aligned buffer
+// whose rows are padded to whole cache lines, so tiles four pixels wide
+// never share a line. Alpha holds the pixel's sample count, so pixels may
+// have different counts. resolve() later turns the means into the RGBA8
+// image in one SIMD pass.
+class Framebuffer
+{
+public:
+    Framebuffer(int width, int height);
+    virtual ~Framebuffer() = default;
+
+    // Resizing within the reserved capacity does not reallocate
+    virtual void resize(int width, int height);
+    void reserve(int width, int height);
+    void clear();
+
+    // Progressive rendering: folds samples new samples of pixel (x, y), which
+    // must lie inside the buffer, into its running mean, given their sum and
+    // the sum of their squared luminances. Once every pixel has had a frame's
+    // samples, finish_samples() moves the count all pixels share forward.
+    // Until the first finish_samples() after a reset, new samples replace
+    // whatever the pixel held.
+    void accumulate_pixel(int x, int y, const Vec3 &sample_sum, int samples, float luminance_squares);
+    void finish_samples(int samples) { accumulated_samples_ += samples; }
+    void reset_accumulation() { accumulated_samples_ = 0; }
+    int get_accumulated_samples() const { return accumulated_samples_; }
+
+    // Writes rows [y0, y1) of the 8-bit image from the mean of the
+    // accumulated samples, or from colors laid out like get_means(), such as
+    // the denoiser's. Disjoint row ranges may resolve in parallel.
+    void resolve(int y0, int y1, const float *means = nullptr);
+    void set_tone_mapping(const ToneMapping &tone_mapping) { tone_mapping_ = tone_mapping; }
+    const ToneMapping &get_tone_mapping() const { return tone_mapping_; }
+
+    int get_width() const { return width_; }
+    int get_height() const { return height_; }
+    // Pixels per row of get_means(), a multiple of 4
+    int get_stride() const { return stride_; }
+    // Per pixel, mean RGB and sample count; 64-byte aligned
+    const float *get_means() const { return accumulation_.data(); }
+    // Per pixel, mean squared luminance of the samples, get_stride() per row
+    const float *get_moments() const { return moments_.data(); }
+    // RGBA8, rows top to bottom
+    const std::vector<unsigned char> &get_pixels() const { return pixels_; }
+    // The 8-bit image as last written; differs from get_pixels() when a
+    // subclass redirects the output (see set_output)
+    const unsigned char *get_output() const { return output_; }
+    // Unclamped mean color of a pixel
+    Vec3 get_color(int x, int y) const;
+    int get_sample_count(int x, int y) const { return static_cast<int>(accumulation_[(static_cast<size_t>(y) * stride_ + x) * 4 + 3]); }
+    // Standard error of the pixel's mean luminance estimated from the
+    // spread of its samples, relative to that mean (floored at 0.1 so dark
+    // pixels don't demand exact blacks)
+    float get_error(int x, int y) const;
+
+protected:
+    int width_;
+    int height_;
+    int stride_; // pixels per row of accumulation_, a multiple of 4
+    std::vector<unsigned char> pixels_;
+    unsigned char *output_; // where resolve() writes the 8-bit image, pixels_ by default
+    AlignedVector<float> accumulation_; // per pixel, mean RGB of the accumulated samples and their count
+    AlignedVector<float> moments_;      // per pixel, mean squared luminance of the samples
+    int accumulated_samples_;
+    ToneMapping tone_mapping_;
+
+    // Sends the 8-bit image to memory of at least width * height * 4 bytes
+    // owned by the caller, such as a mapped pixel buffer; nullptr goes back
+    // to pixels_
+    void set_output(unsigned char *memory);
+
+    static int padded_stride(int width) { return (width + 3) & ~3; }
+};
+
+inline Framebuffer::Framebuffer(int width, int height)
+    : width_(width), height_(height), stride_(padded_stride(width)), pixels_(width * height * 4, 0),
+      accumulation_(static_cast<size_t>(stride_) * height * 4, 0.0f), moments_(static_cast<size_t>(stride_) * height, 0.0f),
+      accumulated_samples_(0)
+{
+    output_ = pixels_.data();
+}
+
+inline void Framebuffer::resize(int width, int height)
+{
+    width_ = width;
+    height_ = height;
+    stride_ = padded_stride(width);
+    const bool internal_output = output_ == pixels_.data();
+    pixels_.resize(width * height * 4);
+    if (internal_output)
+    {
+        output_ = pixels_.data();
+    }
+    accumulation_.resize(static_cast<size_t>(stride_) * height * 4);
+    moments_.resize(static_cast<size_t>(stride_) * height);
+    clear();
+}
+
+inline void Framebuffer::reserve(int width, int height)
+{
+    pixels_.reserve(width * height * 4);
+    accumulation_.reserve(static_cast<size_t>(padded_stride(width)) * height * 4);
+    moments_.reserve(static_cast<size_t>(padded_stride(width)) * height);
+}
+
+inline void Framebuffer::accumulate_pixel(int x, int y, const Vec3 &sample_sum, int samples, float luminance_squares)
+{
+    const size_t pixel = static_cast<size_t>(y) * stride_ + x;
+    float *mean = &accumulation_[pixel * 4];
+    float &moment = moments_[pixel];
+    // The first frame overwrites whatever an earlier view left behind
+    if (accumulated_samples_ == 0)
+    {
+        const float inv_samples = 1.0f / samples;
+        mean[0] = static_cast<float>(sample_sum.x) * inv_samples;
+        mean[1] = static_cast<float>(sample_sum.y) * inv_samples;
+        mean[2] = static_cast<float>(sample_sum.z) * inv_samples;
+        mean[3] = static_cast<float>(samples);
+        moment = luminance_squares * inv_samples;
+        return;
+    }
+
+    const float total = mean[3] + samples;
+    const float inv_total = 1.0f / total;
+    mean[0] += (static_cast<float>(sample_sum.x) - samples * mean[0]) * inv_total;
+    mean[1] += (static_cast<float>(sample_sum.y) - samples * mean[1]) * inv_total;
+    mean[2] += (static_cast<float>(sample_sum.z) - samples * mean[2]) * inv_total;
+    mean[3] = total;
+    moment += (luminance_squares - samples * moment) * inv_total;
+}
+
+inline void Framebuffer::resolve(int y0, int y1, const float *means)
+{
+    // Bayer matrix; thresholds (b + 0.5) / 16 average out to no bias
+    static constexpr int BAYER[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+
+    // Patterns over four pixels. Alpha has zero gain and comes out 255 from
+    // its offset, whatever sample count it holds.
+    alignas(64) float gain[16];
+    alignas(64) float offset[16];
+    for (int i = 0; i < 16; ++i)
+        gain[i] = i % 4 == 3 ? 0.0f : tone_mapping_.exposure;
+
+    const ResolvePixelsFn resolve_pixels = simd_kernels().resolve_pixels;
+    if (!means)
+        means = accumulation_.data();
+    for (int y = y0; y < y1; ++y)
+    {
+        for (int i = 0; i < 16; ++i)
+            offset[i] = i % 4 == 3 ? 255.0f : tone_mapping_.dither ? (BAYER[y & 3][i / 4] + 0.5f) / 16.0f : 0.0f;
+        resolve_pixels(means + static_cast<size_t>(y) * stride_ * 4, static_cast<size_t>(width_) * 4, gain, offset,
+                       tone_mapping_.dither ? 255.0f : 255.99f, tone_mapping_.gamma, output_ + static_cast<size_t>(y) * width_ * 4);
+    }
+}
+
+inline Vec3 Framebuffer::get_color(int x, int y) const
+{
+    const float *mean = &accumulation_[(static_cast<size_t>(y) * stride_ + x) * 4];
+    return Vec3(mean[0], mean[1], mean[2]);
+}
+
+inline float Framebuffer::get_error(int x, int y) const
+{
+    const size_t pixel = static_cast<size_t>(y) * stride_ + x;
+    const float *mean = &accumulation_[pixel * 4];
+    const float count = mean[3];
+    if (count < 2.0f)
+        return std::numeric_limits<float>::infinity();
+
+    const float l = luminance(Vec3(mean[0], mean[1], mean[2]));
+    // Unbiased sample variance from the moments
+    const float variance = std::max(0.0f, moments_[pixel] - l * l) * count / (count - 1.0f);
+    return std::sqrt(variance / count) / std::max(l, 0.1f);
+}
+
+inline void Framebuffer::set_output(unsigned char *memory)
+{
+    output_ = memory ? memory : pixels_.data();
+}
+
+inline void Framebuffer::clear()
+{
+    std::fill(pixels_.begin(), pixels_.end(), 0);
+    if (output_ != pixels_.data())
+    {
+        std::fill(output_, output_ + width_ * height_ * 4, 0);
+    }
+    std::fill(accumulation_.begin(), accumulation_.end(), 0.0f);
+    std::fill(moments_.begin(), moments_.end(), 0.0f);
+    accumulated_samples_ = 0;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <algorithm>
+#include <cmath>
+#include "vec3.hpp"
+#include "aabb.hpp"
+
+// Four planes through the shared origin that bound every ray of a packet.
+// Built from the corner rays of the pixel rectangle; rays in between are
+// positive combinations of the corners, so they lie inside.
+struct PacketFrustum
+{
+    // Relative slack for rounding in the plane normals and culling distances,
+    // so edge rays are never lost
+    static constexpr Real SLACK = sizeof(Real) == 4 ? Real(1e-5) : Real(1e-9);
+
+    Vec3 origin;
+    Vec3 direction;  // central direction, for front-to-back ordering
+    Vec3 normals[4]; // pointing into the frustum
+
+    // corners in order around the rectangle
+    void build(const Vec3 &ray_origin, const Vec3 corners[4])
+    {
+        origin = ray_origin;
+        Vec3 center = corners[0] + corners[1] + corners[2] + corners[3];
+        direction = center.normalize();
+        for (int i = 0; i < 4; ++i)
+        {
+            Vec3 n = corners[i].cross(corners[(i + 1) % 4]);
+            Real length = n.length();
+            // Degenerate (one pixel wide) packets give a zero normal, which culls nothing
+            if (length > 0)
+                n = n / length;
+            normals[i] = n.dot(center) < 0 ? n * Real(-1) : n;
+        }
+    }
+
+    bool cull_sphere(const Vec3 &center, Real radius) const
+    {
+        Vec3 oc = center - origin;
+        Real margin = radius + SLACK * (std::abs(oc.x) + std::abs(oc.y) + std::abs(oc.z));
+        for (const Vec3 &n : normals)
+        {
+            if (n.dot(oc) < -margin)
+                return true;
+        }
+        return false;
+    }
+
+    bool cull_box(const AABB &box) const
+    {
+        for (const Vec3 &n : normals)
+        {
+            // Corner of the box furthest along the normal
+            Vec3 p(n.x >= 0 ? box.max.x : box.min.x,
+                   n.y >= 0 ? box.max.y : box.min.y,
+                   n.z >= 0 ? box.max.z : box.min.z);
+            Vec3 op = p - origin;
+            if (n.dot(op) < -SLACK * (std::abs(op.x) + std::abs(op.y) + std::abs(op.z)))
+                return true;
+        }
+        return false;
+    }
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef IMAGE_IO_HPP
+#define IMAGE_IO_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "framebuffer.hpp"
+
+// Binary PPM (P6), 8-bit RGB, rows top to bottom.
+inline bool write_ppm(const std::string &path, const Framebuffer &buffer)
+{
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+    {
+        std::cerr << "Failed to open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    const int width = buffer.get_width();
+    const int height = buffer.get_height();
+    out << "P6\n"
+        << width << " " << height << "\n255\n";
+
+    // The buffer is RGBA; drop alpha a row at a time
+    const unsigned char *pixels = buffer.get_pixels().data();
+    std::vector<unsigned char> row(width * 3);
+    for (int j = 0; j < height; ++j)
+    {
+        const unsigned char *source = pixels + static_cast<size_t>(j) * width * 4;
+        for (int i = 0; i < width; ++i)
+        {
+            row[i * 3] = source[i * 4];
+            row[i * 3 + 1] = source[i * 4 + 1];
+            row[i * 3 + 2] = source[i * 4 + 2];
+        }
+        out.write(reinterpret_cast<const char *>(row.data()), row.size());
+    }
+    return static_cast<bool>(out);
+}
+
+// Color PFM, 32-bit float RGB, rows bottom to top, with the unclamped mean
+// color before tone mapping, or colors laid out like buffer.get_means()
+inline bool write_pfm(const std::string &path, const Framebuffer &buffer, const float *means = nullptr)
+{
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+    {
+        std::cerr << "Failed to open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    const int width = buffer.get_width();
+    const int height = buffer.get_height();
+
+    // Negative scale marks little-endian data
+    uint16_t probe = 1;
+    unsigned char first_byte;
+    std::memcpy(&first_byte, &probe, 1);
+    const bool little_endian = first_byte == 1;
+
+    out << "PF\n"
+        << width << " " << height << "\n"
+        << (little_endian ? "-1.0" : "1.0") << "\n";
+
+    if (!means)
+        means = buffer.get_means();
+    std::vector<float> row(width * 3);
+    for (int j = height - 1; j >= 0; --j)
+    {
+        const float *source = means + static_cast<size_t>(j) * buffer.get_stride() * 4;
+        for (int i = 0; i < width; ++i)
+        {
+            row[i * 3] = source[i * 4];
+            row[i * 3 + 1] = source[i * 4 + 1];
+            row[i * 3 + 2] = source[i * 4 + 2];
+        }
+        out.write(reinterpret_cast<const char *>(row.data()), row.size() * sizeof(float));
+    }
+    return static_cast<bool>(out);
+}
+
+// Picks the format from the file extension (.pfm, anything else is PPM).
+// PFM takes its colors from means when given, as write_pfm.
+inline bool write_image(const std::string &path, const Framebuffer &buffer, const float *means = nullptr)
+{
+    const std::string ext = ".pfm";
+    if (path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0)
+    {
+        return write_pfm(path, buffer, means);
+    }
+    return write_ppm(path, buffer);
+}
+
+#endif
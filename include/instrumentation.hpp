@@ -0,0 +1,139 @@
+#ifndef INSTRUMENTATION_HPP
+#define INSTRUMENTATION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Hot-path telemetry: counters of rays, sphere tests and hits, and timed
+// spans (frames, chunks, tiles, uploads) exported as a Chrome trace that
+// chrome://tracing and ui.perfetto.dev open.
+//
+// Compiled in with -DRAYTRACER_INSTRUMENTATION=ON (the default); off, every
+// hook below is an empty inline function. At runtime nothing is recorded
+// until Instrumentation::set_enabled(true).
+//
+// Counters and spans go to buffers owned by the recording thread, so the hot
+// path touches no shared atomics and takes no locks. The other side of that:
+// reading them (the renderer's per-frame totals, write_chrome_trace) is only
+// safe while no frame is rendering.
+
+// Totals for the calling thread since it started
+struct TraceCounters
+{
+    uint64_t rays = 0;
+    uint64_t sphere_tests = 0;
+    uint64_t triangle_tests = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+class Instrumentation
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+    static void set_enabled(bool enabled);
+
+    static TraceCounters &counters() { return thread_counters_; }
+    static void count_rays(uint64_t count);
+    static void count_sphere_tests(uint64_t count);
+    static void count_triangle_tests(uint64_t count);
+    static void count_hit(bool hit);
+
+    // Spans on the calling thread; arg shows up in the trace viewer
+    static void record_span(const char *name, Clock::time_point start, Clock::time_point end, int64_t arg = 0);
+    // A value plotted over time, such as rays per frame
+    static void record_value(const char *name, int64_t value);
+    // Shown for the calling thread in the trace; name must outlive the process
+    static void name_thread(const char *name);
+
+    // Writes every thread's buffered events; false if the file can't be written
+    static bool write_chrome_trace(const std::string &path);
+    // Drops buffered events, e.g. to trace only what follows
+    static void clear_events();
+
+    // Events each thread keeps; older ones are overwritten
+    static constexpr size_t EVENTS_PER_THREAD = 1 << 15;
+
+private:
+    static inline std::atomic<bool> enabled_{false};
+    static inline thread_local TraceCounters thread_counters_;
+};
+
+// Records a span from construction to destruction when instrumentation is on
+class ScopedSpan
+{
+public:
+    explicit ScopedSpan(const char *name, int64_t arg = 0);
+    ~ScopedSpan();
+
+    ScopedSpan(const ScopedSpan &) = delete;
+    ScopedSpan &operator=(const ScopedSpan &) = delete;
+
+    void set_arg(int64_t arg) { arg_ = arg; }
+
+private:
+    const char *name_;
+    int64_t arg_;
+    bool active_;
+    Instrumentation::Clock::time_point start_;
+};
+
+#ifdef RAYTRACER_INSTRUMENTATION
+
+inline void Instrumentation::count_rays(uint64_t count)
+{
+    thread_counters_.rays += count;
+}
+
+inline void Instrumentation::count_sphere_tests(uint64_t count)
+{
+    thread_counters_.sphere_tests += count;
+}
+
+inline void Instrumentation::count_triangle_tests(uint64_t count)
+{
+    thread_counters_.triangle_tests += count;
+}
+
+inline void Instrumentation::count_hit(bool hit)
+{
+    thread_counters_.hits += hit;
+    thread_counters_.misses += !hit;
+}
+
+inline ScopedSpan::ScopedSpan(const char *name, int64_t arg)
+    : name_(name), arg_(arg), active_(Instrumentation::enabled())
+{
+    if (active_)
+        start_ = Instrumentation::Clock::now();
+}
+
+inline ScopedSpan::~ScopedSpan()
+{
+    if (active_)
+        Instrumentation::record_span(name_, start_, Instrumentation::Clock::now(), arg_);
+}
+
+#else
+
+inline void Instrumentation::set_enabled(bool) {}
+inline void Instrumentation::count_rays(uint64_t) {}
+inline void Instrumentation::count_sphere_tests(uint64_t) {}
+inline void Instrumentation::count_triangle_tests(uint64_t) {}
+inline void Instrumentation::count_hit(bool) {}
+inline void Instrumentation::record_span(const char *, Clock::time_point, Clock::time_point, int64_t) {}
+inline void Instrumentation::record_value(const char *, int64_t) {}
+inline void Instrumentation::name_thread(const char *) {}
+inline bool Instrumentation::write_chrome_trace(const std::string &) { return false; }
+inline void Instrumentation::clear_events() {}
+
+inline ScopedSpan::ScopedSpan(const char *name, int64_t arg) : name_(name), arg_(arg), active_(false) {}
+inline ScopedSpan::~ScopedSpan() {}
+
+#endif
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+// A whole file mapped read-only, so its pages load on first touch instead of
+// being read up front. Where mmap is unavailable (Windows) the file is read
+// into a 64-byte aligned buffer instead. The data starts page aligned.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Replaces any previous mapping; prints why and returns false on failure
+    bool open(const std::string &path);
+    void close();
+
+    const unsigned char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const unsigned char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif
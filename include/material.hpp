@@ -0,0 +1,12 @@
+#ifndef MATERIAL_HPP
+#define MATERIAL_HPP
+
+#include "vec3.hpp"
+
+// Surface properties, stored once in the scene's material table and shared
+// by every sphere and mesh instance that names them
+struct Material {
+    Vec3 albedo;
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "aabb.hpp"
+#include "bvh.hpp"
+#include "instrumentation.hpp"
+#include "ray.hpp"
+#include "simd.hpp"
+#include "transform.hpp"
+#include "triangle_soa.hpp"
+#include "vec3.hpp"
+
+// Triangles over a shared vertex buffer, with the bottom-level BVH (BLAS)
+// that rays traverse in object space. Built once; every instance of the mesh
+// reads this one copy.
+class Mesh
+{
+public:
+    std::vector<Vec3> positions;
+    std::vector<uint32_t> indices; // three per triangle, counterclockwise seen from the front
+
+    size_t triangle_count() const { return indices.size() / 3; }
+
+    // Builds the BLAS and the SIMD layout; call after filling the buffers
+    void build();
+    bool built() const { return soa_.size() == triangle_count(); }
+    const AABB &bounds() const { return bounds_; }
+
+    // Nearest triangle in (t_min, t_closest) as a slot for normal(); updates
+    // t_closest. The ray direction need not be unit length.
+    bool hit(const Ray &ray, Real t_min, Real &t_closest, size_t &slot) const;
+    // Same, testing every triangle without the BLAS
+    bool hit_linear(const Ray &ray, Real t_min, Real &t_closest, size_t &slot) const;
+
+    // Whether any triangle is hit in (t_min, t_max); stops at the first
+    bool occluded(const Ray &ray, Real t_min, Real t_max) const;
+    bool occluded_linear(const Ray &ray, Real t_min, Real t_max) const;
+
+    // Geometric normal of the triangle in a slot, not normalized
+    Vec3 normal(size_t slot) const;
+
+private:
+    BVH blas_;
+    TriangleSoA soa_;
+    AABB bounds_;
+};
+
+// One placement of a mesh. Costs the same hundred-odd bytes however large
+// the mesh is.
+struct MeshInstance
+{
+    uint32_t mesh;
+    Transform object_to_world;
+    Transform world_to_object;
+    uint32_t material;
+};
+
+inline void Mesh::build()
+{
+    const size_t count = triangle_count();
+    std::vector<AABB> boxes(count);
+    bounds_ = AABB();
+    for (size_t i = 0; i < count; ++i)
+    {
+        for (int corner = 0; corner < 3; ++corner)
+            boxes[i].grow(positions[indices[3 * i + corner]]);
+        bounds_.grow(boxes[i]);
+    }
+
+    blas_.build(boxes.data(), count);
+    soa_.build(positions, indices, blas_.indices().data(), count);
+}
+
+inline bool Mesh::hit(const Ray &ray, Real t_min, Real &t_closest, size_t &slot) const
+{
+    const TriangleSpan span = soa_.span();
+    const NearestTriangleFn nearest_triangle = simd_kernels().nearest_triangle;
+    const Real inf = std::numeric_limits<Real>::infinity();
+    bool found = false;
+    return blas_.traverse(ray, t_min, t_closest, [&](size_t begin, size_t end, Real &t)
+                          {
+        Instrumentation::count_triangle_tests(end - begin);
+        // Triangles sharing an edge can report the same t. Admitting ties and
+        // keeping the lower slot picks the one hit_linear does, whatever order
+        // the leaves come in.
+        Real leaf_t = std::nextafter(t, inf);
+        size_t leaf_slot;
+        if (!nearest_triangle(span, begin, end, ray, t_min, leaf_t, leaf_slot))
+            return false;
+        if (!(leaf_t < t || (found && leaf_t == t && leaf_slot < slot)))
+            return false;
+        t = leaf_t;
+        slot = leaf_slot;
+        found = true;
+        return true; });
+}
+
+inline bool Mesh::hit_linear(const Ray &ray, Real t_min, Real &t_closest, size_t &slot) const
+{
+    // The edge functions lose their precision for rays passing many triangle
+    // sizes away and can report a hit, so rays that miss the mesh bounds are
+    // rejected first, as they are at the BLAS root
+    const Vec3 inv_dir(1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z);
+    if (intersect_aabb(bounds_, ray.origin, inv_dir, t_min, t_closest) == std::numeric_limits<Real>::infinity())
+        return false;
+    Instrumentation::count_triangle_tests(soa_.size());
+    return simd_kernels().nearest_triangle(soa_.span(), 0, soa_.size(), ray, t_min, t_closest, slot);
+}
+
+inline bool Mesh::occluded(const Ray &ray, Real t_min, Real t_max) const
+{
+    const TriangleSpan span = soa_.span();
+    const OccludedTriangleFn occluded_triangle = simd_kernels().occluded_triangle;
+    return blas_.any_hit(ray, t_min, t_max, [&](size_t begin, size_t end)
+                         {
+        Instrumentation::count_triangle_tests(end - begin);
+        return occluded_triangle(span, begin, end, ray, t_min, t_max); });
+}
+
+inline bool Mesh::occluded_linear(const Ray &ray, Real t_min, Real t_max) const
+{
+    // Bounds first for the reason given in hit_linear
+    const Vec3 inv_dir(1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z);
+    if (intersect_aabb(bounds_, ray.origin, inv_dir, t_min, t_max) == std::numeric_limits<Real>::infinity())
+        return false;
+    Instrumentation::count_triangle_tests(soa_.size());
+    return simd_kernels().occluded_triangle(soa_.span(), 0, soa_.size(), ray, t_min, t_max);
+}
+
+inline Vec3 Mesh::normal(size_t slot) const
+{
+    const Vec3 a = soa_.corner(slot, 0);
+    return (soa_.corner(slot, 1) - a).cross(soa_.corner(slot, 2) - a);
+}
+
+#endif
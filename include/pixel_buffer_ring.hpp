@@ -0,0 +1,252 @@
+#ifndef PIXEL_BUFFER_RING_HPP
+#define PIXEL_BUFFER_RING_HPP
+
+#include <GLFW/glfw3.h>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Entry points past OpenGL 1.1 are loaded at runtime, since the system gl.h
+// may not declare them
+#if defined(_WIN32)
+#define RAYTRACER_GL_APIENTRY __stdcall
+#else
+#define RAYTRACER_GL_APIENTRY
+#endif
+
+// Staging memory that frames are rendered into before they reach the
+// texture, one slot per frame in flight. With OpenGL 4.4 or
+// ARB_buffer_storage each slot is a persistently mapped pixel buffer object:
+// workers write straight into driver memory, glTexSubImage2D from the bound
+// buffer returns without copying, and a fence per slot keeps the CPU from
+// overwriting a slot the GPU is still reading. Without it, slots are plain
+// arrays uploaded with an ordinary glTexSubImage2D.
+class PixelBufferRing
+{
+public:
+    static constexpr int MAX_SLOTS = 3;
+
+    PixelBufferRing();
+    ~PixelBufferRing();
+
+    PixelBufferRing(const PixelBufferRing &) = delete;
+    PixelBufferRing &operator=(const PixelBufferRing &) = delete;
+
+    // Needs a current GL context. Frees and reallocates every slot.
+    void allocate(int slot_count, size_t slot_bytes);
+
+    // Writable memory of the slot, once the GPU is done reading it
+    unsigned char *acquire(int slot);
+
+    // Uploads width x height RGBA pixels of the slot into the lower-left
+    // corner of the bound texture
+    void upload(int slot, int width, int height);
+
+    bool is_persistent() const { return persistent_; }
+    int get_slot_count() const { return slot_count_; }
+    size_t get_slot_bytes() const { return slot_bytes_; }
+
+private:
+    using GLsyncHandle = void *;
+    using GenBuffersFn = void(RAYTRACER_GL_APIENTRY *)(GLsizei, GLuint *);
+    using DeleteBuffersFn = void(RAYTRACER_GL_APIENTRY *)(GLsizei, const GLuint *);
+    using BindBufferFn = void(RAYTRACER_GL_APIENTRY *)(GLenum, GLuint);
+    using BufferStorageFn = void(RAYTRACER_GL_APIENTRY *)(GLenum, std::ptrdiff_t, const void *, GLbitfield);
+    using MapBufferRangeFn = void *(RAYTRACER_GL_APIENTRY *)(GLenum, std::ptrdiff_t, std::ptrdiff_t, GLbitfield);
+    using UnmapBufferFn = GLboolean(RAYTRACER_GL_APIENTRY *)(GLenum);
+    using FenceSyncFn = GLsyncHandle(RAYTRACER_GL_APIENTRY *)(GLenum, GLbitfield);
+    using ClientWaitSyncFn = GLenum(RAYTRACER_GL_APIENTRY *)(GLsyncHandle, GLbitfield, uint64_t);
+    using DeleteSyncFn = void(RAYTRACER_GL_APIENTRY *)(GLsyncHandle);
+
+    static constexpr GLenum PIXEL_UNPACK_BUFFER = 0x88EC;
+    static constexpr GLbitfield MAP_WRITE_BIT = 0x0002;
+    static constexpr GLbitfield MAP_PERSISTENT_BIT = 0x0040;
+    static constexpr GLbitfield MAP_COHERENT_BIT = 0x0080;
+    static constexpr GLenum SYNC_GPU_COMMANDS_COMPLETE = 0x9117;
+    static constexpr GLbitfield SYNC_FLUSH_COMMANDS_BIT = 0x0001;
+    static constexpr GLenum TIMEOUT_EXPIRED = 0x911B;
+
+    struct Slot
+    {
+        GLuint buffer = 0;
+        unsigned char *mapped = nullptr;
+        GLsyncHandle fence = nullptr;
+        std::vector<unsigned char> fallback;
+    };
+
+    bool loaded_;
+    bool persistent_;
+    int slot_count_;
+    size_t slot_bytes_;
+    Slot slots_[MAX_SLOTS];
+
+    GenBuffersFn gen_buffers_;
+    DeleteBuffersFn delete_buffers_;
+    BindBufferFn bind_buffer_;
+    BufferStorageFn buffer_storage_;
+    MapBufferRangeFn map_buffer_range_;
+    UnmapBufferFn unmap_buffer_;
+    FenceSyncFn fence_sync_;
+    ClientWaitSyncFn client_wait_sync_;
+    DeleteSyncFn delete_sync_;
+
+    bool load_functions();
+    void release();
+    void wait_for_fence(Slot &slot);
+};
+
+inline PixelBufferRing::PixelBufferRing()
+    : loaded_(false), persistent_(false), slot_count_(0), slot_bytes_(0), gen_buffers_(nullptr), delete_buffers_(nullptr), bind_buffer_(nullptr), buffer_storage_(nullptr), map_buffer_range_(nullptr), unmap_buffer_(nullptr), fence_sync_(nullptr), client_wait_sync_(nullptr), delete_sync_(nullptr)
+{
+}
+
+inline PixelBufferRing::~PixelBufferRing()
+{
+    release();
+}
+
+inline bool PixelBufferRing::load_functions()
+{
+    auto load = [](auto &fn, const char *name)
+    {
+        fn = reinterpret_cast<std::remove_reference_t<decltype(fn)>>(glfwGetProcAddress(name));
+        return fn != nullptr;
+    };
+
+    const bool has_storage = glfwExtensionSupported("GL_ARB_buffer_storage") != 0;
+    const bool has_sync = glfwExtensionSupported("GL_ARB_sync") != 0;
+
+    // Check every load so none is left dangling
+    bool ok = load(gen_buffers_, "glGenBuffers");
+    ok = load(delete_buffers_, "glDeleteBuffers") && ok;
+    ok = load(bind_buffer_, "glBindBuffer") && ok;
+    ok = load(buffer_storage_, "glBufferStorage") && ok;
+    ok = load(map_buffer_range_, "glMapBufferRange") && ok;
+    ok = load(unmap_buffer_, "glUnmapBuffer") && ok;
+    ok = load(fence_sync_, "glFenceSync") && ok;
+    ok = load(client_wait_sync_, "glClientWaitSync") && ok;
+    ok = load(delete_sync_, "glDeleteSync") && ok;
+    return ok && has_storage && has_sync;
+}
+
+inline void PixelBufferRing::allocate(int slot_count, size_t slot_bytes)
+{
+    release();
+    if (!loaded_)
+    {
+        persistent_ = load_functions();
+        loaded_ = true;
+    }
+
+    const int count = slot_count < 1 ? 1 : (slot_count > MAX_SLOTS ? MAX_SLOTS : slot_count);
+    slot_count_ = count;
+    slot_bytes_ = slot_bytes;
+
+    for (int i = 0; i < slot_count_ && persistent_; ++i)
+    {
+        Slot &slot = slots_[i];
+        const GLbitfield flags = MAP_WRITE_BIT | MAP_PERSISTENT_BIT | MAP_COHERENT_BIT;
+        gen_buffers_(1, &slot.buffer);
+        bind_buffer_(PIXEL_UNPACK_BUFFER, slot.buffer);
+        buffer_storage_(PIXEL_UNPACK_BUFFER, static_cast<std::ptrdiff_t>(slot_bytes_), nullptr, flags);
+        slot.mapped = static_cast<unsigned char *>(
+            map_buffer_range_(PIXEL_UNPACK_BUFFER, 0, static_cast<std::ptrdiff_t>(slot_bytes_), flags));
+        if (!slot.mapped)
+        {
+            // Driver refused; drop to the copying path for good
+            bind_buffer_(PIXEL_UNPACK_BUFFER, 0);
+            release();
+            persistent_ = false;
+            slot_count_ = count;
+            slot_bytes_ = slot_bytes;
+            break;
+        }
+    }
+    if (persistent_)
+    {
+        bind_buffer_(PIXEL_UNPACK_BUFFER, 0);
+        return;
+    }
+
+    for (int i = 0; i < slot_count_; ++i)
+    {
+        slots_[i].fallback.assign(slot_bytes_, 0);
+    }
+}
+
+inline unsigned char *PixelBufferRing::acquire(int slot)
+{
+    Slot &s = slots_[slot];
+    if (!persistent_)
+        return s.fallback.data();
+
+    wait_for_fence(s);
+    return s.mapped;
+}
+
+inline void PixelBufferRing::upload(int slot, int width, int height)
+{
+    Slot &s = slots_[slot];
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    if (!persistent_)
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, s.fallback.data());
+        return;
+    }
+
+    // With a buffer bound the pointer argument is an offset into it, and the
+    // call only queues the transfer
+    bind_buffer_(PIXEL_UNPACK_BUFFER, s.buffer);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    bind_buffer_(PIXEL_UNPACK_BUFFER, 0);
+
+    if (s.fence)
+        delete_sync_(s.fence);
+    s.fence = fence_sync_(SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+inline void PixelBufferRing::wait_for_fence(Slot &slot)
+{
+    if (!slot.fence)
+        return;
+
+    // The first wait flushes so the fence is guaranteed to signal
+    GLbitfield flags = SYNC_FLUSH_COMMANDS_BIT;
+    for (;;)
+    {
+        // Signaled, or failed (lost context), either way stop waiting
+        if (client_wait_sync_(slot.fence, flags, 1000000) != TIMEOUT_EXPIRED)
+            break;
+        flags = 0;
+    }
+    delete_sync_(slot.fence);
+    slot.fence = nullptr;
+}
+
+inline void PixelBufferRing::release()
+{
+    for (Slot &slot : slots_)
+    {
+        if (slot.fence)
+        {
+            wait_for_fence(slot);
+        }
+        if (slot.buffer)
+        {
+            bind_buffer_(PIXEL_UNPACK_BUFFER, slot.buffer);
+            if (slot.mapped)
+                unmap_buffer_(PIXEL_UNPACK_BUFFER);
+            bind_buffer_(PIXEL_UNPACK_BUFFER, 0);
+            delete_buffers_(1, &slot.buffer);
+        }
+        slot.buffer = 0;
+        slot.mapped = nullptr;
+        slot.fallback.clear();
+        slot.fallback.shrink_to_fit();
+    }
+    slot_count_ = 0;
+    slot_bytes_ = 0;
+}
+
+#endif
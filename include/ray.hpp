@@ -1,6 +1,9 @@
 #ifndef RAY_HPP
 #define RAY_HPP
 
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
 #include "vec3.hpp"
 
 class Ray {
@@ -8,12 +11,47 @@ public:
     Vec3 origin;
     Vec3 direction;
 
+    Ray() = default;
     Ray(const Vec3& origin, const Vec3& direction)
         : origin(origin), direction(direction.normalize()) {}
 
-    Vec3 point_at(double t) const {
+    // Skips the normalize for directions that are already unit length
+    static Ray from_unit(const Vec3& origin, const Vec3& unit_direction) {
+        Ray ray;
+        ray.origin = origin;
+        ray.direction = unit_direction;
+        return ray;
+    }
+
+    Vec3 point_at(Real t) const {
         return origin + direction * t;
     }
 };
 
-#endif 
\ No newline at end of file
+// Moves a surface point off the surface along the geometric normal, far
+// enough that a ray spawned from it can't hit the same surface again through
+// rounding. Far from the origin the offset is a fixed number of ulps, so it
+// scales with the point's own precision; near the origin, where ulps get
+// tiny, it is a small constant instead. (Wächter and Binder, "A Fast and
+// Robust Method for Avoiding Self-Intersection", Ray Tracing Gems ch. 6.)
+inline Vec3 offset_ray_origin(const Vec3& p, const Vec3& normal) {
+    using Bits = std::conditional_t<sizeof(Real) == 4, int32_t, int64_t>;
+    const Real origin_bound = Real(1) / 32;
+    const Real float_scale = sizeof(Real) == 4 ? Real(1) / 65536 : Real(1) / 4294967296.0;
+    const Real int_scale = 256;
+
+    auto offset = [&](Real value, Real n) {
+        if (std::abs(value) < origin_bound)
+            return value + float_scale * n;
+        Bits bits;
+        std::memcpy(&bits, &value, sizeof(Real));
+        const Bits ulps = static_cast<Bits>(int_scale * n);
+        bits += value < 0 ? -ulps : ulps;
+        Real moved;
+        std::memcpy(&moved, &bits, sizeof(Real));
+        return moved;
+    };
+    return Vec3(offset(p.x, normal.x), offset(p.y, normal.y), offset(p.z, normal.z));
+}
+
+#endif
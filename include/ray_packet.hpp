@@ -0,0 +1,49 @@
+#ifndef RAY_PACKET_HPP
+#define RAY_PACKET_HPP
+
+#include <algorithm>
+#include "vec3.hpp"
+
+// Up to 8x8 coherent rays sharing one origin, stored SoA so the packet
+// kernels can test one sphere against several rays per instruction. Unused
+// lanes keep a zero direction, which can never produce a hit.
+struct alignas(64) RayPacket
+{
+    static constexpr int MAX_RAYS = 64;
+
+    Real dx[MAX_RAYS];
+    Real dy[MAX_RAYS];
+    Real dz[MAX_RAYS];
+    Real t[MAX_RAYS];    // nearest hit so far, starts at t_max
+    Real slot[MAX_RAYS]; // SoA slot of the nearest hit, -1 for none (exact below 2^24 in float)
+    Vec3 origin;
+    Real t_min;
+    int count;
+
+    void reset(const Vec3 &ray_origin, Real ray_t_min, Real ray_t_max)
+    {
+        origin = ray_origin;
+        t_min = ray_t_min;
+        count = 0;
+        std::fill(dx, dx + MAX_RAYS, Real(0));
+        std::fill(dy, dy + MAX_RAYS, Real(0));
+        std::fill(dz, dz + MAX_RAYS, Real(0));
+        std::fill(t, t + MAX_RAYS, ray_t_max);
+        std::fill(slot, slot + MAX_RAYS, Real(-1));
+    }
+
+    void add(const Vec3 &direction)
+    {
+        dx[count] = direction.x;
+        dy[count] = direction.y;
+        dz[count] = direction.z;
+        count++;
+    }
+
+    Real max_t() const
+    {
+        return *std::max_element(t, t + count);
+    }
+};
+
+#endif
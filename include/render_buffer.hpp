@@ -1,40 +1,81 @@
 #ifndef RENDER_BUFFER_HPP
 #define RENDER_BUFFER_HPP
 
-#include <vector>
+#include <algorithm>
 #include <GLFW/glfw3.h>
-#include "vec3.hpp"
-
-class RenderBuffer
+#include "framebuffer.hpp"
+#include "pixel_buffer_ring.hpp"
+#include "config.hpp"
+
+// OpenGL 1.2, missing from some 1.1-only gl.h headers
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+
+// Framebuffer shown through an OpenGL texture. Frames are rendered into the
+// slots of a PixelBufferRing, so one slot can upload and display while the
+// next is being traced:
+//
+//   int slot = buffer.begin_frame();   // GL thread, before rendering
+//   ... render into buffer ...
+//   buffer.present_frame(slot);        // GL thread, any time later
+class RenderBuffer : public Framebuffer
 {
 public:
     RenderBuffer(int width, int height);
-    ~RenderBuffer();
+    ~RenderBuffer() override;
+
+    void resize(int width, int height) override;
 
-    void resize(int width, int height);
-    void set_pixel(int x, int y, const Vec3 &color);
+    // Points the image at the next staging slot and returns it. Waits if
+    // the GPU is still reading that slot from an earlier frame.
+    int begin_frame();
+    // Uploads a finished slot to the texture; false (and nothing uploaded)
+    // when the slot was invalidated since begin_frame()
+    bool present_frame(int slot);
+    // Marks a slot as not worth uploading, e.g. when the renderer skipped it
+    void invalidate_frame(int slot);
+
+    // Synchronous path: uploads the slot of the last begin_frame()
     void update_texture();
     void bind_texture() const;
-    void clear();
 
-    int get_width() const { return width_; }
-    int get_height() const { return height_; }
-    const std::vector<unsigned char> &get_pixels() const { return pixels_; }
+    bool has_shown_frame() const { return shown_width_ > 0; }
+    bool uses_persistent_buffers() const { return ring_.is_persistent(); }
+
+    // The texture only grows, so the image may cover just its lower-left
+    // part; draw with texture coordinates up to these
+    float get_texcoord_u() const;
+    float get_texcoord_v() const;
 
 private:
-    int width_;
-    int height_;
-    std::vector<unsigned char> pixels_;
+    struct SlotFrame
+    {
+        int width = 0;
+        int height = 0;
+        bool valid = false;
+    };
+
     GLuint texture_id_;
+    int texture_width_;
+    int texture_height_;
+    PixelBufferRing ring_;
+    SlotFrame slot_frames_[PixelBufferRing::MAX_SLOTS];
+    int write_slot_;
+
+    // Size of the image currently in the texture
+    int shown_width_;
+    int shown_height_;
 
     void setup_texture();
-    unsigned char clamp_color(double value) const;
+    void allocate_slots();
 };
 
 inline RenderBuffer::RenderBuffer(int width, int height)
-    : width_(width), height_(height), pixels_(width * height * 3, 0)
+    : Framebuffer(width, height), texture_id_(0), texture_width_(width), texture_height_(height), write_slot_(-1), shown_width_(0), shown_height_(0)
 {
     setup_texture();
+    allocate_slots();
 }
 
 inline RenderBuffer::~RenderBuffer()
@@ -47,30 +88,73 @@ inline RenderBuffer::~RenderBuffer()
 
 inline void RenderBuffer::resize(int width, int height)
 {
-    width_ = width;
-    height_ = height;
-    pixels_.resize(width * height * 3);
-    clear();
+    // Frames in the slots have the old size; show none of them
+    set_output(nullptr);
+    for (SlotFrame &frame : slot_frames_)
+        frame.valid = false;
 
+    Framebuffer::resize(width, height);
+    if (width_ <= texture_width_ && height_ <= texture_height_)
+        return;
+
+    texture_width_ = std::max(width_, texture_width_);
+    texture_height_ = std::max(height_, texture_height_);
     glBindTexture(GL_TEXTURE_2D, texture_id_);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width_, height_, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texture_width_, texture_height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    shown_width_ = 0;
+    shown_height_ = 0;
+    allocate_slots();
 }
 
-inline void RenderBuffer::set_pixel(int x, int y, const Vec3 &color)
+inline void RenderBuffer::allocate_slots()
 {
-    if (x >= 0 && x < width_ && y >= 0 && y < height_)
-    {
-        int idx = (y * width_ + x) * 3;
-        pixels_[idx] = clamp_color(color.x);
-        pixels_[idx + 1] = clamp_color(color.y);
-        pixels_[idx + 2] = clamp_color(color.z);
-    }
+    // Sized for the whole texture, so shrinking never reallocates
+    ring_.allocate(Config::PRESENT_BUFFERS, static_cast<size_t>(texture_width_) * texture_height_ * 4);
+    write_slot_ = -1;
+}
+
+inline int RenderBuffer::begin_frame()
+{
+    write_slot_ = (write_slot_ + 1) % ring_.get_slot_count();
+    set_output(ring_.acquire(write_slot_));
+
+    SlotFrame &frame = slot_frames_[write_slot_];
+    frame.width = width_;
+    frame.height = height_;
+    frame.valid = true;
+    return write_slot_;
+}
+
+inline bool RenderBuffer::present_frame(int slot)
+{
+    if (slot < 0 || !slot_frames_[slot].valid)
+        return false;
+
+    const SlotFrame &frame = slot_frames_[slot];
+    glBindTexture(GL_TEXTURE_2D, texture_id_);
+    ring_.upload(slot, frame.width, frame.height);
+    shown_width_ = frame.width;
+    shown_height_ = frame.height;
+    return true;
+}
+
+inline void RenderBuffer::invalidate_frame(int slot)
+{
+    if (slot >= 0)
+        slot_frames_[slot].valid = false;
 }
 
 inline void RenderBuffer::update_texture()
 {
+    if (present_frame(write_slot_))
+        return;
+
+    // Nothing rendered through begin_frame(); upload pixels_ directly
     glBindTexture(GL_TEXTURE_2D, texture_id_);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width_, height_, GL_RGB, GL_UNSIGNED_BYTE, pixels_.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width_, height_, GL_RGBA, GL_UNSIGNED_BYTE, get_output());
+    shown_width_ = width_;
+    shown_height_ = height_;
 }
 
 inline void RenderBuffer::bind_texture() const
@@ -78,9 +162,16 @@ inline void RenderBuffer::bind_texture() const
     glBindTexture(GL_TEXTURE_2D, texture_id_);
 }
 
-inline void RenderBuffer::clear()
+// Stops half a texel inside the image so linear filtering never blends in
+// texels outside it
+inline float RenderBuffer::get_texcoord_u() const
+{
+    return shown_width_ == texture_width_ ? 1.0f : (shown_width_ - 0.5f) / texture_width_;
+}
+
+inline float RenderBuffer::get_texcoord_v() const
 {
-    std::fill(pixels_.begin(), pixels_.end(), 0);
+    return shown_height_ == texture_height_ ? 1.0f : (shown_height_ - 0.5f) / texture_height_;
 }
 
 inline void RenderBuffer::setup_texture()
@@ -89,12 +180,9 @@ inline void RenderBuffer::setup_texture()
     glBindTexture(GL_TEXTURE_2D, texture_id_);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width_, height_, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-}
-
-inline unsigned char RenderBuffer::clamp_color(double value) const
-{
-    return static_cast<unsigned char>(255.99 * std::min(1.0, std::max(0.0, value)));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texture_width_, texture_height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,100 +1,750 @@
 #ifndef RENDERER_HPP
 #define RENDERER_HPP
 
+#include <chrono>
 #include <memory>
+#include <limits>
+#include <vector>
 #include "scene.hpp"
 #include "camera.hpp"
-#include "render_buffer.hpp"
+#include "frustum.hpp"
+#include "ray_packet.hpp"
+#include "framebuffer.hpp"
+#include "instrumentation.hpp"
 #include "thread_pool.hpp"
+#include "tiles.hpp"
+#include "sampling.hpp"
+#include "wavefront.hpp"
+#include "reprojection.hpp"
+#include "sphere_bins.hpp"
+#include "denoiser.hpp"
 #include "config.hpp"
 
+// Load balance of the last frame: how long each worker spent on tiles.
+// A long tail shows up as max_busy_ms well above mean_busy_ms.
+struct RenderStats
+{
+    double frame_ms = 0.0;
+    int tile_count = 0;
+    int samples = 0; // accumulated by every pixel, including this frame
+    int pixels = 0;  // traced this frame
+    int64_t traced_samples = 0; // primary samples this frame, over all pixels
+    int reused = 0;  // of those, colored from the last frame (see set_reprojection)
+    double denoise_ms = 0.0; // part of frame_ms, 0 with the denoiser off
+    std::vector<double> worker_busy_ms;
+    std::vector<int> worker_tiles;
+    TraceCounters counters; // this frame's rays and tests, with instrumentation compiled in
+
+    double max_busy_ms() const
+    {
+        return worker_busy_ms.empty() ? 0.0 : *std::max_element(worker_busy_ms.begin(), worker_busy_ms.end());
+    }
+
+    double mean_busy_ms() const
+    {
+        double total = 0.0;
+        for (double ms : worker_busy_ms)
+            total += ms;
+        return worker_busy_ms.empty() ? 0.0 : total / worker_busy_ms.size();
+    }
+
+    double reuse_ratio() const
+    {
+        return pixels > 0 ? static_cast<double>(reused) / pixels : 0.0;
+    }
+
+    // 1.0 is perfectly balanced
+    double imbalance() const
+    {
+        double mean = mean_busy_ms();
+        return mean > 0.0 ? max_busy_ms() / mean : 1.0;
+    }
+};
+
+enum class RenderMode
+{
+    Direct,   // one hit per pixel, sun and ambient light, shadow rays
+    PathTrace // bounced light and shadows through WavefrontTracer
+};
+
 class Renderer
 {
 public:
-    Renderer();
+    explicit Renderer(int thread_count = Config::NUM_THREADS);
     ~Renderer() = default;
 
-    void render(const Scene &scene, const Camera &camera, RenderBuffer &buffer);
-    void render_with_fps(const Scene &scene, const Camera &camera, RenderBuffer &buffer, int fps);
+    void render(const Scene &scene, const Camera &camera, Framebuffer &buffer);
+    // The snapshot must be taken at the buffer's resolution
+    void render(const Scene &scene, const CameraSnapshot &camera, Framebuffer &buffer);
+    void render_with_fps(const Scene &scene, const Camera &camera, Framebuffer &buffer, int fps);
+    // Applies sphere edits to the scene's acceleration on the worker
+    // threads (see Scene::update_acceleration); returns whether it rebuilt
+    bool update_scene(Scene &scene);
     void set_thread_count(int count);
+    int get_thread_count() const { return thread_count_; }
+    bool set_packet_size(int size);
+    int get_packet_size() const { return packet_size_; }
+    void set_tile_size(int size);
+    int get_tile_size() const { return tile_size_; }
+    void set_tile_order(TileOrder order);
+    TileOrder get_tile_order() const { return tile_order_; }
+
+    // With accumulation on, frames of an unchanged camera and scene add
+    // jittered samples to the buffer's running mean instead of starting over
+    void set_accumulation(bool enabled) { accumulate_ = enabled; }
+    bool get_accumulation() const { return accumulate_; }
+    void set_samples_per_frame(int samples) { samples_per_frame_ = std::max(1, samples); }
+    int get_samples_per_frame() const { return samples_per_frame_; }
+    const RenderStats &get_last_stats() const { return stats_; }
+
+    // Changing either starts accumulation over
+    void set_render_mode(RenderMode mode);
+    RenderMode get_render_mode() const { return render_mode_; }
+    void set_max_depth(int depth);
+    int get_max_depth() const { return max_depth_; }
+    // Shadow rays in the direct mode; path tracing always casts them
+    void set_shadows(bool enabled);
+    bool get_shadows() const { return shadows_; }
+
+    // While the camera moves, pixels that reprojection shows still see the
+    // same primitive as last frame keep its color instead of being shaded
+    // again (see ReprojectionCache). Applies to direct rendering at one
+    // sample per frame; the first frame after the camera stops is traced in
+    // full.
+    void set_reprojection(bool enabled);
+    bool get_reprojection() const { return reprojection_; }
+
+    // Primary ray packets test only the spheres binned to their tile (see
+    // SphereBins) instead of walking the BVH. Needs packets and an
+    // accelerated scene; the image is the same either way.
+    void set_binning(bool enabled) { binning_ = enabled; }
+    bool get_binning() const { return binning_; }
+
+    // Accumulating frames after the first Config::ADAPTIVE_MIN_SAMPLES go
+    // only to the blocks of tiles where some pixel's mean is still noisy by
+    // its samples' variance, noisiest first and with more samples each, but
+    // never more samples in all than a frame covering every pixel. Changing
+    // it starts accumulation over.
+    void set_adaptive_sampling(bool enabled);
+    bool get_adaptive_sampling() const { return adaptive_; }
+
+    // Filters every frame with Denoiser before it is quantized, guided by
+    // the primary hits of the accumulated samples. Turning it on starts
+    // accumulation over, so every sample has its guides.
+    void set_denoising(bool enabled);
+    bool get_denoising() const { return denoise_; }
+    // The last frame's filtered colors, laid out like its buffer's
+    // get_means(); nullptr with the denoiser off
+    const float *get_denoised() const { return denoise_ ? denoiser_.output() : nullptr; }
 
 private:
+    int thread_count_;
+    int packet_size_;
+    int tile_size_;
+    TileOrder tile_order_;
+    bool accumulate_;
+    int samples_per_frame_;
+    RenderMode render_mode_;
+    int max_depth_;
+    bool shadows_;
+    bool reprojection_;
+    bool binning_;
+    bool adaptive_;
+    bool denoise_;
     std::unique_ptr<ThreadPool> thread_pool_;
     Vec3 light_direction_;
 
-    void render_chunk(const Scene &scene, const Camera &camera, RenderBuffer &buffer,
-                      int start_row, int end_row) const;
+    // Per-frame state, rebuilt only when the resolution, tiling or thread
+    // count changes so a steady-state frame does not allocate
+    std::vector<Tile> tiles_;
+    int tiles_width_;
+    int tiles_height_;
+    RenderStats stats_;
+
+    // Adaptive sampling works on Config::ADAPTIVE_BLOCK squares of the
+    // tiles, in tile order: samples each has accumulated, its noisiest
+    // pixel's error, the blocks this frame samples, and how many each gets
+    std::vector<Tile> blocks_;
+    std::vector<uint32_t> block_samples_;
+    std::vector<float> block_errors_;
+    std::vector<uint32_t> noisy_blocks_;
+    int adaptive_batch_;
+
+    // Written by one render thread each, on separate cache lines
+    struct alignas(64) ThreadStats
+    {
+        double busy_ms = 0.0;
+        int tiles = 0;
+        int reused = 0;
+        int64_t traced_samples = 0;
+        TraceCounters counters;
+    };
+    std::vector<ThreadStats> thread_stats_;
+    // One per render thread, indexed like thread_stats_
+    std::vector<WavefrontTracer> tracers_;
+
+    // What the accumulated samples in the last buffer were rendered from
+    const Scene *accumulated_scene_;
+    const Framebuffer *accumulated_buffer_;
+    uint64_t scene_revision_;
+    uint64_t camera_revision_;
+
+    ReprojectionCache reprojection_cache_;
+    bool reused_last_frame_;
+    SphereBins sphere_bins_;
+    Denoiser denoiser_;
+
+    void update_tiles(int width, int height);
+    void resize_thread_stats();
+    void reserve_tracers();
+    void schedule_noisy_blocks(const Framebuffer &buffer);
+    int render_tile(const Scene &scene, const CameraSnapshot &camera, Framebuffer &buffer, const Tile &tile,
+                    uint32_t first_sample, int samples, const SphereBins *bins, bool record, bool reuse, bool guides);
+    int render_packet(const Scene &scene, const CameraSnapshot &camera, const SphereBins *bins,
+                      int x0, int y0, int x1, int y1, uint32_t sample, Vec3 *colors, float *squares,
+                      bool record, bool reuse, PixelGuides *guides);
     Vec3 trace_ray(const Ray &ray, const Scene &scene) const;
-    Vec3 calculate_lighting(const Vec3 &color, const Vec3 &normal) const;
+    static void add_guides(const Scene &scene, const Ray &ray, bool hit, const Hit &nearest, PixelGuides &guides);
+    Vec3 shade_recorded(const Scene &scene, const Ray &ray, bool hit, const Hit &nearest, int x, int y, bool reuse,
+                        int &reused);
+    Vec3 calculate_lighting(const Scene &scene, const HitRecord &rec) const;
     Vec3 get_background_color(const Ray &ray) const;
 };
 
-inline Renderer::Renderer()
-    : thread_pool_(std::make_unique<ThreadPool>(Config::NUM_THREADS)), light_direction_(Vec3(1, 1, -1).normalize())
+inline Renderer::Renderer(int thread_count)
+    : thread_count_(std::max(1, thread_count)), packet_size_(Config::PACKET_SIZE), tile_size_(Config::TILE_SIZE), tile_order_(TileOrder::Morton), accumulate_(true), samples_per_frame_(std::max(1, Config::SAMPLES_PER_PIXEL)), render_mode_(RenderMode::Direct), max_depth_(Config::MAX_PATH_DEPTH), shadows_(true), reprojection_(true), binning_(true), adaptive_(true), denoise_(false), thread_pool_(std::make_unique<ThreadPool>(thread_count_ - 1)), light_direction_(Vec3(1, 1, -1).normalize()), tiles_width_(0), tiles_height_(0), adaptive_batch_(0),
+      accumulated_scene_(nullptr), accumulated_buffer_(nullptr), scene_revision_(0), camera_revision_(0),
+      reused_last_frame_(false)
 {
+    resize_thread_stats();
 }
 
-inline void Renderer::render(const Scene &scene, const Camera &camera, RenderBuffer &buffer)
+inline void Renderer::render(const Scene &scene, const Camera &camera, Framebuffer &buffer)
 {
-    const int width = buffer.get_width();
-    const int height = buffer.get_height();
-    const int chunk_size = height / Config::NUM_THREADS;
+    render(scene, camera.snapshot(buffer.get_width(), buffer.get_height()), buffer);
+}
 
-    std::vector<std::future<void>> futures;
+inline void Renderer::render(const Scene &scene, const CameraSnapshot &camera, Framebuffer &buffer)
+{
+    auto frame_start = std::chrono::steady_clock::now();
+    ScopedSpan frame_span("frame");
 
-    for (int i = 0; i < Config::NUM_THREADS; ++i)
+    // Start over when the samples so far no longer match what is on screen,
+    // or hold reused colors
+    if (!accumulate_ || &scene != accumulated_scene_ || scene.revision() != scene_revision_ ||
+        &buffer != accumulated_buffer_ || camera.revision != camera_revision_ || reused_last_frame_)
     {
-        int start_row = i * chunk_size;
-        int end_row = (i == Config::NUM_THREADS - 1) ? height : (i + 1) * chunk_size;
+        buffer.reset_accumulation();
+        accumulated_scene_ = &scene;
+        accumulated_buffer_ = &buffer;
+        scene_revision_ = scene.revision();
+        camera_revision_ = camera.revision;
+    }
 
-        futures.push_back(thread_pool_->enqueue([this, &scene, &camera, &buffer, start_row, end_row]()
-                                                { render_chunk(scene, camera, buffer, start_row, end_row); }));
+    update_tiles(buffer.get_width(), buffer.get_height());
+    for (ThreadStats &thread : thread_stats_)
+        thread = ThreadStats{};
+
+    const bool adaptive = adaptive_ && accumulate_ && buffer.get_accumulated_samples() >= Config::ADAPTIVE_MIN_SAMPLES;
+    if (adaptive)
+    {
+        ScopedSpan schedule_span("schedule");
+        schedule_noisy_blocks(buffer);
     }
 
-    for (auto &future : futures)
+    // Converged: further samples would not visibly change the image
+    if (adaptive ? noisy_blocks_.empty() : buffer.get_accumulated_samples() >= Config::MAX_ACCUMULATED_SAMPLES)
     {
-        future.wait();
+        stats_.tile_count = 0;
+        stats_.samples = buffer.get_accumulated_samples();
+        stats_.pixels = 0;
+        stats_.traced_samples = 0;
+        stats_.reused = 0;
+        stats_.denoise_ms = 0.0;
+        stats_.counters = TraceCounters{};
+        std::fill(stats_.worker_busy_ms.begin(), stats_.worker_busy_ms.end(), 0.0);
+        std::fill(stats_.worker_tiles.begin(), stats_.worker_tiles.end(), 0);
+        stats_.frame_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+        return;
     }
+    stats_.tile_count = static_cast<int>(adaptive ? noisy_blocks_.size() : tiles_.size());
+
+    // One tile per chunk: idle threads steal ranges of the Morton-ordered
+    // list, so threads that land on cheap sky tiles keep helping. The calling
+    // thread renders too and is the last entry in the stats.
+    const PathSettings path_settings{max_depth_, Config::RUSSIAN_ROULETTE_DEPTH, light_direction_};
+    const uint32_t first_sample = static_cast<uint32_t>(buffer.get_accumulated_samples());
+
+    // Frames starting from their first sample record their hits for the
+    // next frame, and reuse the last frame's when the camera has moved
+    const bool record = reprojection_ && render_mode_ == RenderMode::Direct && samples_per_frame_ == 1 && first_sample == 0;
+    const bool reuse = record && reprojection_cache_.usable(scene, camera, buffer.get_width(), buffer.get_height());
+    if (record)
+    {
+        reprojection_cache_.begin(buffer.get_width(), buffer.get_height());
+        if (reuse)
+        {
+            ScopedSpan project_span("reproject");
+            reprojection_cache_.project(camera, *thread_pool_);
+        }
+    }
+
+    const bool binned = binning_ && render_mode_ == RenderMode::Direct && packet_size_ > 1 && scene.has_acceleration();
+    if (binned)
+    {
+        ScopedSpan bin_span("bin");
+        sphere_bins_.build(scene, camera, buffer.get_width(), buffer.get_height(), tile_size_);
+    }
+    const SphereBins *bins = binned ? &sphere_bins_ : nullptr;
+
+    if (denoise_)
+        denoiser_.resize(buffer.get_width(), buffer.get_height());
+
+    thread_pool_->parallel_for(0, adaptive ? noisy_blocks_.size() : tiles_.size(), 1, [&](size_t begin, size_t end)
+                               {
+        ScopedSpan chunk_span("chunk", static_cast<int64_t>(end - begin));
+        const size_t thread_index = thread_pool_->current_thread_index();
+        const TraceCounters before = Instrumentation::counters();
+        int reused = 0;
+        int64_t traced_samples = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = begin; i < end; ++i)
+        {
+            const size_t t = adaptive ? noisy_blocks_[i] : i;
+            const Tile &tile = adaptive ? blocks_[t] : tiles_[t];
+            ScopedSpan tile_span("tile", static_cast<int64_t>(t));
+            const uint32_t tile_first = adaptive ? block_samples_[t] : first_sample;
+            const int samples = adaptive ? std::min<int>(adaptive_batch_, Config::MAX_ACCUMULATED_SAMPLES - tile_first)
+                                         : samples_per_frame_;
+            if (render_mode_ == RenderMode::PathTrace)
+                tracers_[thread_index].render_tile(scene, camera, path_settings, tile, tile_first, samples, buffer,
+                                                   denoise_ ? &denoiser_ : nullptr);
+            else
+                reused += render_tile(scene, camera, buffer, tile, tile_first, samples, bins, record, reuse, denoise_);
+            if (adaptive)
+                block_samples_[t] = tile_first + samples;
+            traced_samples += static_cast<int64_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0) * samples;
+        }
+        auto finish = std::chrono::steady_clock::now();
+        const TraceCounters &after = Instrumentation::counters();
+
+        ThreadStats &thread = thread_stats_[thread_index];
+        thread.busy_ms += std::chrono::duration<double, std::milli>(finish - start).count();
+        thread.tiles += static_cast<int>(end - begin);
+        thread.reused += reused;
+        thread.traced_samples += traced_samples;
+        thread.counters.rays += after.rays - before.rays;
+        thread.counters.sphere_tests += after.sphere_tests - before.sphere_tests;
+        thread.counters.triangle_tests += after.triangle_tests - before.triangle_tests;
+        thread.counters.hits += after.hits - before.hits;
+        thread.counters.misses += after.misses - before.misses; });
+
+    if (record)
+        reprojection_cache_.finish(scene, camera);
+    stats_.pixels = buffer.get_width() * buffer.get_height();
+    stats_.reused = 0;
+    stats_.traced_samples = 0;
+    stats_.counters = TraceCounters{};
+    for (size_t i = 0; i < thread_stats_.size(); ++i)
+    {
+        stats_.reused += thread_stats_[i].reused;
+        stats_.traced_samples += thread_stats_[i].traced_samples;
+        stats_.worker_busy_ms[i] = thread_stats_[i].busy_ms;
+        stats_.worker_tiles[i] = thread_stats_[i].tiles;
+        stats_.counters.rays += thread_stats_[i].counters.rays;
+        stats_.counters.sphere_tests += thread_stats_[i].counters.sphere_tests;
+        stats_.counters.triangle_tests += thread_stats_[i].counters.triangle_tests;
+        stats_.counters.hits += thread_stats_[i].counters.hits;
+        stats_.counters.misses += thread_stats_[i].counters.misses;
+    }
+    Instrumentation::record_value("rays", static_cast<int64_t>(stats_.counters.rays));
+    Instrumentation::record_value("sphere_tests", static_cast<int64_t>(stats_.counters.sphere_tests));
+    Instrumentation::record_value("triangle_tests", static_cast<int64_t>(stats_.counters.triangle_tests));
+
+    Instrumentation::record_value("reused_pixels", stats_.reused);
+    reused_last_frame_ = stats_.reused > 0;
+
+    // Adaptive frames leave pixels with different counts
+    if (!adaptive)
+    {
+        buffer.finish_samples(samples_per_frame_);
+        std::fill(block_samples_.begin(), block_samples_.end(), static_cast<uint32_t>(buffer.get_accumulated_samples()));
+        std::fill(block_errors_.begin(), block_errors_.end(), std::numeric_limits<float>::infinity());
+    }
+    stats_.samples = buffer.get_accumulated_samples();
+
+    stats_.denoise_ms = 0.0;
+    if (denoise_)
+    {
+        ScopedSpan denoise_span("denoise");
+        const auto denoise_start = std::chrono::steady_clock::now();
+        denoiser_.denoise(buffer, *thread_pool_, tile_size_);
+        stats_.denoise_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - denoise_start).count();
+    }
+
+    // Bands of whole rows, so each worker writes one contiguous stretch of
+    // the 8-bit image
+    {
+        ScopedSpan resolve_span("resolve");
+        const float *means = denoise_ ? denoiser_.output() : nullptr;
+        thread_pool_->parallel_for(0, static_cast<size_t>(buffer.get_height()), static_cast<size_t>(tile_size_), [&](size_t y0, size_t y1)
+                                   { buffer.resolve(static_cast<int>(y0), static_cast<int>(y1), means); });
+    }
+
+    auto frame_end = std::chrono::steady_clock::now();
+    stats_.frame_ms = std::chrono::duration<double, std::milli>(frame_end - frame_start).count();
+}
+
+inline void Renderer::render_with_fps(const Scene &scene, const Camera &camera, Framebuffer &buffer, int fps)
+{
+    Instrumentation::record_value("fps", fps);
+    render(scene, camera.snapshot(buffer.get_width(), buffer.get_height()), buffer);
 }
 
-inline void Renderer::render_with_fps(const Scene &scene, const Camera &camera, RenderBuffer &buffer, int fps)
+inline bool Renderer::update_scene(Scene &scene)
 {
-    render(scene, camera, buffer);
+    ScopedSpan refit_span("refit");
+    return scene.update_acceleration(*thread_pool_);
 }
 
 inline void Renderer::set_thread_count(int count)
 {
-    thread_pool_ = std::make_unique<ThreadPool>(count);
+    count = std::max(1, count);
+    if (count == thread_count_)
+        return;
+
+    thread_count_ = count;
+    thread_pool_ = std::make_unique<ThreadPool>(thread_count_ - 1);
+    resize_thread_stats();
 }
 
-inline void Renderer::render_chunk(const Scene &scene, const Camera &camera,
-                                   RenderBuffer &buffer, int start_row, int end_row) const
+inline void Renderer::resize_thread_stats()
 {
-    const int width = buffer.get_width();
-    const int height = buffer.get_height();
+    thread_stats_.assign(thread_count_, ThreadStats{});
+    tracers_.resize(thread_count_);
+    reserve_tracers();
+    stats_.worker_busy_ms.assign(thread_count_, 0.0);
+    stats_.worker_tiles.assign(thread_count_, 0);
+}
 
-    //threads each render a group of rows
-    for (int j = start_row; j < end_row; ++j)
+// Any thread may take any tile, so every tracer is sized for a full one
+inline void Renderer::reserve_tracers()
+{
+    const size_t pixels = static_cast<size_t>(tile_size_) * tile_size_;
+    for (WavefrontTracer &tracer : tracers_)
+        tracer.reserve(pixels);
+}
+
+inline void Renderer::set_render_mode(RenderMode mode)
+{
+    render_mode_ = mode;
+    accumulated_scene_ = nullptr;
+}
+
+inline void Renderer::set_max_depth(int depth)
+{
+    max_depth_ = std::max(1, depth);
+    accumulated_scene_ = nullptr;
+}
+
+inline void Renderer::set_shadows(bool enabled)
+{
+    shadows_ = enabled;
+    accumulated_scene_ = nullptr;
+    // Recorded colors were shaded the old way
+    reprojection_cache_.invalidate();
+}
+
+inline void Renderer::set_reprojection(bool enabled)
+{
+    reprojection_ = enabled;
+    reprojection_cache_.invalidate();
+}
+
+inline void Renderer::set_adaptive_sampling(bool enabled)
+{
+    adaptive_ = enabled;
+    accumulated_scene_ = nullptr;
+}
+
+inline void Renderer::set_denoising(bool enabled)
+{
+    denoise_ = enabled;
+    accumulated_scene_ = nullptr;
+}
+
+inline void Renderer::set_tile_size(int size)
+{
+    tile_size_ = std::max(1, size);
+    tiles_.clear();
+}
+
+inline void Renderer::set_tile_order(TileOrder order)
+{
+    tile_order_ = order;
+    tiles_.clear();
+}
+
+inline void Renderer::update_tiles(int width, int height)
+{
+    if (!tiles_.empty() && width == tiles_width_ && height == tiles_height_)
+        return;
+
+    tiles_ = make_tiles(width, height, tile_size_, tile_order_);
+    tiles_width_ = width;
+    tiles_height_ = height;
+
+    blocks_.clear();
+    for (const Tile &tile : tiles_)
+    {
+        for (int y = tile.y0; y < tile.y1; y += Config::ADAPTIVE_BLOCK)
+            for (int x = tile.x0; x < tile.x1; x += Config::ADAPTIVE_BLOCK)
+                blocks_.push_back(Tile{x, y, std::min(x + Config::ADAPTIVE_BLOCK, tile.x1), std::min(y + Config::ADAPTIVE_BLOCK, tile.y1)});
+    }
+    block_samples_.assign(blocks_.size(), 0);
+    block_errors_.assign(blocks_.size(), std::numeric_limits<float>::infinity());
+    noisy_blocks_.clear();
+    noisy_blocks_.reserve(blocks_.size());
+    // Adaptive frames hand out a chunk per block
+    thread_pool_->reserve_chunks(blocks_.size());
+    reserve_tracers();
+}
+
+// Lists the blocks whose noisiest pixel's error is above
+// Config::ADAPTIVE_ERROR, noisiest first, and gives each as many samples as
+// the skipped blocks free, up to ADAPTIVE_MAX_BOOST times the usual. Blocks
+// found converged get no samples, so only the others are measured again.
+inline void Renderer::schedule_noisy_blocks(const Framebuffer &buffer)
+{
+    thread_pool_->parallel_for(0, blocks_.size(), 64, [&](size_t begin, size_t end)
+                               {
+        for (size_t b = begin; b < end; ++b)
+        {
+            if (block_errors_[b] <= Config::ADAPTIVE_ERROR)
+                continue;
+            const Tile &block = blocks_[b];
+            float error = 0.0f;
+            if (block_samples_[b] < static_cast<uint32_t>(Config::MAX_ACCUMULATED_SAMPLES))
+            {
+                for (int y = block.y0; y < block.y1; ++y)
+                    for (int x = block.x0; x < block.x1; ++x)
+                        error = std::max(error, buffer.get_error(x, y));
+            }
+            block_errors_[b] = error;
+        } });
+
+    noisy_blocks_.clear();
+    size_t noisy_pixels = 0;
+    for (size_t b = 0; b < blocks_.size(); ++b)
+    {
+        if (block_errors_[b] > Config::ADAPTIVE_ERROR)
+        {
+            noisy_blocks_.push_back(static_cast<uint32_t>(b));
+            noisy_pixels += static_cast<size_t>(blocks_[b].x1 - blocks_[b].x0) * (blocks_[b].y1 - blocks_[b].y0);
+        }
+    }
+    std::sort(noisy_blocks_.begin(), noisy_blocks_.end(), [this](uint32_t a, uint32_t b)
+              { return block_errors_[a] > block_errors_[b] || (block_errors_[a] == block_errors_[b] && a < b); });
+
+    // A frame covering every pixel is the budget
+    const size_t pixels = static_cast<size_t>(tiles_width_) * tiles_height_;
+    const size_t boost = noisy_pixels > 0 ? pixels / noisy_pixels : 1;
+    adaptive_batch_ = samples_per_frame_ * static_cast<int>(std::min<size_t>(Config::ADAPTIVE_MAX_BOOST, boost));
+}
+
+inline bool Renderer::set_packet_size(int size)
+{
+    if (size != 1 && size != 2 && size != 4 && size != 8)
+        return false;
+    packet_size_ = size;
+    return true;
+}
+
+// Adds samples samples of every pixel of the tile, numbered from
+// first_sample. Packets find spheres through bins when given, otherwise
+// through the scene. With record, a frame of one sample also hands every
+// pixel's hit and color to the reprojection cache, and with reuse takes
+// colors from it. With guides, every pixel's primary hits also go to the
+// denoiser. Returns the pixels reused.
+inline int Renderer::render_tile(const Scene &scene, const CameraSnapshot &camera, Framebuffer &buffer,
+                                 const Tile &tile, uint32_t first_sample, int samples, const SphereBins *bins,
+                                 bool record, bool reuse, bool guides)
+{
+    int reused = 0;
+
+    // Packets need the SoA/BVH data; linear scenes trace one ray at a time
+    if (packet_size_ > 1 && scene.has_acceleration())
+    {
+        Vec3 colors[RayPacket::MAX_RAYS];
+        float squares[RayPacket::MAX_RAYS];
+        PixelGuides guide_sums[RayPacket::MAX_RAYS];
+        for (int j = tile.y0; j < tile.y1; j += packet_size_)
+        {
+            for (int i = tile.x0; i < tile.x1; i += packet_size_)
+            {
+                const int x1 = std::min(i + packet_size_, tile.x1);
+                const int y1 = std::min(j + packet_size_, tile.y1);
+                const int packet_width = x1 - i;
+                const int count = packet_width * (y1 - j);
+
+                std::fill(colors, colors + count, Vec3(0, 0, 0));
+                std::fill(squares, squares + count, 0.0f);
+                if (guides)
+                    std::fill(guide_sums, guide_sums + count, PixelGuides{});
+                for (int s = 0; s < samples; ++s)
+                    reused += render_packet(scene, camera, bins, i, j, x1, y1, first_sample + s, colors, squares, record,
+                                            reuse, guides ? guide_sums : nullptr);
+
+                for (int k = 0; k < count; ++k)
+                {
+                    const int x = i + k % packet_width, y = j + k / packet_width;
+                    if (guides)
+                        denoiser_.accumulate_guides(buffer, x, y, guide_sums[k], samples);
+                    buffer.accumulate_pixel(x, y, colors[k], samples, squares[k]);
+                }
+            }
+        }
+        return reused;
+    }
+
+    // Rows in batches, so directions are generated together
+    Vec3 directions[CameraSnapshot::BATCH];
+    Vec3 row_colors[CameraSnapshot::BATCH];
+    float row_squares[CameraSnapshot::BATCH];
+    PixelGuides row_guides[CameraSnapshot::BATCH];
+    for (int j = tile.y0; j < tile.y1; ++j)
     {
-        for (int i = 0; i < width; ++i)
+        for (int i0 = tile.x0; i0 < tile.x1; i0 += CameraSnapshot::BATCH)
         {
-            double u = (2.0 * i / (width - 1.0)) - 1.0;
-            double v = 1.0 - (2.0 * j / (height - 1.0));
+            const int i1 = std::min(i0 + CameraSnapshot::BATCH, tile.x1);
+            const int count = i1 - i0;
+            std::fill(row_colors, row_colors + count, Vec3(0, 0, 0));
+            std::fill(row_squares, row_squares + count, 0.0f);
+            if (guides)
+                std::fill(row_guides, row_guides + count, PixelGuides{});
+            for (int s = 0; s < samples; ++s)
+            {
+                camera.row_directions(i0, i1, j, first_sample + s, directions);
+                for (int k = 0; k < count; ++k)
+                {
+                    const Ray ray = Ray::from_unit(camera.position, directions[k]);
+                    Vec3 color;
+                    if (record || guides)
+                    {
+                        Hit nearest{};
+                        const bool hit = scene.intersect(ray, Config::RAY_T_MIN, Config::RAY_T_MAX, nearest);
+                        Instrumentation::count_hit(hit);
+                        if (record)
+                            color = shade_recorded(scene, ray, hit, nearest, i0 + k, j, reuse, reused);
+                        else
+                            color = hit ? calculate_lighting(scene, scene.surface(ray, nearest)) : get_background_color(ray);
+                        if (guides)
+                            add_guides(scene, ray, hit, nearest, row_guides[k]);
+                    }
+                    else
+                    {
+                        color = trace_ray(ray, scene);
+                    }
+                    row_colors[k] = row_colors[k] + color;
+                    const float l = luminance(color);
+                    row_squares[k] += l * l;
+                }
+            }
+            Instrumentation::count_rays(static_cast<uint64_t>(count) * samples);
+
+            for (int k = 0; k < count; ++k)
+            {
+                if (guides)
+                    denoiser_.accumulate_guides(buffer, i0 + k, j, row_guides[k], samples);
+                buffer.accumulate_pixel(i0 + k, j, row_colors[k], samples, row_squares[k]);
+            }
+        }
+    }
+    return reused;
+}
 
-            Ray ray = camera.get_ray(u, v);
-            Vec3 pixel_color = trace_ray(ray, scene);
+// Adds one sample of every pixel in [x0, x1) x [y0, y1) to colors, and its
+// squared luminance to squares, row by row; bins, record and reuse as in
+// render_tile, and the hits' guides to guides when given. Returns the pixels
+// reused.
+inline int Renderer::render_packet(const Scene &scene, const CameraSnapshot &camera, const SphereBins *bins,
+                                   int x0, int y0, int x1, int y1, uint32_t sample, Vec3 *colors, float *squares,
+                                   bool record, bool reuse, PixelGuides *guides)
+{
+    RayPacket packet;
+    Ray rays[RayPacket::MAX_RAYS];
+    Vec3 directions[RayPacket::MAX_RAYS];
+    packet.reset(camera.position, Config::RAY_T_MIN, Config::RAY_T_MAX);
 
-            buffer.set_pixel(i, j, pixel_color);
+    // Same rays as the per-pixel path, so results match it exactly
+    for (int j = y0; j < y1; ++j)
+    {
+        camera.row_directions(x0, x1, j, sample, directions);
+        for (int k = 0; k < x1 - x0; ++k)
+        {
+            rays[packet.count] = Ray::from_unit(camera.position, directions[k]);
+            packet.add(directions[k]);
         }
     }
+
+    // Tiles no sphere reaches go straight to the meshes and the background
+    if (!bins || !bins->empty(x0, y0))
+    {
+        // Jittered rays can leave the rectangle of pixel centers, so bound the
+        // frustum half a pixel further out. Directions are linear in the pixel
+        // coordinates before normalization, so every ray stays inside.
+        const double pad = sample == 0 ? 0.0 : 0.5;
+        const Vec3 corners[4] = {camera.direction(x0 - pad, y0 - pad), camera.direction(x1 - 1 + pad, y0 - pad),
+                                 camera.direction(x1 - 1 + pad, y1 - 1 + pad), camera.direction(x0 - pad, y1 - 1 + pad)};
+        PacketFrustum frustum;
+        frustum.build(camera.position, corners);
+
+        if (bins)
+            bins->hit_packet(scene, x0, y0, packet, frustum);
+        else
+            scene.hit_packet(packet, frustum);
+    }
+    Instrumentation::count_rays(packet.count);
+
+    int reused = 0;
+    for (int k = 0; k < packet.count; ++k)
+    {
+        Vec3 pixel_color;
+        bool hit = packet.slot[k] >= 0;
+        Hit nearest{packet.t[k], hit ? scene.soa().id(static_cast<size_t>(packet.slot[k])) : 0, Hit::SPHERE};
+        // Meshes are traced per ray, limited to the nearest sphere
+        if (scene.intersect_instances(rays[k], Config::RAY_T_MIN, nearest.t, nearest))
+            hit = true;
+        Instrumentation::count_hit(hit);
+        if (record)
+        {
+            pixel_color = shade_recorded(scene, rays[k], hit, nearest, x0 + k % (x1 - x0), y0 + k / (x1 - x0), reuse, reused);
+        }
+        else if (hit)
+        {
+            pixel_color = calculate_lighting(scene, scene.surface(rays[k], nearest));
+        }
+        else
+        {
+            pixel_color = get_background_color(rays[k]);
+        }
+        if (guides)
+            add_guides(scene, rays[k], hit, nearest, guides[k]);
+        colors[k] = colors[k] + pixel_color;
+        const float l = luminance(pixel_color);
+        squares[k] += l * l;
+    }
+    return reused;
 }
 
 inline Vec3 Renderer::trace_ray(const Ray &ray, const Scene &scene) const
 {
     HitRecord rec;
-    if (scene.hit(ray, Config::RAY_T_MIN, Config::RAY_T_MAX, rec))
+    const bool hit = scene.hit(ray, Config::RAY_T_MIN, Config::RAY_T_MAX, rec);
+    Instrumentation::count_hit(hit);
+    if (hit)
     {
-        return calculate_lighting(rec.color, rec.normal);
+        return calculate_lighting(scene, rec);
     }
     else
     {
@@ -102,17 +752,63 @@ inline Vec3 Renderer::trace_ray(const Ray &ray, const Scene &scene) const
     }
 }
 
-inline Vec3 Renderer::calculate_lighting(const Vec3 &color, const Vec3 &normal) const
+// Adds a primary hit's features to the denoiser's guides for its pixel
+inline void Renderer::add_guides(const Scene &scene, const Ray &ray, bool hit, const Hit &nearest, PixelGuides &guides)
 {
-    double diffuse = std::max(0.0, normal.dot(light_direction_));
-    Vec3 ambient = Vec3(Config::AMBIENT_STRENGTH, Config::AMBIENT_STRENGTH, Config::AMBIENT_STRENGTH);
+    if (!hit)
+    {
+        guides.add_miss();
+        return;
+    }
+    const HitRecord rec = scene.surface(ray, nearest);
+    guides.add_hit(rec.normal, rec.t, scene.material(rec.material).albedo);
+}
+
+// Color of pixel (x, y) from its primary hit, recorded for the next frame.
+// With reuse, a pixel whose reprojected candidate saw the same primitive
+// keeps the candidate's color and skips shading, shadow ray included.
+inline Vec3 Renderer::shade_recorded(const Scene &scene, const Ray &ray, bool hit, const Hit &nearest, int x, int y,
+                                     bool reuse, int &reused)
+{
+    const PixelHistory *candidate = hit && reuse ? reprojection_cache_.candidate(x, y) : nullptr;
+    const bool same = candidate && candidate->hit.primitive == nearest.primitive &&
+                      candidate->hit.instance == nearest.instance;
+    if (same && candidate->age < ReprojectionCache::MAX_AGE)
+    {
+        reprojection_cache_.record(x, y, PixelHistory{nearest, candidate->color, static_cast<uint8_t>(candidate->age + 1), true});
+        reused++;
+        return candidate->color;
+    }
+
+    const Vec3 color = hit ? calculate_lighting(scene, scene.surface(ray, nearest)) : get_background_color(ray);
+    // Expired colors start over at 0 and stay out of step with their
+    // neighbours'; new ones are staggered so refreshes spread over frames
+    const uint8_t age = same ? 0 : static_cast<uint8_t>((x + 3 * y) % ReprojectionCache::MAX_AGE);
+    reprojection_cache_.record(x, y, PixelHistory{nearest, color, age, hit});
+    return color;
+}
+
+// Sun and ambient light; the sun is blocked when a shadow ray toward it hits
+// anything
+inline Vec3 Renderer::calculate_lighting(const Scene &scene, const HitRecord &rec) const
+{
+    const Vec3 &color = scene.material(rec.material).albedo;
+    Real diffuse = std::max(Real(0), rec.normal.dot(light_direction_));
+    if (diffuse > 0 && shadows_)
+    {
+        Instrumentation::count_rays(1);
+        const Ray shadow_ray = Ray::from_unit(offset_ray_origin(rec.point, rec.normal), light_direction_);
+        if (scene.occluded(shadow_ray, static_cast<Real>(Config::RAY_T_MAX)))
+            diffuse = 0;
+    }
+    const Real ambient_strength = static_cast<Real>(Config::AMBIENT_STRENGTH);
+    Vec3 ambient = Vec3(ambient_strength, ambient_strength, ambient_strength);
     return ambient + color * diffuse;
 }
 
 inline Vec3 Renderer::get_background_color(const Ray &ray) const
 {
-    double t = 0.5 * (ray.direction.y + 1.0);
-    return Vec3(1.0, 1.0, 1.0) * (1.0 - t) + Vec3(0.5, 0.7, 1.0) * t;
+    return sky_color(ray.direction);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,182 @@
+#ifndef REPROJECTION_HPP
+#define REPROJECTION_HPP
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "camera.hpp"
+#include "scene.hpp"
+#include "thread_pool.hpp"
+
+// One pixel's primary hit in a frame and the color it was shaded with
+struct PixelHistory
+{
+    Hit hit;     // t along the ray through the pixel center
+    Vec3 color;
+    uint8_t age; // frames the color has been carried over since it was shaded
+    bool valid;  // false where the ray hit nothing
+};
+
+// Temporal reprojection cache, after Nehab et al., "Accelerating Real-Time
+// Shading with Reverse Reprojection Caching" (Graphics Hardware 2007). It
+// keeps the last frame's primary hits and colors. Once the camera moves,
+// project() carries every hit point into the new view, so a pixel that
+// still sees the same primitive can take its color instead of being shaded
+// again. The renderer still traces every primary ray and takes a candidate
+// only when the nearest hit is the same primitive, so reuse skips shading
+// and shadow rays but never shows a surface that has since been covered.
+class ReprojectionCache
+{
+public:
+    // Colors carried over this many frames are shaded again
+    static constexpr uint8_t MAX_AGE = 8;
+
+    // Whether the recorded frame can be projected into a frame of scene at
+    // this resolution taken from a different camera
+    bool usable(const Scene &scene, const CameraSnapshot &camera, int width, int height) const;
+    void invalidate() { valid_ = false; }
+
+    // Scatters the recorded hits into camera, keeping the nearest per pixel
+    void project(const CameraSnapshot &camera, ThreadPool &pool);
+
+    // The recorded sample that landed on pixel (x, y) after project(), or
+    // nullptr. Edges get nullptr too: pixels where a neighbour received
+    // nothing or a different object lie on silhouettes and disocclusions,
+    // where scattered samples are least reliable.
+    const PixelHistory *candidate(int x, int y) const;
+
+    // Recording a frame: begin(), record() every pixel, then finish(). The
+    // recorded frame replaces the one candidate() reads at finish().
+    void begin(int width, int height);
+    void record(int x, int y, const PixelHistory &sample) { current_[static_cast<size_t>(y) * width_ + x] = sample; }
+    void finish(const Scene &scene, const CameraSnapshot &camera);
+
+private:
+    static constexpr uint64_t EMPTY = UINT64_MAX;
+
+    std::vector<PixelHistory> history_; // the recorded frame
+    std::vector<PixelHistory> current_; // the frame being recorded
+    // Per pixel of the projected view, the nearest sample landing there as
+    // depth bits above its index in history_, so one atomic min keeps it
+    std::unique_ptr<std::atomic<uint64_t>[]> candidates_;
+    size_t candidate_capacity_ = 0;
+
+    int width_ = 0;
+    int height_ = 0;
+    bool valid_ = false;
+    const Scene *scene_ = nullptr;
+    uint64_t scene_revision_ = 0;
+    CameraSnapshot camera_; // the recorded frame's view
+
+    const PixelHistory *landed(int x, int y) const;
+};
+
+inline bool ReprojectionCache::usable(const Scene &scene, const CameraSnapshot &camera, int width, int height) const
+{
+    return valid_ && &scene == scene_ && scene.revision() == scene_revision_ && width == width_ &&
+           height == height_ && camera.revision != camera_.revision;
+}
+
+inline void ReprojectionCache::project(const CameraSnapshot &camera, ThreadPool &pool)
+{
+    Vec3T<double> r0, r1, r2;
+    camera.projection_rows(r0, r1, r2);
+    const Vec3T<double> origin(camera.position);
+
+    pool.parallel_for(0, static_cast<size_t>(height_), 8, [&](size_t y0, size_t y1)
+                      {
+        for (size_t i = y0 * width_; i < y1 * width_; ++i)
+            candidates_[i].store(EMPTY, std::memory_order_relaxed); });
+
+    pool.parallel_for(0, static_cast<size_t>(height_), 8, [&](size_t y0, size_t y1)
+                      {
+        for (int y = static_cast<int>(y0); y < static_cast<int>(y1); ++y)
+        {
+            for (int x = 0; x < width_; ++x)
+            {
+                const size_t index = static_cast<size_t>(y) * width_ + x;
+                const PixelHistory &sample = history_[index];
+                if (!sample.valid)
+                    continue;
+
+                const Vec3T<double> point = Vec3T<double>(camera_.position) +
+                                            Vec3T<double>(camera_.direction(x, y)) * static_cast<double>(sample.hit.t);
+                const Vec3T<double> v = point - origin;
+                const double s = v.dot(r0);
+                if (!(s > 0.0))
+                    continue;
+                const double px = std::floor(v.dot(r1) / s + 0.5);
+                const double py = std::floor(v.dot(r2) / s + 0.5);
+                if (!(px >= 0.0 && px < width_ && py >= 0.0 && py < height_))
+                    continue;
+
+                // Positive floats order like their bits
+                const float depth = static_cast<float>(s);
+                uint32_t depth_bits;
+                std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+                const uint64_t key = (static_cast<uint64_t>(depth_bits) << 32) | index;
+                std::atomic<uint64_t> &slot = candidates_[static_cast<size_t>(py) * width_ + static_cast<size_t>(px)];
+                uint64_t seen = slot.load(std::memory_order_relaxed);
+                while (key < seen && !slot.compare_exchange_weak(seen, key, std::memory_order_relaxed))
+                {
+                }
+            }
+        } });
+}
+
+inline const PixelHistory *ReprojectionCache::landed(int x, int y) const
+{
+    const uint64_t key = candidates_[static_cast<size_t>(y) * width_ + x].load(std::memory_order_relaxed);
+    return key == EMPTY ? nullptr : &history_[key & 0xffffffffu];
+}
+
+inline const PixelHistory *ReprojectionCache::candidate(int x, int y) const
+{
+    const PixelHistory *sample = landed(x, y);
+    if (!sample)
+        return nullptr;
+
+    auto same_object = [sample](const PixelHistory *other)
+    {
+        return other && other->hit.instance == sample->hit.instance &&
+               (sample->hit.instance != Hit::SPHERE || other->hit.primitive == sample->hit.primitive);
+    };
+    if ((x > 0 && !same_object(landed(x - 1, y))) || (x + 1 < width_ && !same_object(landed(x + 1, y))) ||
+        (y > 0 && !same_object(landed(x, y - 1))) || (y + 1 < height_ && !same_object(landed(x, y + 1))))
+        return nullptr;
+    return sample;
+}
+
+inline void ReprojectionCache::begin(int width, int height)
+{
+    width_ = width;
+    height_ = height;
+    valid_ = false;
+
+    // Sized for the largest frame seen, so steady-state frames don't allocate
+    const size_t pixels = static_cast<size_t>(width) * height;
+    if (current_.size() < pixels)
+    {
+        current_.resize(pixels);
+        history_.resize(pixels);
+    }
+    if (candidate_capacity_ < pixels)
+    {
+        candidates_ = std::make_unique<std::atomic<uint64_t>[]>(pixels);
+        candidate_capacity_ = pixels;
+    }
+}
+
+inline void ReprojectionCache::finish(const Scene &scene, const CameraSnapshot &camera)
+{
+    history_.swap(current_);
+    scene_ = &scene;
+    scene_revision_ = scene.revision();
+    camera_ = camera;
+    valid_ = true;
+}
+
+#endif
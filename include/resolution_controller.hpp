@@ -0,0 +1,125 @@
+#ifndef RESOLUTION_CONTROLLER_HPP
+#define RESOLUTION_CONTROLLER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include "config.hpp"
+
+// Picks the internal render scale that keeps Renderer::render within a
+// frame-time budget. Render time grows with the pixel count, i.e. with the
+// square of the scale, so each adjustment scales by sqrt(target / measured).
+// To keep it from oscillating it only acts after SETTLE_FRAMES frames at the
+// current scale, ignores averages inside a dead band around the target, and
+// raises the scale more cautiously than it lowers it.
+class ResolutionController
+{
+public:
+    static constexpr size_t HISTORY_SIZE = 120;
+    static constexpr int SETTLE_FRAMES = 8;
+
+    explicit ResolutionController(double target_ms = Config::TARGET_FRAME_MS,
+                                  double min_scale = Config::MIN_RENDER_SCALE,
+                                  double max_scale = Config::MAX_RENDER_SCALE,
+                                  double initial_scale = Config::RENDER_SCALE);
+
+    // Records the render time of one frame; returns true when the scale changed
+    bool add_frame(double render_ms);
+    void reset();
+
+    double get_scale() const { return scale_; }
+    double get_max_scale() const { return max_scale_; }
+    double get_target_ms() const { return target_ms_; }
+    void set_target_ms(double target_ms);
+
+    // Smoothed render time at the current scale, 0 until a frame is measured
+    double get_average_ms() const { return average_ms_; }
+
+    // Render times of the last get_history_size() frames, oldest first
+    size_t get_history_size() const { return history_count_; }
+    double get_history(size_t i) const;
+
+private:
+    double target_ms_;
+    double min_scale_;
+    double max_scale_;
+    double scale_;
+
+    double average_ms_;
+    int frames_at_scale_;
+
+    std::array<double, HISTORY_SIZE> history_;
+    size_t history_count_;
+    size_t history_next_;
+};
+
+inline ResolutionController::ResolutionController(double target_ms, double min_scale, double max_scale, double initial_scale)
+    : target_ms_(target_ms), min_scale_(min_scale), max_scale_(std::max(min_scale, max_scale)),
+      scale_(std::min(max_scale_, std::max(min_scale_, initial_scale))), average_ms_(0.0), frames_at_scale_(0),
+      history_{}, history_count_(0), history_next_(0)
+{
+}
+
+inline bool ResolutionController::add_frame(double render_ms)
+{
+    history_[history_next_] = render_ms;
+    history_next_ = (history_next_ + 1) % HISTORY_SIZE;
+    history_count_ = std::min(history_count_ + 1, HISTORY_SIZE);
+
+    // The first frame after a change pays for rebuilding tiles and buffers
+    if (frames_at_scale_++ == 0)
+        return false;
+
+    const double smoothing = 0.25;
+    average_ms_ = frames_at_scale_ == 2 ? render_ms : average_ms_ + smoothing * (render_ms - average_ms_);
+    if (frames_at_scale_ < SETTLE_FRAMES || average_ms_ <= 0.0)
+        return false;
+
+    double factor;
+    if (average_ms_ > target_ms_ * 1.10)
+    {
+        factor = std::max(0.7, std::sqrt(target_ms_ / average_ms_));
+    }
+    else if (average_ms_ < target_ms_ * 0.80)
+    {
+        // Aim below the target so the next measurement lands in the dead band
+        factor = std::min(1.15, std::sqrt(0.9 * target_ms_ / average_ms_));
+    }
+    else
+    {
+        return false;
+    }
+
+    const double new_scale = std::min(max_scale_, std::max(min_scale_, scale_ * factor));
+    if (std::abs(new_scale - scale_) < 0.01)
+        return false;
+
+    scale_ = new_scale;
+    frames_at_scale_ = 0;
+    average_ms_ = 0.0;
+    return true;
+}
+
+inline void ResolutionController::reset()
+{
+    frames_at_scale_ = 0;
+    average_ms_ = 0.0;
+    history_count_ = 0;
+    history_next_ = 0;
+}
+
+inline void ResolutionController::set_target_ms(double target_ms)
+{
+    target_ms_ = target_ms;
+    frames_at_scale_ = 0;
+    average_ms_ = 0.0;
+}
+
+inline double ResolutionController::get_history(size_t i) const
+{
+    size_t oldest = (history_next_ + HISTORY_SIZE - history_count_) % HISTORY_SIZE;
+    return history_[(oldest + i) % HISTORY_SIZE];
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef SAMPLING_HPP
+#define SAMPLING_HPP
+
+#include <cstdint>
+
+// Index-th point of the van der Corput sequence in the given base
+inline double radical_inverse(uint32_t base, uint32_t index)
+{
+    double inverse_base = 1.0 / base;
+    double fraction = inverse_base;
+    double result = 0.0;
+    while (index > 0)
+    {
+        result += (index % base) * fraction;
+        index /= base;
+        fraction *= inverse_base;
+    }
+    return result;
+}
+
+// Avalanches the bits of h (the lowbias32 hash of Chris Wellons)
+inline uint32_t mix_bits(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+// Seed for the random numbers of one path through pixel (x, y)
+inline uint32_t path_seed(int x, int y, uint32_t sample)
+{
+    return mix_bits(static_cast<uint32_t>(x) * 0x8da6b343u ^ static_cast<uint32_t>(y) * 0xd8163841u ^
+                    sample * 0xcb1ab31fu);
+}
+
+// Uniform in [0, 1), advancing state
+inline double next_random(uint32_t &state)
+{
+    state = state * 747796405u + 2891336453u;
+    return mix_bits(state) / 4294967296.0;
+}
+
+// Sub-pixel offset in [-0.5, 0.5)^2 for a sample of pixel (x, y). Sample 0 is
+// the pixel center; later samples follow the Halton (2, 3) sequence, shifted
+// per pixel (Cranley-Patterson rotation) so neighbours don't alias together.
+inline void pixel_jitter(int x, int y, uint32_t sample, double &dx, double &dy)
+{
+    if (sample == 0)
+    {
+        dx = 0.0;
+        dy = 0.0;
+        return;
+    }
+
+    const uint32_t h = mix_bits(static_cast<uint32_t>(x) * 0x8da6b343u ^ static_cast<uint32_t>(y) * 0xd8163841u);
+    const double shift_x = (h & 0xffff) / 65536.0;
+    const double shift_y = (h >> 16) / 65536.0;
+
+    double sx = radical_inverse(2, sample) + shift_x;
+    double sy = radical_inverse(3, sample) + shift_y;
+    dx = (sx >= 1.0 ? sx - 1.0 : sx) - 0.5;
+    dy = (sy >= 1.0 ? sy - 1.0 : sy) - 0.5;
+}
+
+#endif
@@ -1,32 +1,585 @@
 #ifndef SCENE_HPP
 #define SCENE_HPP
 
+#include <cstdint>
+#include <memory>
 #include <vector>
+#include "array_store.hpp"
+#include "material.hpp"
 #include "sphere.hpp"
+#include "bvh.hpp"
+#include "mesh.hpp"
+#include "transform.hpp"
+#include "sphere_soa.hpp"
+#include "simd.hpp"
+#include "instrumentation.hpp"
+#include "thread_pool.hpp"
+
+// What intersection finds: a distance and a primitive, nothing more, so
+// candidates stay cheap to compare and keep. Scene::surface fetches the
+// point, normal and material of the final one.
+struct Hit {
+    static constexpr uint32_t SPHERE = UINT32_MAX;
+
+    Real t;
+    uint32_t primitive; // sphere index, or triangle slot in the instance's mesh
+    uint32_t instance;  // SPHERE for spheres
+};
 
 class Scene {
 public:
+    static constexpr uint32_t NO_SPHERE = UINT32_MAX;
+    // update_acceleration() rebuilds rather than refits once the tree's SAH
+    // cost grows past this multiple of its cost when built
+    static constexpr double REFIT_COST_LIMIT = 1.5;
+    // Editable spheres. Empty while the scene borrows them from a loaded
+    // file; use sphere_count() and sphere_data() to read either kind.
     std::vector<Sphere> spheres;
 
+    // Triangle meshes, each stored once however many instances place it
+    std::vector<Mesh> meshes;
+    std::vector<MeshInstance> instances;
+
     void add_sphere(const Sphere& sphere) {
+        detach();
         spheres.push_back(sphere);
+        revision_++;
+    }
+
+    // Moving spheres. A handle names one sphere from insert_sphere() until
+    // remove_sphere(), while its index in spheres may change as others are
+    // removed; handles of removed spheres are given out again. Spheres
+    // placed any other way get one from sphere_handle(). Updating or
+    // removing through a handle that names no sphere returns false and
+    // changes nothing. Edits reach the acceleration at
+    // update_acceleration(), and until then hit() falls back to the linear
+    // loop.
+    uint32_t insert_sphere(const Sphere& sphere) {
+        sync_handles();
+        const bool editable = editable_acceleration();
+        const uint32_t index = static_cast<uint32_t>(spheres.size());
+        spheres.push_back(sphere);
+        uint32_t handle;
+        if (free_handles_.empty()) {
+            handle = static_cast<uint32_t>(handle_index_.size());
+            handle_index_.push_back(index);
+        } else {
+            handle = free_handles_.back();
+            free_handles_.pop_back();
+            handle_index_[handle] = index;
+        }
+        index_handle_.push_back(handle);
+
+        if (editable) {
+            slot_of_.push_back(static_cast<uint32_t>(soa_.append(sphere, index)));
+            accelerated_count_++;
+            refit_pending_ = true;
+        }
+        revision_++;
+        return handle;
+    }
+
+    bool update_sphere(uint32_t handle, const Sphere& sphere) {
+        sync_handles();
+        const uint32_t index = sphere_index(handle);
+        if (index == NO_SPHERE) {
+            return false;
+        }
+        spheres[index] = sphere;
+        if (editable_acceleration()) {
+            soa_.set(slot_of_[index], sphere, index);
+            refit_pending_ = true;
+        }
+        revision_++;
+        return true;
+    }
+
+    // The last sphere takes the removed one's index
+    bool remove_sphere(uint32_t handle) {
+        sync_handles();
+        const uint32_t index = sphere_index(handle);
+        if (index == NO_SPHERE) {
+            return false;
+        }
+        const uint32_t last = static_cast<uint32_t>(spheres.size() - 1);
+        if (editable_acceleration()) {
+            soa_.kill(slot_of_[index]);
+            soa_.set_id(slot_of_[last], index);
+            slot_of_[index] = slot_of_[last];
+            slot_of_.pop_back();
+            dead_slots_++;
+            accelerated_count_--;
+            refit_pending_ = true;
+        }
+        spheres[index] = spheres[last];
+        spheres.pop_back();
+        index_handle_[index] = index_handle_[last];
+        handle_index_[index_handle_[index]] = index;
+        index_handle_.pop_back();
+        handle_index_[handle] = NO_SPHERE;
+        free_handles_.push_back(handle);
+        revision_++;
+        return true;
+    }
+
+    uint32_t sphere_handle(size_t index) {
+        sync_handles();
+        return index_handle_[index];
+    }
+
+    // Index in spheres of a handle given out above, or NO_SPHERE once removed
+    uint32_t sphere_index(uint32_t handle) const {
+        return handle < handle_index_.size() ? handle_index_[handle] : NO_SPHERE;
+    }
+
+    // Appends to the material table and returns the id spheres and
+    // instances refer to it by. Borrowed spheres stay borrowed.
+    uint32_t add_material(const Material& material) {
+        detach_materials();
+        materials_.vector().push_back(material);
+        revision_++;
+        return static_cast<uint32_t>(materials_.size() - 1);
+    }
+
+    const Material& material(uint32_t id) const { return materials_[id]; }
+    size_t material_count() const { return materials_.size(); }
+    const Material* material_data() const { return materials_.data(); }
+
+    // Builds the mesh's BLAS and returns its index for add_instance
+    uint32_t add_mesh(Mesh mesh) {
+        mesh.build();
+        meshes.push_back(std::move(mesh));
+        revision_++;
+        return static_cast<uint32_t>(meshes.size() - 1);
+    }
+
+    // Places a mesh; the TLAS over instances is rebuilt by build_acceleration
+    void add_instance(uint32_t mesh, const Transform& object_to_world, uint32_t material) {
+        instances.push_back(MeshInstance{mesh, object_to_world, object_to_world.inverse(), material});
+        tlas_.clear();
+        accelerated_ = false;
+        revision_++;
+    }
+
+    size_t sphere_count() const { return borrowed_spheres_ ? borrowed_count_ : spheres.size(); }
+    const Sphere* sphere_data() const { return borrowed_spheres_ ? borrowed_spheres_ : spheres.data(); }
+
+    // Reads spheres, materials and acceleration data from memory that storage
+    // keeps alive, such as a mapped scene file (see load_scene), without copying
+    void borrow(std::shared_ptr<const void> storage, const Sphere* spheres_data, size_t count,
+                const Material* materials_data, size_t material_count, const SphereSoA& soa, const BVH& bvh) {
+        spheres.clear();
+        storage_ = std::move(storage);
+        borrowed_spheres_ = spheres_data;
+        borrowed_count_ = count;
+        materials_.borrow(materials_data, material_count);
+        soa_ = soa;
+        bvh_ = bvh;
+        meshes.clear();
+        instances.clear();
+        tlas_.clear();
+        accelerated_ = !soa_.empty();
+        use_bvh_ = !bvh_.empty();
+        reset_dynamic_state();
+        built_cost_ = bvh_.sah_cost();
+        clear_handles();
+        revision_++;
+    }
+
+    // Replaces every sphere and material and drops the acceleration
+    void set_spheres(std::vector<Sphere> new_spheres, std::vector<Material> new_materials) {
+        storage_.reset();
+        borrowed_spheres_ = nullptr;
+        borrowed_count_ = 0;
+        spheres = std::move(new_spheres);
+        materials_.vector() = std::move(new_materials);
+        clear_handles();
+        clear_acceleration();
+    }
+
+    // Copies borrowed spheres and materials so they can be edited
+    void detach() {
+        detach_materials();
+        if (!borrowed_spheres_)
+            return;
+        spheres.assign(borrowed_spheres_, borrowed_spheres_ + borrowed_count_);
+        borrowed_spheres_ = nullptr;
+        borrowed_count_ = 0;
+    }
+
+    // Changes whenever the scene may render differently. Edits made to
+    // spheres directly are picked up by the build_acceleration() that must
+    // follow them, or by mark_changed().
+    uint64_t revision() const { return revision_; }
+    void mark_changed() { revision_++; }
+
+    // Copies the spheres into SoA form for the SIMD kernels and, with use_bvh,
+    // builds a BVH over them (SoA slots then follow BVH leaf order) and the
+    // top-level BVH (TLAS) over mesh instances. Until this is called, or after
+    // spheres or instances change, hit() falls back to the linear loop.
+    void build_acceleration(bool use_bvh = true) {
+        if (use_bvh) {
+            bvh_.build(sphere_data(), sphere_count());
+            soa_.build(sphere_data(), sphere_count(), bvh_.indices().data());
+
+            std::vector<AABB> boxes(instances.size());
+            for (size_t i = 0; i < instances.size(); ++i) {
+                boxes[i] = instances[i].object_to_world.box(meshes[instances[i].mesh].bounds());
+            }
+            tlas_.build(boxes.data(), boxes.size());
+        } else {
+            bvh_.clear();
+            tlas_.clear();
+            soa_.build(sphere_data(), sphere_count());
+        }
+        accelerated_ = true;
+        use_bvh_ = use_bvh;
+        reset_dynamic_state();
+        built_cost_ = bvh_.sah_cost();
+        revision_++;
+    }
+
+    // Brings the acceleration up to date with the edits made through
+    // sphere handles since it was built: new spheres are inserted into the
+    // BVH and every box is refit in parallel on pool, which costs far less
+    // than a build. Rebuilds instead once the refit tree's SAH cost exceeds
+    // REFIT_COST_LIMIT times its built cost, once it is too deep to
+    // traverse, or once removed spheres hold a quarter of the SoA slots.
+    // Returns whether it rebuilt. Scenes without acceleration are left so.
+    bool update_acceleration(ThreadPool& pool) {
+        if (!accelerated_) {
+            return false;
+        }
+        bool rebuild = rebuild_pending_ || accelerated_count_ != sphere_count() || dead_slots_ * 4 > soa_.size();
+        if (!rebuild && !refit_pending_) {
+            return false;
+        }
+        if (!rebuild && use_bvh_) {
+            const SphereSpan span = soa_.span();
+            for (size_t slot = bvh_.primitive_count(); slot < soa_.size(); ++slot) {
+                AABB box;
+                const Real r = span.radius[slot];
+                if (r >= 0) {
+                    const Vec3 center(span.cx[slot], span.cy[slot], span.cz[slot]);
+                    box.grow(center - Vec3(r, r, r));
+                    box.grow(center + Vec3(r, r, r));
+                }
+                bvh_.insert(box, soa_.id(slot));
+            }
+            const int depth = bvh_.refit(span, pool);
+            rebuild = depth > BVH::MAX_DEPTH || bvh_.sah_cost() > REFIT_COST_LIMIT * built_cost_;
+        }
+        if (rebuild) {
+            build_acceleration(use_bvh_);
+            return true;
+        }
+        refit_pending_ = false;
+        revision_++;
+        return false;
+    }
+
+    void clear_acceleration() {
+        bvh_.clear();
+        soa_.clear();
+        tlas_.clear();
+        accelerated_ = false;
+        reset_dynamic_state();
+        revision_++;
+    }
+
+    bool has_acceleration() const {
+        return accelerated_ && !refit_pending_ && !rebuild_pending_ && accelerated_count_ == sphere_count();
+    }
+
+    const BVH& bvh() const { return bvh_; }
+    const SphereSoA& soa() const { return soa_; }
+
+    // Nearest hit in (t_min, t_max) with its attributes
+    bool hit(const Ray& ray, Real t_min, Real t_max, HitRecord& rec) const {
+        Hit nearest;
+        if (!intersect(ray, t_min, t_max, nearest)) {
+            return false;
+        }
+        rec = surface(ray, nearest);
+        return true;
+    }
+
+    // Nearest hit in (t_min, t_max) as a distance and primitive only
+    bool intersect(const Ray& ray, Real t_min, Real t_max, Hit& hit) const {
+        if (!has_acceleration()) {
+            return intersect_linear(ray, t_min, t_max, hit);
+        }
+
+        Real t = t_max;
+        size_t slot = 0;
+        bool found;
+        if (bvh_.empty()) {
+            Instrumentation::count_sphere_tests(soa_.size());
+            found = simd_kernels().nearest_sphere(soa_.span(), 0, soa_.size(), ray, t_min, t, slot);
+        } else {
+            found = bvh_.hit(soa_.span(), ray, t_min, t, slot);
+        }
+        if (found) {
+            hit = Hit{t, soa_.id(slot), Hit::SPHERE};
+        }
+        if (intersect_instances(ray, t_min, t, hit)) {
+            found = true;
+        }
+        return found;
+    }
+
+    // Point, normal and material of a hit that intersect() found for ray.
+    // Sphere points are projected back onto the surface (see fill_hit).
+    HitRecord surface(const Ray& ray, const Hit& hit) const {
+        HitRecord rec;
+        if (hit.instance == Hit::SPHERE) {
+            sphere_data()[hit.primitive].fill_hit(ray, hit.t, rec);
+            return rec;
+        }
+
+        const MeshInstance& instance = instances[hit.instance];
+        Vec3 normal = instance.world_to_object.transpose_vector(meshes[instance.mesh].normal(hit.primitive)).normalize();
+        if (normal.dot(ray.direction) > 0) {
+            normal = normal * Real(-1);
+        }
+        rec.t = hit.t;
+        rec.point = ray.point_at(hit.t);
+        rec.normal = normal;
+        rec.material = instance.material;
+        return rec;
+    }
+
+    // Nearest mesh instance hit in (t_min, t_max), walking the TLAS once
+    // has_acceleration() and every instance before. Rays enter each mesh's
+    // object space unnormalized, so t means the same there as in world space.
+    bool intersect_instances(const Ray& ray, Real t_min, Real t_max, Hit& hit) const {
+        if (instances.empty()) {
+            return false;
+        }
+
+        Real t = t_max;
+        size_t best_instance = 0;
+        size_t best_slot = 0;
+        const bool accelerated = has_acceleration();
+        auto test = [&](size_t index, Real& t_closest) {
+            const MeshInstance& instance = instances[index];
+            const Mesh& mesh = meshes[instance.mesh];
+            const Ray local = Ray::from_unit(instance.world_to_object.point(ray.origin),
+                                             instance.world_to_object.vector(ray.direction));
+            size_t slot;
+            const bool found = accelerated ? mesh.hit(local, t_min, t_closest, slot)
+                                           : mesh.hit_linear(local, t_min, t_closest, slot);
+            if (found) {
+                best_instance = index;
+                best_slot = slot;
+            }
+            return found;
+        };
+
+        bool found = false;
+        if (accelerated && !tlas_.empty()) {
+            const uint32_t* order = tlas_.indices().data();
+            found = tlas_.traverse(ray, t_min, t, [&](size_t begin, size_t end, Real& t_closest) {
+                bool leaf_hit = false;
+                for (size_t i = begin; i < end; ++i) {
+                    leaf_hit |= test(order[i], t_closest);
+                }
+                return leaf_hit;
+            });
+        } else {
+            for (size_t i = 0; i < instances.size(); ++i) {
+                found |= test(i, t);
+            }
+        }
+        if (found) {
+            hit = Hit{t, static_cast<uint32_t>(best_slot), static_cast<uint32_t>(best_instance)};
+        }
+        return found;
+    }
+
+    // Whether anything blocks the ray before t_max, for shadow rays. Stops at
+    // the first hit found and computes no hit attributes. The query starts
+    // at t = 0, so move origins off surfaces first (offset_ray_origin).
+    bool occluded(const Ray& ray, Real t_max) const {
+        const Real t_min = 0;
+        if (!has_acceleration()) {
+            const Sphere* data = sphere_data();
+            const size_t count = sphere_count();
+            for (size_t i = 0; i < count; ++i) {
+                Real t;
+                if (data[i].intersect(ray, t_min, t_max, t)) {
+                    Instrumentation::count_sphere_tests(i + 1);
+                    return true;
+                }
+            }
+            Instrumentation::count_sphere_tests(count);
+            return occluded_instances(ray, t_min, t_max);
+        }
+
+        if (bvh_.empty()) {
+            Instrumentation::count_sphere_tests(soa_.size());
+            if (simd_kernels().occluded_sphere(soa_.span(), 0, soa_.size(), ray, t_min, t_max)) {
+                return true;
+            }
+        } else if (bvh_.occluded(soa_.span(), ray, t_min, t_max)) {
+            return true;
+        }
+        return occluded_instances(ray, t_min, t_max);
+    }
+
+    // Nearest hit for every ray of a coherent packet, as SoA slots in
+    // packet.slot (soa().id() names the sphere). Requires has_acceleration().
+    void hit_packet(RayPacket& packet, const PacketFrustum& frustum) const {
+        if (!bvh_.empty()) {
+            bvh_.hit_packet(soa_.span(), packet, frustum);
+            return;
+        }
+
+        const SphereSpan span = soa_.span();
+        const PacketSphereFn packet_sphere = simd_kernels().packet_sphere;
+        for (size_t slot = 0; slot < soa_.size(); ++slot) {
+            Vec3 center(span.cx[slot], span.cy[slot], span.cz[slot]);
+            if (!frustum.cull_sphere(center, span.radius[slot])) {
+                packet_sphere(span, slot, packet);
+                Instrumentation::count_sphere_tests(packet.count);
+            }
+        }
     }
 
-    bool hit(const Ray& ray, double t_min, double t_max, HitRecord& rec) const {
-        HitRecord temp_rec;
+    bool occluded_instances(const Ray& ray, Real t_min, Real t_max) const {
+        if (instances.empty()) {
+            return false;
+        }
+
+        const bool accelerated = has_acceleration();
+        auto test = [&](size_t index) {
+            const MeshInstance& instance = instances[index];
+            const Mesh& mesh = meshes[instance.mesh];
+            const Ray local = Ray::from_unit(instance.world_to_object.point(ray.origin),
+                                             instance.world_to_object.vector(ray.direction));
+            return accelerated ? mesh.occluded(local, t_min, t_max) : mesh.occluded_linear(local, t_min, t_max);
+        };
+
+        if (accelerated && !tlas_.empty()) {
+            const uint32_t* order = tlas_.indices().data();
+            return tlas_.any_hit(ray, t_min, t_max, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    if (test(order[i])) {
+                        return true;
+                    }
+                }
+                return false;
+            });
+        }
+        for (size_t i = 0; i < instances.size(); ++i) {
+            if (test(i)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Reference implementation: tests every sphere
+    bool intersect_linear(const Ray& ray, Real t_min, Real t_max, Hit& hit) const {
         bool hit_anything = false;
-        double closest_so_far = t_max;
+        Real closest_so_far = t_max;
+        const Sphere* data = sphere_data();
+        const size_t count = sphere_count();
+        Instrumentation::count_sphere_tests(count);
 
-        for (const auto& sphere : spheres) {
-            if (sphere.hit(ray, t_min, closest_so_far, temp_rec)) {
+        for (size_t i = 0; i < count; ++i) {
+            Real t;
+            if (data[i].intersect(ray, t_min, closest_so_far, t)) {
                 hit_anything = true;
-                closest_so_far = temp_rec.t;
-                rec = temp_rec;
+                closest_so_far = t;
+                hit = Hit{t, static_cast<uint32_t>(i), Hit::SPHERE};
             }
         }
+        if (intersect_instances(ray, t_min, closest_so_far, hit)) {
+            hit_anything = true;
+        }
 
         return hit_anything;
     }
+
+private:
+    BVH bvh_;
+    SphereSoA soa_;
+    BVH tlas_;
+    ArrayStore<Material> materials_;
+    bool accelerated_ = false;
+    uint64_t revision_ = 0;
+
+    // Sphere handles: each handle's index, each index's handle, and
+    // handles free to give out again
+    std::vector<uint32_t> handle_index_;
+    std::vector<uint32_t> index_handle_;
+    std::vector<uint32_t> free_handles_;
+
+    // What edits since the last build leave for update_acceleration()
+    bool use_bvh_ = false;
+    size_t accelerated_count_ = 0; // spheres the acceleration holds
+    std::vector<uint32_t> slot_of_; // each sphere's SoA slot, once edited
+    size_t dead_slots_ = 0;         // slots of removed spheres
+    bool refit_pending_ = false;
+    bool rebuild_pending_ = false;  // edited while borrowed from a file
+    double built_cost_ = 0.0;
+
+    std::shared_ptr<const void> storage_;
+    const Sphere* borrowed_spheres_ = nullptr;
+    size_t borrowed_count_ = 0;
+
+    // Copies borrowed materials; the spheres may stay borrowed
+    void detach_materials() {
+        if (materials_.borrowed()) {
+            std::vector<Material> copy(materials_.begin(), materials_.end());
+            materials_.vector() = std::move(copy);
+        }
+    }
+
+    // Handles for spheres placed without insert_sphere()
+    void sync_handles() {
+        detach();
+        while (index_handle_.size() < spheres.size()) {
+            index_handle_.push_back(static_cast<uint32_t>(handle_index_.size()));
+            handle_index_.push_back(static_cast<uint32_t>(index_handle_.size() - 1));
+        }
+    }
+
+    void clear_handles() {
+        handle_index_.clear();
+        index_handle_.clear();
+        free_handles_.clear();
+    }
+
+    void reset_dynamic_state() {
+        accelerated_count_ = accelerated_ ? sphere_count() : 0;
+        slot_of_.clear();
+        dead_slots_ = 0;
+        refit_pending_ = false;
+        rebuild_pending_ = false;
+    }
+
+    // Whether edits can go straight into the SoA slots, mapping spheres to
+    // slots on first use; if not, the next update rebuilds
+    bool editable_acceleration() {
+        if (!accelerated_) {
+            return false;
+        }
+        if (soa_.borrowed() || bvh_.borrowed() || accelerated_count_ != spheres.size()) {
+            rebuild_pending_ = true;
+            return false;
+        }
+        if (slot_of_.size() != spheres.size()) {
+            slot_of_.assign(spheres.size(), NO_SPHERE);
+            for (size_t slot = 0; slot < soa_.size(); ++slot) {
+                if (soa_.span().radius[slot] >= 0) {
+                    slot_of_[soa_.id(slot)] = static_cast<uint32_t>(slot);
+                }
+            }
+        }
+        return true;
+    }
 };
 
-#endif 
\ No newline at end of file
+#endif
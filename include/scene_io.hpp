@@ -0,0 +1,72 @@
+#ifndef SCENE_IO_HPP
+#define SCENE_IO_HPP
+
+#include <cstdint>
+#include <string>
+#include "scene.hpp"
+
+// Scene files.
+//
+// Binary (.rtscene): a Scene's arrays exactly as they sit in memory,
+// spheres, materials, SoA slots and BVH nodes, each at a 64-byte aligned
+// offset. load_scene maps the file and points the scene at them, so nothing
+// is parsed, copied or rebuilt and startup takes about as long for ten
+// million spheres as for three; pages are read as rays first touch them.
+// Files use the native byte order and layout, and a build whose Real, Sphere
+// or Material layout differs rejects them. Import the text form again in
+// that case. Contents are trusted beyond the header and section bounds
+// checks.
+//
+// Text: one sphere per line, "x y z radius" with an optional "r g b" color in
+// [0, 1]; '#' starts a comment. Read in fixed-size chunks, so memory holds
+// the spheres and one chunk, never the whole file.
+//
+// Meshes come from Wavefront OBJ files, of which only vertex positions and
+// faces are read. Binary scene files don't hold meshes yet.
+
+struct SceneFileHeader
+{
+    char magic[8];             // SCENE_FILE_MAGIC
+    uint32_t version;          // SCENE_FILE_VERSION
+    uint32_t byte_order;       // 0x01020304 as written by the saving machine
+    uint32_t real_size;        // sizeof(Real)
+    uint32_t sphere_size;      // sizeof(Sphere)
+    uint32_t material_size;    // sizeof(Material)
+    uint32_t node_size;        // sizeof(BVHNode)
+    uint32_t soa_padding;      // SphereSoA::PADDING
+    uint64_t sphere_count;
+    uint64_t material_count;
+    uint64_t slot_count;       // SoA array length including padding, 0 without acceleration
+    uint64_t node_count;       // 0 without a BVH
+    uint64_t file_size;
+    uint64_t spheres_offset;   // Sphere[sphere_count]
+    uint64_t materials_offset; // Material[material_count], indexed by Sphere::material
+    uint64_t cx_offset;        // Real[slot_count], likewise cy, cz and radius
+    uint64_t cy_offset;
+    uint64_t cz_offset;
+    uint64_t radius_offset;
+    uint64_t ids_offset;       // uint32_t[sphere_count], sphere in each slot; also the BVH indices
+    uint64_t nodes_offset;     // BVHNode[node_count]
+};
+
+constexpr char SCENE_FILE_MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+constexpr uint32_t SCENE_FILE_VERSION = 3;
+
+// Writes the scene and whatever acceleration it has built. Returns false and
+// prints why when the file can't be written or the scene has mesh instances.
+bool save_scene(const Scene &scene, const std::string &path);
+
+// Maps a binary scene file into scene, replacing its contents
+bool load_scene(const std::string &path, Scene &scene);
+
+// Reads a text scene into scene, replacing its contents, without acceleration
+bool import_scene_text(const std::string &path, Scene &scene);
+
+// Reads the positions and faces of an OBJ file into mesh, unbuilt; polygons
+// become triangle fans
+bool load_obj(const std::string &path, Mesh &mesh);
+
+// load_scene for .rtscene files, import_scene_text for anything else
+bool open_scene(const std::string &path, Scene &scene);
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef SCENES_HPP
+#define SCENES_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "scene.hpp"
+
+// Built-in scenes shared by the interactive and headless front ends.
+inline Scene create_default_scene()
+{
+    Scene scene;
+    scene.add_sphere(Sphere(Vec3(0, 0, -5), 1.0, scene.add_material(Material{Vec3(1.0, 0.2, 0.2)})));  // Red
+    scene.add_sphere(Sphere(Vec3(2, 0, -6), 1.0, scene.add_material(Material{Vec3(0.2, 1.0, 0.2)})));  // Green
+    scene.add_sphere(Sphere(Vec3(-2, 0, -4), 1.0, scene.add_material(Material{Vec3(0.2, 0.2, 1.0)}))); // Blue
+    return scene;
+}
+
+// Deterministic cloud of random spheres in front of the default camera,
+// sized so density stays roughly constant as count grows.
+inline Scene create_sphere_field(int count, uint32_t seed = 1)
+{
+    Scene scene;
+    scene.spheres.reserve(count);
+
+    uint32_t state = seed ? seed : 1;
+    auto next = [&state]()
+    {
+        // xorshift32
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state / 4294967296.0;
+    };
+
+    const double extent = 4.0 * std::cbrt(static_cast<double>(count));
+    const double radius = 0.5;
+    for (int i = 0; i < count; ++i)
+    {
+        Vec3 center((next() - 0.5) * extent,
+                    (next() - 0.5) * extent,
+                    -2.0 - radius - next() * extent);
+        Vec3 color(0.2 + 0.8 * next(), 0.2 + 0.8 * next(), 0.2 + 0.8 * next());
+        scene.add_sphere(Sphere(center, radius * (0.5 + next()), scene.add_material(Material{color})));
+    }
+    return scene;
+}
+
+// Scatters count instances of a mesh the way create_sphere_field scatters
+// spheres, each turned about y and scaled to about a unit across
+inline void add_mesh_field(Scene &scene, uint32_t mesh, int count, uint32_t seed = 1)
+{
+    uint32_t state = seed ? seed : 1;
+    auto next = [&state]()
+    {
+        // xorshift32
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state / 4294967296.0;
+    };
+
+    const AABB &bounds = scene.meshes[mesh].bounds();
+    const Vec3 size = bounds.max - bounds.min;
+    const double largest = std::max(size.x, std::max(size.y, size.z));
+    const Transform centered = Transform::translation((bounds.min + bounds.max) * Real(-0.5));
+    const double extent = 4.0 * std::cbrt(static_cast<double>(count));
+    for (int i = 0; i < count; ++i)
+    {
+        Vec3 position((next() - 0.5) * extent,
+                      (next() - 0.5) * extent,
+                      -2.5 - next() * extent);
+        const Transform place = Transform::translation(position) * Transform::rotation_y(360.0 * next()) *
+                                Transform::scale(static_cast<Real>((0.75 + 0.5 * next()) / largest)) * centered;
+        Vec3 color(0.2 + 0.8 * next(), 0.2 + 0.8 * next(), 0.2 + 0.8 * next());
+        scene.add_instance(mesh, place, scene.add_material(Material{color}));
+    }
+}
+
+// A camera pose along a fixed path, for repeatable multi-frame runs
+struct CameraPose
+{
+    Vec3 position;
+    double yaw;
+    double pitch;
+};
+
+// Slow dolly into the scene with a gentle pan and tilt, t in [0, 1]. Starts
+// at the default camera, so every built-in scene stays in view.
+inline CameraPose camera_path_pose(double t)
+{
+    const double angle = 2.0 * M_PI * t;
+    CameraPose pose;
+    pose.position = Vec3(0.5 * std::sin(angle), 0.25 * std::sin(2.0 * angle), 3.0 - 1.5 * t);
+    pose.yaw = -90.0 + 8.0 * std::sin(angle);
+    pose.pitch = 4.0 * std::sin(2.0 * angle);
+    return pose;
+}
+
+#endif
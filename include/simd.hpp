@@ -0,0 +1,111 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <cstddef>
+#include <string>
+#include "ray.hpp"
+#include "ray_packet.hpp"
+#include "sphere_soa.hpp"
+#include "triangle_soa.hpp"
+
+// Instruction sets the intersection kernels are compiled for. Each one lives
+// in its own translation unit (src/simd_*.cpp) built with the matching
+// compiler flags; the best one the CPU supports is picked at runtime.
+enum class SimdIsa
+{
+    Scalar,
+    SSE41,
+    AVX2,
+    AVX512
+};
+
+// Finds the nearest sphere in slots [begin, end) hit by the ray in
+// (t_min, t_closest). On a hit, updates t_closest and slot and returns true.
+// Ties resolve to the lowest slot, matching a sequential loop.
+using NearestSphereFn = bool (*)(const SphereSpan &spheres, size_t begin, size_t end,
+                                 const Ray &ray, Real t_min, Real &t_closest, size_t &slot);
+
+// Tests one sphere against every ray of the packet, updating each ray's
+// nearest t and slot. Rays are tested W at a time.
+using PacketSphereFn = void (*)(const SphereSpan &spheres, size_t slot, RayPacket &packet);
+
+// Finds the nearest triangle in slots [begin, end) hit by the ray in
+// (t_min, t_closest), like NearestSphereFn. The direction need not be unit
+// length; t is measured along it.
+using NearestTriangleFn = bool (*)(const TriangleSpan &triangles, size_t begin, size_t end,
+                                   const Ray &ray, Real t_min, Real &t_closest, size_t &slot);
+
+// Whether any sphere or triangle in slots [begin, end) is hit in
+// (t_min, t_max). Stops at the first hit found, in no particular order.
+using OccludedSphereFn = bool (*)(const SphereSpan &spheres, size_t begin, size_t end,
+                                  const Ray &ray, Real t_min, Real t_max);
+using OccludedTriangleFn = bool (*)(const TriangleSpan &triangles, size_t begin, size_t end,
+                                    const Ray &ray, Real t_min, Real t_max);
+
+// Quantizes count floats of RGBA color to bytes. Each is multiplied by
+// gain[i % 16], clamped to [0, 1], square-rooted when gamma is set, scaled,
+// raised by offset[i % 16] and truncated; the patterns cover four pixels.
+// rgba must be 64-byte aligned and count a multiple of 4.
+using ResolvePixelsFn = void (*)(const float *rgba, size_t count, const float *gain, const float *offset,
+                                 float scale, bool gamma, unsigned char *out);
+
+// Planes of the denoiser, one float per pixel each, all laid out alike
+// and bordered so every tap of a pass lands inside them
+struct DenoisePlanes
+{
+    const float *color[3];
+    const float *color_weight; // per pixel, how strongly color differences count
+    const float *normal[3];
+    const float *depth;
+    const float *albedo[3];
+    float *out[3];
+};
+
+// Inverse squared widths of the denoiser's edge-stopping terms
+struct DenoiseWeights
+{
+    float color; // scales DenoisePlanes::color_weight
+    float normal;
+    float depth; // of the difference relative to the centre's depth
+    float albedo;
+};
+
+// One edge-avoiding a-trous pass over pixels [begin, begin + count) of the
+// planes. Each output color is the mean of the 3x3 pixels step apart
+// (row_step between rows), weighted by a B-spline and by how far their
+// color, normal, depth and albedo are from the centre's.
+using DenoiseRowFn = void (*)(const DenoisePlanes &planes, size_t begin, size_t count, size_t step, size_t row_step,
+                              const DenoiseWeights &weights);
+
+struct SimdKernels
+{
+    SimdIsa isa;
+    NearestSphereFn nearest_sphere;
+    PacketSphereFn packet_sphere;
+    NearestTriangleFn nearest_triangle;
+    OccludedSphereFn occluded_sphere;
+    OccludedTriangleFn occluded_triangle;
+    ResolvePixelsFn resolve_pixels;
+    DenoiseRowFn denoise_row;
+};
+
+// Per-ISA tables, nullptr when that ISA was not compiled in
+const SimdKernels *simd_kernels_scalar();
+const SimdKernels *simd_kernels_sse41();
+const SimdKernels *simd_kernels_avx2();
+const SimdKernels *simd_kernels_avx512();
+
+bool simd_isa_supported(SimdIsa isa);
+SimdIsa best_simd_isa();
+const char *simd_isa_name(SimdIsa isa);
+bool parse_simd_isa(const std::string &name, SimdIsa &isa);
+
+// Active kernels. Defaults to best_simd_isa(), or RAYTRACER_SIMD from the
+// environment (scalar, sse4.1, avx2, avx512) when set.
+const SimdKernels &simd_kernels();
+
+// Forces a specific ISA; returns false and leaves the selection unchanged
+// when the CPU or the build does not support it.
+bool set_simd_isa(SimdIsa isa);
+
+#endif
@@ -0,0 +1,416 @@
+#ifndef SIMD_KERNELS_HPP
+#define SIMD_KERNELS_HPP
+
+// Kernel templates shared by every src/simd_*.cpp. Instantiated with
+// ScalarLanes they are the scalar fallback; the operation order is the same
+// for every lane type, so all instruction sets return bit-identical results
+// (the library is built with -ffp-contract=off to keep it that way).
+
+#include <cstddef>
+#include "ray.hpp"
+#include "ray_packet.hpp"
+#include "simd.hpp"
+#include "simd_lanes.hpp"
+#include "sphere_soa.hpp"
+#include "triangle_soa.hpp"
+
+namespace SIMD_TARGET_NAMESPACE
+{
+
+// Folds per-lane results into t_closest and slot: the nearest lane wins and
+// equal t goes to the lower slot, like a sequential loop. Lanes with a
+// negative slot found nothing.
+template <class V>
+bool reduce_nearest(V best_t, V best_slot, Real &t_closest, size_t &slot)
+{
+    constexpr int W = V::width;
+    Real lane_t[W];
+    Real lane_index[W];
+    best_t.store(lane_t);
+    best_slot.store(lane_index);
+
+    bool found = false;
+    for (int lane = 0; lane < W; ++lane)
+    {
+        if (lane_index[lane] < 0)
+            continue;
+        size_t lane_hit = static_cast<size_t>(lane_index[lane]);
+        if (lane_t[lane] < t_closest || (found && lane_t[lane] == t_closest && lane_hit < slot))
+        {
+            t_closest = lane_t[lane];
+            slot = lane_hit;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// With ANY_HIT, returns at the first block with a hit in (t_min, t_closest)
+// and leaves t_closest and slot alone: the occlusion query of shadow rays.
+template <class V, bool ANY_HIT = false>
+bool nearest_sphere_kernel(const SphereSpan &spheres, size_t begin, size_t end,
+                           const Ray &ray, Real t_min, Real &t_closest, size_t &slot)
+{
+    using M = typename V::Mask;
+    constexpr int W = V::width;
+
+    // Same formulation as Sphere::hit, one ray against W spheres. Vec3 helpers
+    // are avoided on purpose: they are inline functions shared across TUs.
+    const Vec3 &d = ray.direction;
+    const Real a_s = d.x * d.x + d.y * d.y + d.z * d.z;
+    const V ox = V::set1(ray.origin.x);
+    const V oy = V::set1(ray.origin.y);
+    const V oz = V::set1(ray.origin.z);
+    const V dx = V::set1(ray.direction.x);
+    const V dy = V::set1(ray.direction.y);
+    const V dz = V::set1(ray.direction.z);
+    const V a = V::set1(a_s);
+    const V zero = V::set1(0);
+    const V lower = V::set1(t_min);
+    const V last = V::set1(static_cast<Real>(end));
+    const V step = V::set1(W);
+
+    V best_t = V::set1(t_closest);
+    V best_slot = V::set1(-1);
+    V lane_slot = V::iota(static_cast<Real>(begin));
+
+    for (size_t i = begin; i < end; i += W)
+    {
+        V fx = ox - V::load(spheres.cx + i);
+        V fy = oy - V::load(spheres.cy + i);
+        V fz = oz - V::load(spheres.cz + i);
+        V r = V::load(spheres.radius + i);
+
+        V b = fx * dx + fy * dy + fz * dz;
+        V k = b / a;
+        V lx = fx - dx * k;
+        V ly = fy - dy * k;
+        V lz = fz - dz * k;
+        V r2 = r * r;
+        V discriminant = a * (r2 - (lx * lx + ly * ly + lz * lz));
+
+        // Lanes past end belong to the padding or to the next leaf
+        M candidate = V::mask_and(V::gt(discriminant, zero), V::lt(lane_slot, last));
+        if (V::any(candidate))
+        {
+            V c = (fx * fx + fy * fy + fz * fz) - r2;
+            V root = V::sqrt(discriminant);
+            V q = V::neg(b + V::select(V::lt(b, zero), V::neg(root), root));
+            V t0 = c / q;
+            V t1 = q / a;
+            M ordered = V::lt(t0, t1);
+            V t_near = V::select(ordered, t0, t1);
+            V t_far = V::select(ordered, t1, t0);
+
+            M hit0 = V::mask_and(candidate, V::mask_and(V::lt(t_near, best_t), V::gt(t_near, lower)));
+            M hit1 = V::mask_andnot(hit0, V::mask_and(candidate, V::mask_and(V::lt(t_far, best_t), V::gt(t_far, lower))));
+            M hit = V::mask_or(hit0, hit1);
+
+            if constexpr (ANY_HIT)
+            {
+                if (V::any(hit))
+                    return true;
+            }
+            else
+            {
+                best_t = V::select(hit, V::select(hit0, t_near, t_far), best_t);
+                best_slot = V::select(hit, lane_slot, best_slot);
+            }
+        }
+        lane_slot = lane_slot + step;
+    }
+
+    if constexpr (ANY_HIT)
+        return false;
+    else
+        return reduce_nearest(best_t, best_slot, t_closest, slot);
+}
+
+template <class V>
+bool occluded_sphere_kernel(const SphereSpan &spheres, size_t begin, size_t end,
+                            const Ray &ray, Real t_min, Real t_max)
+{
+    size_t slot;
+    return nearest_sphere_kernel<V, true>(spheres, begin, end, ray, t_min, t_max, slot);
+}
+
+// Watertight ray/triangle test of Woop, Benthin and Wald, "Watertight
+// Ray/Triangle Intersection" (JCGT 2013), one ray against W triangles. The
+// corners are moved into a space where the ray runs along +z from the
+// origin; each edge function there depends only on the edge's own two
+// corners, so triangles sharing an edge agree on which side a ray passes and
+// none slip through between them. Points on an edge count as inside. The
+// paper's double precision recheck of edge functions that round to zero is
+// left out: it only decides whether such a ray hits one neighbor or both.
+// ANY_HIT works as in nearest_sphere_kernel.
+template <class V, bool ANY_HIT = false>
+bool nearest_triangle_kernel(const TriangleSpan &triangles, size_t begin, size_t end,
+                             const Ray &ray, Real t_min, Real &t_closest, size_t &slot)
+{
+    using M = typename V::Mask;
+    constexpr int W = V::width;
+
+    // The largest direction component becomes z; swapping x and y when it is
+    // negative keeps the winding
+    const Real d[3] = {ray.direction.x, ray.direction.y, ray.direction.z};
+    const Real o[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+    const Real abs_d[3] = {std::abs(d[0]), std::abs(d[1]), std::abs(d[2])};
+    const int kz = abs_d[0] > abs_d[1] ? (abs_d[0] > abs_d[2] ? 0 : 2) : (abs_d[1] > abs_d[2] ? 1 : 2);
+    int kx = kz == 2 ? 0 : kz + 1;
+    int ky = kx == 2 ? 0 : kx + 1;
+    if (d[kz] < 0)
+        std::swap(kx, ky);
+
+    const Real *const a[3] = {triangles.ax, triangles.ay, triangles.az};
+    const Real *const b[3] = {triangles.bx, triangles.by, triangles.bz};
+    const Real *const c[3] = {triangles.cx, triangles.cy, triangles.cz};
+    const V sx = V::set1(d[kx] / d[kz]);
+    const V sy = V::set1(d[ky] / d[kz]);
+    const V sz = V::set1(1 / d[kz]);
+    const V ox = V::set1(o[kx]);
+    const V oy = V::set1(o[ky]);
+    const V oz = V::set1(o[kz]);
+    const V zero = V::set1(0);
+    const V lower = V::set1(t_min);
+    const V last = V::set1(static_cast<Real>(end));
+    const V step = V::set1(W);
+
+    V best_t = V::set1(t_closest);
+    V best_slot = V::set1(-1);
+    V lane_slot = V::iota(static_cast<Real>(begin));
+
+    for (size_t i = begin; i < end; i += W)
+    {
+        const V az = V::load(a[kz] + i) - oz;
+        const V bz = V::load(b[kz] + i) - oz;
+        const V cz = V::load(c[kz] + i) - oz;
+        const V ax = (V::load(a[kx] + i) - ox) - sx * az;
+        const V ay = (V::load(a[ky] + i) - oy) - sy * az;
+        const V bx = (V::load(b[kx] + i) - ox) - sx * bz;
+        const V by = (V::load(b[ky] + i) - oy) - sy * bz;
+        const V cx = (V::load(c[kx] + i) - ox) - sx * cz;
+        const V cy = (V::load(c[ky] + i) - oy) - sy * cz;
+
+        const V u = cx * by - cy * bx;
+        const V v = ax * cy - ay * cx;
+        const V w = bx * ay - by * ax;
+
+        // Inside when the edge functions don't disagree in sign. Lanes past
+        // end belong to the padding or to the next leaf.
+        const M negative = V::mask_or(V::lt(u, zero), V::mask_or(V::lt(v, zero), V::lt(w, zero)));
+        const M positive = V::mask_or(V::gt(u, zero), V::mask_or(V::gt(v, zero), V::gt(w, zero)));
+        const M inside = V::mask_andnot(V::mask_and(negative, positive), V::lt(lane_slot, last));
+        if (V::any(inside))
+        {
+            // Edge-on triangles have det 0 and give a NaN or infinite t
+            const V det = u + v + w;
+            const V t = (u * (sz * az) + v * (sz * bz) + w * (sz * cz)) / det;
+            const M hit = V::mask_and(inside, V::mask_and(V::lt(t, best_t), V::gt(t, lower)));
+
+            if constexpr (ANY_HIT)
+            {
+                if (V::any(hit))
+                    return true;
+            }
+            else
+            {
+                best_t = V::select(hit, t, best_t);
+                best_slot = V::select(hit, lane_slot, best_slot);
+            }
+        }
+        lane_slot = lane_slot + step;
+    }
+
+    if constexpr (ANY_HIT)
+        return false;
+    else
+        return reduce_nearest(best_t, best_slot, t_closest, slot);
+}
+
+template <class V>
+bool occluded_triangle_kernel(const TriangleSpan &triangles, size_t begin, size_t end,
+                              const Ray &ray, Real t_min, Real t_max)
+{
+    size_t slot;
+    return nearest_triangle_kernel<V, true>(triangles, begin, end, ray, t_min, t_max, slot);
+}
+
+// One sphere against every ray of a packet, lanes running over rays. The
+// per-ray arithmetic matches nearest_sphere_kernel exactly.
+template <class V>
+void packet_sphere_kernel(const SphereSpan &spheres, size_t slot, RayPacket &packet)
+{
+    using M = typename V::Mask;
+    constexpr int W = V::width;
+
+    // The packet shares one origin, so f and c are the same for every ray
+    const Real fx_s = packet.origin.x - spheres.cx[slot];
+    const Real fy_s = packet.origin.y - spheres.cy[slot];
+    const Real fz_s = packet.origin.z - spheres.cz[slot];
+    const Real r = spheres.radius[slot];
+    const Real r2_s = r * r;
+    const Real c_s = (fx_s * fx_s + fy_s * fy_s + fz_s * fz_s) - r2_s;
+
+    const V fx = V::set1(fx_s);
+    const V fy = V::set1(fy_s);
+    const V fz = V::set1(fz_s);
+    const V r2 = V::set1(r2_s);
+    const V c = V::set1(c_s);
+    const V zero = V::set1(0);
+    const V lower = V::set1(packet.t_min);
+    const V slot_v = V::set1(static_cast<Real>(slot));
+
+    for (int i = 0; i < packet.count; i += W)
+    {
+        V dx = V::load(packet.dx + i);
+        V dy = V::load(packet.dy + i);
+        V dz = V::load(packet.dz + i);
+
+        // Unused lanes have a zero direction: k is NaN and nothing passes
+        V a = dx * dx + dy * dy + dz * dz;
+        V b = fx * dx + fy * dy + fz * dz;
+        V k = b / a;
+        V lx = fx - dx * k;
+        V ly = fy - dy * k;
+        V lz = fz - dz * k;
+        V discriminant = a * (r2 - (lx * lx + ly * ly + lz * lz));
+
+        M candidate = V::gt(discriminant, zero);
+        if (!V::any(candidate))
+            continue;
+
+        V best_t = V::load(packet.t + i);
+        V root = V::sqrt(discriminant);
+        V q = V::neg(b + V::select(V::lt(b, zero), V::neg(root), root));
+        V t0 = c / q;
+        V t1 = q / a;
+        M ordered = V::lt(t0, t1);
+        V t_near = V::select(ordered, t0, t1);
+        V t_far = V::select(ordered, t1, t0);
+
+        M hit0 = V::mask_and(candidate, V::mask_and(V::lt(t_near, best_t), V::gt(t_near, lower)));
+        M hit1 = V::mask_andnot(hit0, V::mask_and(candidate, V::mask_and(V::lt(t_far, best_t), V::gt(t_far, lower))));
+        M hit = V::mask_or(hit0, hit1);
+        if (!V::any(hit))
+            continue;
+
+        V::select(hit, V::select(hit0, t_near, t_far), best_t).store(packet.t + i);
+        V::select(hit, slot_v, V::load(packet.slot + i)).store(packet.slot + i);
+    }
+}
+
+// One step of resolve_pixels_kernel over P::width floats starting at i
+template <class P, bool GAMMA>
+void resolve_step(const float *rgba, size_t i, const float *gain, const float *offset, float scale, unsigned char *out)
+{
+    P v = P::load(rgba + i) * P::load(gain + i % 16);
+    v = P::min(P::max(v, P::set1(0.0f)), P::set1(1.0f));
+    if (GAMMA)
+        v = P::sqrt(v);
+    (v * P::set1(scale) + P::load(offset + i % 16)).store_bytes(out + i);
+}
+
+// Lanes step through the four-pixel patterns in place, since 16 is a
+// multiple of every width; the tail goes one float at a time with the same
+// operations.
+template <class P, bool GAMMA>
+void resolve_pixels_impl(const float *rgba, size_t count, const float *gain, const float *offset, float scale,
+                         unsigned char *out)
+{
+    size_t i = 0;
+    for (; i + P::width <= count; i += P::width)
+        resolve_step<P, GAMMA>(rgba, i, gain, offset, scale, out);
+    for (; i < count; ++i)
+        resolve_step<ScalarPixels, GAMMA>(rgba, i, gain, offset, scale, out);
+}
+
+template <class P>
+void resolve_pixels_kernel(const float *rgba, size_t count, const float *gain, const float *offset, float scale,
+                           bool gamma, unsigned char *out)
+{
+    if (gamma)
+        resolve_pixels_impl<P, true>(rgba, count, gain, offset, scale, out);
+    else
+        resolve_pixels_impl<P, false>(rgba, count, gain, offset, scale, out);
+}
+
+// One step of denoise_row_kernel over the P::width pixels starting at i.
+// exp(-d) of the edge-stopping distance d is replaced by 1 over its cubic
+// Taylor series in the denominator: as steep near 0, still exactly 0 at
+// infinity (the border's depth), and one division instead of an exp.
+template <class P>
+void denoise_step(const DenoisePlanes &planes, size_t i, size_t step, size_t row_step, const DenoiseWeights &weights)
+{
+    static constexpr float SPLINE[3] = {0.25f, 0.5f, 0.25f};
+
+    const P r = P::loadu(planes.color[0] + i);
+    const P g = P::loadu(planes.color[1] + i);
+    const P b = P::loadu(planes.color[2] + i);
+    const P nx = P::loadu(planes.normal[0] + i);
+    const P ny = P::loadu(planes.normal[1] + i);
+    const P nz = P::loadu(planes.normal[2] + i);
+    const P ar = P::loadu(planes.albedo[0] + i);
+    const P ag = P::loadu(planes.albedo[1] + i);
+    const P ab = P::loadu(planes.albedo[2] + i);
+    const P depth = P::loadu(planes.depth + i);
+    const P depth_weight = P::set1(weights.depth) / (depth * depth);
+    const P color_weight = P::loadu(planes.color_weight + i) * P::set1(weights.color);
+    const P normal_weight = P::set1(weights.normal);
+    const P albedo_weight = P::set1(weights.albedo);
+    const P one = P::set1(1.0f);
+    const P half = P::set1(0.5f);
+    const P sixth = P::set1(1.0f / 6.0f);
+
+    const P centre = P::set1(SPLINE[1] * SPLINE[1]);
+    P sum_r = centre * r;
+    P sum_g = centre * g;
+    P sum_b = centre * b;
+    P sum_w = centre;
+    for (int dy = 0; dy < 3; ++dy)
+    {
+        for (int dx = 0; dx < 3; ++dx)
+        {
+            if (dx == 1 && dy == 1)
+                continue;
+            const size_t j = i + dy * row_step + dx * step - row_step - step;
+            const P tr = P::loadu(planes.color[0] + j);
+            const P tg = P::loadu(planes.color[1] + j);
+            const P tb = P::loadu(planes.color[2] + j);
+            const P cr = tr - r, cg = tg - g, cb = tb - b;
+            const P mx = P::loadu(planes.normal[0] + j) - nx;
+            const P my = P::loadu(planes.normal[1] + j) - ny;
+            const P mz = P::loadu(planes.normal[2] + j) - nz;
+            const P dz = P::loadu(planes.depth + j) - depth;
+            const P qr = P::loadu(planes.albedo[0] + j) - ar;
+            const P qg = P::loadu(planes.albedo[1] + j) - ag;
+            const P qb = P::loadu(planes.albedo[2] + j) - ab;
+
+            const P d = color_weight * (cr * cr + cg * cg + cb * cb) + normal_weight * (mx * mx + my * my + mz * mz) +
+                        depth_weight * (dz * dz) + albedo_weight * (qr * qr + qg * qg + qb * qb);
+            const P w = P::set1(SPLINE[dy] * SPLINE[dx]) / (one + d * (one + d * (half + d * sixth)));
+            sum_r = sum_r + w * tr;
+            sum_g = sum_g + w * tg;
+            sum_b = sum_b + w * tb;
+            sum_w = sum_w + w;
+        }
+    }
+    (sum_r / sum_w).storeu(planes.out[0] + i);
+    (sum_g / sum_w).storeu(planes.out[1] + i);
+    (sum_b / sum_w).storeu(planes.out[2] + i);
+}
+
+template <class P>
+void denoise_row_kernel(const DenoisePlanes &planes, size_t begin, size_t count, size_t step, size_t row_step,
+                        const DenoiseWeights &weights)
+{
+    const size_t end = begin + count;
+    size_t i = begin;
+    for (; i + P::width <= end; i += P::width)
+        denoise_step<P>(planes, i, step, row_step, weights);
+    for (; i < end; ++i)
+        denoise_step<ScalarPixels>(planes, i, step, row_step, weights);
+}
+
+} // namespace SIMD_TARGET_NAMESPACE
+
+#endif
@@ -0,0 +1,366 @@
+#ifndef SIMD_LANES_HPP
+#define SIMD_LANES_HPP
+
+// Thin wrappers giving every instruction set the same small interface, so
+// kernels in simd_kernels.hpp are written once as templates. Only the
+// wrappers enabled by the current translation unit's flags are defined.
+//
+// Each src/simd_*.cpp defines SIMD_TARGET_NAMESPACE before including this,
+// so inline functions compiled with different -m flags never share a symbol
+// and the linker cannot hand AVX code to the scalar path.
+//
+// Lanes hold Real: twice as many fit in a register in the float build.
+
+#include <cmath>
+#include <cstring>
+#include "vec3.hpp"
+
+#if defined(__SSE4_1__) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#ifndef SIMD_TARGET_NAMESPACE
+#error "Define SIMD_TARGET_NAMESPACE before including simd_lanes.hpp"
+#endif
+
+namespace SIMD_TARGET_NAMESPACE
+{
+
+struct ScalarLanes
+{
+    static constexpr int width = 1;
+    using Mask = bool;
+    Real v;
+
+    static ScalarLanes load(const Real *p) { return {*p}; }
+    static ScalarLanes set1(Real x) { return {x}; }
+    static ScalarLanes iota(Real base) { return {base}; }
+    void store(Real *p) const { *p = v; }
+
+    friend ScalarLanes operator+(ScalarLanes a, ScalarLanes b) { return {a.v + b.v}; }
+    friend ScalarLanes operator-(ScalarLanes a, ScalarLanes b) { return {a.v - b.v}; }
+    friend ScalarLanes operator*(ScalarLanes a, ScalarLanes b) { return {a.v * b.v}; }
+    friend ScalarLanes operator/(ScalarLanes a, ScalarLanes b) { return {a.v / b.v}; }
+    static ScalarLanes neg(ScalarLanes a) { return {-a.v}; }
+    static ScalarLanes sqrt(ScalarLanes a) { return {std::sqrt(a.v)}; }
+
+    static Mask lt(ScalarLanes a, ScalarLanes b) { return a.v < b.v; }
+    static Mask gt(ScalarLanes a, ScalarLanes b) { return a.v > b.v; }
+    static Mask mask_and(Mask a, Mask b) { return a && b; }
+    static Mask mask_or(Mask a, Mask b) { return a || b; }
+    static Mask mask_andnot(Mask a, Mask b) { return !a && b; } // ~a & b
+    static bool any(Mask m) { return m; }
+    static ScalarLanes select(Mask m, ScalarLanes a, ScalarLanes b) { return m ? a : b; }
+};
+
+#ifdef RAYTRACER_DOUBLE_PRECISION
+
+#if defined(__SSE4_1__)
+struct SSE41Lanes
+{
+    static constexpr int width = 2;
+    using Mask = __m128d;
+    __m128d v;
+
+    static SSE41Lanes load(const double *p) { return {_mm_loadu_pd(p)}; }
+    static SSE41Lanes set1(double x) { return {_mm_set1_pd(x)}; }
+    static SSE41Lanes iota(double base) { return {_mm_setr_pd(base, base + 1)}; }
+    void store(double *p) const { _mm_storeu_pd(p, v); }
+
+    friend SSE41Lanes operator+(SSE41Lanes a, SSE41Lanes b) { return {_mm_add_pd(a.v, b.v)}; }
+    friend SSE41Lanes operator-(SSE41Lanes a, SSE41Lanes b) { return {_mm_sub_pd(a.v, b.v)}; }
+    friend SSE41Lanes operator*(SSE41Lanes a, SSE41Lanes b) { return {_mm_mul_pd(a.v, b.v)}; }
+    friend SSE41Lanes operator/(SSE41Lanes a, SSE41Lanes b) { return {_mm_div_pd(a.v, b.v)}; }
+    static SSE41Lanes neg(SSE41Lanes a) { return {_mm_xor_pd(a.v, _mm_set1_pd(-0.0))}; }
+    static SSE41Lanes sqrt(SSE41Lanes a) { return {_mm_sqrt_pd(a.v)}; }
+
+    static Mask lt(SSE41Lanes a, SSE41Lanes b) { return _mm_cmplt_pd(a.v, b.v); }
+    static Mask gt(SSE41Lanes a, SSE41Lanes b) { return _mm_cmpgt_pd(a.v, b.v); }
+    static Mask mask_and(Mask a, Mask b) { return _mm_and_pd(a, b); }
+    static Mask mask_or(Mask a, Mask b) { return _mm_or_pd(a, b); }
+    static Mask mask_andnot(Mask a, Mask b) { return _mm_andnot_pd(a, b); }
+    static bool any(Mask m) { return _mm_movemask_pd(m) != 0; }
+    static SSE41Lanes select(Mask m, SSE41Lanes a, SSE41Lanes b) { return {_mm_blendv_pd(b.v, a.v, m)}; }
+};
+#endif
+
+#if defined(__AVX2__)
+struct AVX2Lanes
+{
+    static constexpr int width = 4;
+    using Mask = __m256d;
+    __m256d v;
+
+    static AVX2Lanes load(const double *p) { return {_mm256_loadu_pd(p)}; }
+    static AVX2Lanes set1(double x) { return {_mm256_set1_pd(x)}; }
+    static AVX2Lanes iota(double base) { return {_mm256_setr_pd(base, base + 1, base + 2, base + 3)}; }
+    void store(double *p) const { _mm256_storeu_pd(p, v); }
+
+    friend AVX2Lanes operator+(AVX2Lanes a, AVX2Lanes b) { return {_mm256_add_pd(a.v, b.v)}; }
+    friend AVX2Lanes operator-(AVX2Lanes a, AVX2Lanes b) { return {_mm256_sub_pd(a.v, b.v)}; }
+    friend AVX2Lanes operator*(AVX2Lanes a, AVX2Lanes b) { return {_mm256_mul_pd(a.v, b.v)}; }
+    friend AVX2Lanes operator/(AVX2Lanes a, AVX2Lanes b) { return {_mm256_div_pd(a.v, b.v)}; }
+    static AVX2Lanes neg(AVX2Lanes a) { return {_mm256_xor_pd(a.v, _mm256_set1_pd(-0.0))}; }
+    static AVX2Lanes sqrt(AVX2Lanes a) { return {_mm256_sqrt_pd(a.v)}; }
+
+    static Mask lt(AVX2Lanes a, AVX2Lanes b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+    static Mask gt(AVX2Lanes a, AVX2Lanes b) { return _mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ); }
+    static Mask mask_and(Mask a, Mask b) { return _mm256_and_pd(a, b); }
+    static Mask mask_or(Mask a, Mask b) { return _mm256_or_pd(a, b); }
+    static Mask mask_andnot(Mask a, Mask b) { return _mm256_andnot_pd(a, b); }
+    static bool any(Mask m) { return _mm256_movemask_pd(m) != 0; }
+    static AVX2Lanes select(Mask m, AVX2Lanes a, AVX2Lanes b) { return {_mm256_blendv_pd(b.v, a.v, m)}; }
+};
+#endif
+
+#if defined(__AVX512F__)
+struct AVX512Lanes
+{
+    static constexpr int width = 8;
+    using Mask = __mmask8;
+    __m512d v;
+
+    static AVX512Lanes load(const double *p) { return {_mm512_loadu_pd(p)}; }
+    static AVX512Lanes set1(double x) { return {_mm512_set1_pd(x)}; }
+    static AVX512Lanes iota(double base)
+    {
+        return {_mm512_add_pd(_mm512_set1_pd(base), _mm512_setr_pd(0, 1, 2, 3, 4, 5, 6, 7))};
+    }
+    void store(double *p) const { _mm512_storeu_pd(p, v); }
+
+    friend AVX512Lanes operator+(AVX512Lanes a, AVX512Lanes b) { return {_mm512_add_pd(a.v, b.v)}; }
+    friend AVX512Lanes operator-(AVX512Lanes a, AVX512Lanes b) { return {_mm512_sub_pd(a.v, b.v)}; }
+    friend AVX512Lanes operator*(AVX512Lanes a, AVX512Lanes b) { return {_mm512_mul_pd(a.v, b.v)}; }
+    friend AVX512Lanes operator/(AVX512Lanes a, AVX512Lanes b) { return {_mm512_div_pd(a.v, b.v)}; }
+    static AVX512Lanes neg(AVX512Lanes a)
+    {
+        return {_mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(a.v),
+                                                     _mm512_castpd_si512(_mm512_set1_pd(-0.0))))};
+    }
+    // The unmasked form trips -Wmaybe-uninitialized in GCC 12's own header
+    static AVX512Lanes sqrt(AVX512Lanes a) { return {_mm512_maskz_sqrt_pd(0xFF, a.v)}; }
+
+    static Mask lt(AVX512Lanes a, AVX512Lanes b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_LT_OQ); }
+    static Mask gt(AVX512Lanes a, AVX512Lanes b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_GT_OQ); }
+    static Mask mask_and(Mask a, Mask b) { return a & b; }
+    static Mask mask_or(Mask a, Mask b) { return a | b; }
+    static Mask mask_andnot(Mask a, Mask b) { return static_cast<Mask>(~a & b); }
+    static bool any(Mask m) { return m != 0; }
+    static AVX512Lanes select(Mask m, AVX512Lanes a, AVX512Lanes b) { return {_mm512_mask_blend_pd(m, b.v, a.v)}; }
+};
+#endif
+
+#else
+
+#if defined(__SSE4_1__)
+struct SSE41Lanes
+{
+    static constexpr int width = 4;
+    using Mask = __m128;
+    __m128 v;
+
+    static SSE41Lanes load(const float *p) { return {_mm_loadu_ps(p)}; }
+    static SSE41Lanes set1(float x) { return {_mm_set1_ps(x)}; }
+    static SSE41Lanes iota(float base) { return {_mm_add_ps(_mm_set1_ps(base), _mm_setr_ps(0, 1, 2, 3))}; }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+
+    friend SSE41Lanes operator+(SSE41Lanes a, SSE41Lanes b) { return {_mm_add_ps(a.v, b.v)}; }
+    friend SSE41Lanes operator-(SSE41Lanes a, SSE41Lanes b) { return {_mm_sub_ps(a.v, b.v)}; }
+    friend SSE41Lanes operator*(SSE41Lanes a, SSE41Lanes b) { return {_mm_mul_ps(a.v, b.v)}; }
+    friend SSE41Lanes operator/(SSE41Lanes a, SSE41Lanes b) { return {_mm_div_ps(a.v, b.v)}; }
+    static SSE41Lanes neg(SSE41Lanes a) { return {_mm_xor_ps(a.v, _mm_set1_ps(-0.0f))}; }
+    static SSE41Lanes sqrt(SSE41Lanes a) { return {_mm_sqrt_ps(a.v)}; }
+
+    static Mask lt(SSE41Lanes a, SSE41Lanes b) { return _mm_cmplt_ps(a.v, b.v); }
+    static Mask gt(SSE41Lanes a, SSE41Lanes b) { return _mm_cmpgt_ps(a.v, b.v); }
+    static Mask mask_and(Mask a, Mask b) { return _mm_and_ps(a, b); }
+    static Mask mask_or(Mask a, Mask b) { return _mm_or_ps(a, b); }
+    static Mask mask_andnot(Mask a, Mask b) { return _mm_andnot_ps(a, b); }
+    static bool any(Mask m) { return _mm_movemask_ps(m) != 0; }
+    static SSE41Lanes select(Mask m, SSE41Lanes a, SSE41Lanes b) { return {_mm_blendv_ps(b.v, a.v, m)}; }
+};
+#endif
+
+#if defined(__AVX2__)
+struct AVX2Lanes
+{
+    static constexpr int width = 8;
+    using Mask = __m256;
+    __m256 v;
+
+    static AVX2Lanes load(const float *p) { return {_mm256_loadu_ps(p)}; }
+    static AVX2Lanes set1(float x) { return {_mm256_set1_ps(x)}; }
+    static AVX2Lanes iota(float base)
+    {
+        return {_mm256_add_ps(_mm256_set1_ps(base), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7))};
+    }
+    void store(float *p) const { _mm256_storeu_ps(p, v); }
+
+    friend AVX2Lanes operator+(AVX2Lanes a, AVX2Lanes b) { return {_mm256_add_ps(a.v, b.v)}; }
+    friend AVX2Lanes operator-(AVX2Lanes a, AVX2Lanes b) { return {_mm256_sub_ps(a.v, b.v)}; }
+    friend AVX2Lanes operator*(AVX2Lanes a, AVX2Lanes b) { return {_mm256_mul_ps(a.v, b.v)}; }
+    friend AVX2Lanes operator/(AVX2Lanes a, AVX2Lanes b) { return {_mm256_div_ps(a.v, b.v)}; }
+    static AVX2Lanes neg(AVX2Lanes a) { return {_mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f))}; }
+    static AVX2Lanes sqrt(AVX2Lanes a) { return {_mm256_sqrt_ps(a.v)}; }
+
+    static Mask lt(AVX2Lanes a, AVX2Lanes b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    static Mask gt(AVX2Lanes a, AVX2Lanes b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+    static Mask mask_and(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+    static Mask mask_or(Mask a, Mask b) { return _mm256_or_ps(a, b); }
+    static Mask mask_andnot(Mask a, Mask b) { return _mm256_andnot_ps(a, b); }
+    static bool any(Mask m) { return _mm256_movemask_ps(m) != 0; }
+    static AVX2Lanes select(Mask m, AVX2Lanes a, AVX2Lanes b) { return {_mm256_blendv_ps(b.v, a.v, m)}; }
+};
+#endif
+
+#if defined(__AVX512F__)
+struct AVX512Lanes
+{
+    static constexpr int width = 16;
+    using Mask = __mmask16;
+    __m512 v;
+
+    static AVX512Lanes load(const float *p) { return {_mm512_loadu_ps(p)}; }
+    static AVX512Lanes set1(float x) { return {_mm512_set1_ps(x)}; }
+    static AVX512Lanes iota(float base)
+    {
+        return {_mm512_add_ps(_mm512_set1_ps(base),
+                              _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15))};
+    }
+    void store(float *p) const { _mm512_storeu_ps(p, v); }
+
+    friend AVX512Lanes operator+(AVX512Lanes a, AVX512Lanes b) { return {_mm512_add_ps(a.v, b.v)}; }
+    friend AVX512Lanes operator-(AVX512Lanes a, AVX512Lanes b) { return {_mm512_sub_ps(a.v, b.v)}; }
+    friend AVX512Lanes operator*(AVX512Lanes a, AVX512Lanes b) { return {_mm512_mul_ps(a.v, b.v)}; }
+    friend AVX512Lanes operator/(AVX512Lanes a, AVX512Lanes b) { return {_mm512_div_ps(a.v, b.v)}; }
+    static AVX512Lanes neg(AVX512Lanes a)
+    {
+        return {_mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a.v),
+                                                     _mm512_castps_si512(_mm512_set1_ps(-0.0f))))};
+    }
+    // The unmasked form trips -Wmaybe-uninitialized in GCC 12's own header
+    static AVX512Lanes sqrt(AVX512Lanes a) { return {_mm512_maskz_sqrt_ps(0xFFFF, a.v)}; }
+
+    static Mask lt(AVX512Lanes a, AVX512Lanes b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+    static Mask gt(AVX512Lanes a, AVX512Lanes b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ); }
+    static Mask mask_and(Mask a, Mask b) { return a & b; }
+    static Mask mask_or(Mask a, Mask b) { return a | b; }
+    static Mask mask_andnot(Mask a, Mask b) { return static_cast<Mask>(~a & b); }
+    static bool any(Mask m) { return m != 0; }
+    static AVX512Lanes select(Mask m, AVX512Lanes a, AVX512Lanes b) { return {_mm512_mask_blend_ps(m, b.v, a.v)}; }
+};
+#endif
+
+#endif
+
+// Float lanes in both precisions, for framebuffer color: quantizing it to
+// bytes and denoising it. load is aligned, loadu and storeu are not. min and
+// max return b when a lane of a is NaN, like minps/maxps.
+struct ScalarPixels
+{
+    static constexpr int width = 1;
+    float v;
+
+    static ScalarPixels load(const float *p) { return {*p}; }
+    static ScalarPixels loadu(const float *p) { return {*p}; }
+    static ScalarPixels set1(float x) { return {x}; }
+    void storeu(float *p) const { *p = v; }
+
+    friend ScalarPixels operator+(ScalarPixels a, ScalarPixels b) { return {a.v + b.v}; }
+    friend ScalarPixels operator-(ScalarPixels a, ScalarPixels b) { return {a.v - b.v}; }
+    friend ScalarPixels operator*(ScalarPixels a, ScalarPixels b) { return {a.v * b.v}; }
+    friend ScalarPixels operator/(ScalarPixels a, ScalarPixels b) { return {a.v / b.v}; }
+    static ScalarPixels min(ScalarPixels a, ScalarPixels b) { return {a.v < b.v ? a.v : b.v}; }
+    static ScalarPixels max(ScalarPixels a, ScalarPixels b) { return {a.v > b.v ? a.v : b.v}; }
+    static ScalarPixels sqrt(ScalarPixels a) { return {std::sqrt(a.v)}; }
+
+    // Truncates lanes already in [0, 256) and stores them as bytes
+    void store_bytes(unsigned char *p) const { *p = static_cast<unsigned char>(static_cast<int>(v)); }
+};
+
+#if defined(__SSE4_1__)
+struct SSE41Pixels
+{
+    static constexpr int width = 4;
+    __m128 v;
+
+    static SSE41Pixels load(const float *p) { return {_mm_load_ps(p)}; }
+    static SSE41Pixels loadu(const float *p) { return {_mm_loadu_ps(p)}; }
+    static SSE41Pixels set1(float x) { return {_mm_set1_ps(x)}; }
+    void storeu(float *p) const { _mm_storeu_ps(p, v); }
+
+    friend SSE41Pixels operator+(SSE41Pixels a, SSE41Pixels b) { return {_mm_add_ps(a.v, b.v)}; }
+    friend SSE41Pixels operator-(SSE41Pixels a, SSE41Pixels b) { return {_mm_sub_ps(a.v, b.v)}; }
+    friend SSE41Pixels operator*(SSE41Pixels a, SSE41Pixels b) { return {_mm_mul_ps(a.v, b.v)}; }
+    friend SSE41Pixels operator/(SSE41Pixels a, SSE41Pixels b) { return {_mm_div_ps(a.v, b.v)}; }
+    static SSE41Pixels min(SSE41Pixels a, SSE41Pixels b) { return {_mm_min_ps(a.v, b.v)}; }
+    static SSE41Pixels max(SSE41Pixels a, SSE41Pixels b) { return {_mm_max_ps(a.v, b.v)}; }
+    static SSE41Pixels sqrt(SSE41Pixels a) { return {_mm_sqrt_ps(a.v)}; }
+
+    void store_bytes(unsigned char *p) const
+    {
+        const __m128i words = _mm_packus_epi32(_mm_cvttps_epi32(v), _mm_setzero_si128());
+        const int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+        std::memcpy(p, &bytes, sizeof(bytes));
+    }
+};
+#endif
+
+#if defined(__AVX2__)
+struct AVX2Pixels
+{
+    static constexpr int width = 8;
+    __m256 v;
+
+    static AVX2Pixels load(const float *p) { return {_mm256_load_ps(p)}; }
+    static AVX2Pixels loadu(const float *p) { return {_mm256_loadu_ps(p)}; }
+    static AVX2Pixels set1(float x) { return {_mm256_set1_ps(x)}; }
+    void storeu(float *p) const { _mm256_storeu_ps(p, v); }
+
+    friend AVX2Pixels operator+(AVX2Pixels a, AVX2Pixels b) { return {_mm256_add_ps(a.v, b.v)}; }
+    friend AVX2Pixels operator-(AVX2Pixels a, AVX2Pixels b) { return {_mm256_sub_ps(a.v, b.v)}; }
+    friend AVX2Pixels operator*(AVX2Pixels a, AVX2Pixels b) { return {_mm256_mul_ps(a.v, b.v)}; }
+    friend AVX2Pixels operator/(AVX2Pixels a, AVX2Pixels b) { return {_mm256_div_ps(a.v, b.v)}; }
+    static AVX2Pixels min(AVX2Pixels a, AVX2Pixels b) { return {_mm256_min_ps(a.v, b.v)}; }
+    static AVX2Pixels max(AVX2Pixels a, AVX2Pixels b) { return {_mm256_max_ps(a.v, b.v)}; }
+    static AVX2Pixels sqrt(AVX2Pixels a) { return {_mm256_sqrt_ps(a.v)}; }
+
+    void store_bytes(unsigned char *p) const
+    {
+        const __m256i ints = _mm256_cvttps_epi32(v);
+        const __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(ints), _mm256_extracti128_si256(ints, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(p), _mm_packus_epi16(words, words));
+    }
+};
+#endif
+
+#if defined(__AVX512F__)
+struct AVX512Pixels
+{
+    static constexpr int width = 16;
+    __m512 v;
+
+    static AVX512Pixels load(const float *p) { return {_mm512_load_ps(p)}; }
+    static AVX512Pixels loadu(const float *p) { return {_mm512_loadu_ps(p)}; }
+    static AVX512Pixels set1(float x) { return {_mm512_set1_ps(x)}; }
+    void storeu(float *p) const { _mm512_storeu_ps(p, v); }
+
+    friend AVX512Pixels operator+(AVX512Pixels a, AVX512Pixels b) { return {_mm512_add_ps(a.v, b.v)}; }
+    friend AVX512Pixels operator-(AVX512Pixels a, AVX512Pixels b) { return {_mm512_sub_ps(a.v, b.v)}; }
+    friend AVX512Pixels operator*(AVX512Pixels a, AVX512Pixels b) { return {_mm512_mul_ps(a.v, b.v)}; }
+    friend AVX512Pixels operator/(AVX512Pixels a, AVX512Pixels b) { return {_mm512_div_ps(a.v, b.v)}; }
+    // Masked forms for the same GCC 12 warning as AVX512Lanes::sqrt
+    static AVX512Pixels min(AVX512Pixels a, AVX512Pixels b) { return {_mm512_maskz_min_ps(0xFFFF, a.v, b.v)}; }
+    static AVX512Pixels max(AVX512Pixels a, AVX512Pixels b) { return {_mm512_maskz_max_ps(0xFFFF, a.v, b.v)}; }
+    static AVX512Pixels sqrt(AVX512Pixels a) { return {_mm512_maskz_sqrt_ps(0xFFFF, a.v)}; }
+
+    void store_bytes(unsigned char *p) const
+    {
+        _mm512_mask_cvtusepi32_storeu_epi8(p, 0xFFFF, _mm512_maskz_cvttps_epi32(0xFFFF, v));
+    }
+};
+#endif
+
+} // namespace SIMD_TARGET_NAMESPACE
+
+#endif
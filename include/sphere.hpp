@@ -1,52 +1,72 @@
 #ifndef SPHERE_HPP
 #define SPHERE_HPP
 
+#include <cstdint>
 #include "vec3.hpp"
 #include "ray.hpp"
 
+// Attributes of the nearest hit, computed only once it is known (see
+// Scene::surface). The material indexes the scene's material table.
 struct HitRecord {
-    double t;
+    Real t;
     Vec3 point;
     Vec3 normal;
-    Vec3 color;
+    uint32_t material;
 };
 
 class Sphere {
 public:
     Vec3 center;
-    double radius;
-    Vec3 color;
+    Real radius;
+    uint32_t material;
 
-    Sphere(const Vec3& center, double radius, const Vec3& color)
-        : center(center), radius(radius), color(color) {}
+    Sphere(const Vec3& center, Real radius, uint32_t material)
+        : center(center), radius(radius), material(material) {}
 
-    bool hit(const Ray& ray, double t_min, double t_max, HitRecord& rec) const {
-        Vec3 oc = ray.origin - center;
-        double a = ray.direction.dot(ray.direction);
-        double b = 2.0 * oc.dot(ray.direction);
-        double c = oc.dot(oc) - radius * radius;
-        double discriminant = b*b - 4*a*c;
+    // Solves the quadratic in the form of Haines et al., "Precision
+    // Improvements for Ray/Sphere Intersection" (Ray Tracing Gems ch. 7): the
+    // discriminant comes from the distance between the center and the ray's
+    // closest approach rather than b^2 - 4ac, and the roots avoid subtracting
+    // nearly equal values, so float stays accurate for small or far spheres.
+    // Finds the nearer root in (t_min, t_max), without the hit attributes.
+    bool intersect(const Ray& ray, Real t_min, Real t_max, Real& t) const {
+        const Vec3& d = ray.direction;
+        Vec3 f = ray.origin - center;
+        Real a = d.dot(d);
+        Real b = f.dot(d); // half of the usual b
+        Vec3 l = f - d * (b / a);
+        Real r2 = radius * radius;
+        Real discriminant = a * (r2 - l.dot(l));
 
         if (discriminant > 0) {
-            double temp = (-b - sqrt(discriminant)) / (2.0*a);
+            Real c = f.dot(f) - r2;
+            Real root = std::sqrt(discriminant);
+            Real q = -(b + (b < 0 ? -root : root));
+            Real t0 = c / q;
+            Real t1 = q / a;
+            Real temp = t0 < t1 ? t0 : t1;
             if (temp < t_max && temp > t_min) {
-                rec.t = temp;
-                rec.point = ray.point_at(rec.t);
-                rec.normal = (rec.point - center) / radius;
-                rec.color = color;
+                t = temp;
                 return true;
             }
-            temp = (-b + sqrt(discriminant)) / (2.0*a);
+            temp = t0 < t1 ? t1 : t0;
             if (temp < t_max && temp > t_min) {
-                rec.t = temp;
-                rec.point = ray.point_at(rec.t);
-                rec.normal = (rec.point - center) / radius;
-                rec.color = color;
+                t = temp;
                 return true;
             }
         }
         return false;
     }
+
+    // Hit attributes at a known distance, computed once for the winning sphere.
+    // The point is projected back onto the surface, so rays spawned from it
+    // (see offset_ray_origin) start from where the sphere actually is.
+    void fill_hit(const Ray& ray, Real t, HitRecord& rec) const {
+        rec.t = t;
+        rec.normal = (ray.point_at(t) - center).normalize();
+        rec.point = center + rec.normal * radius;
+        rec.material = material;
+    }
 };
 
-#endif 
\ No newline at end of file
+#endif
@@ -0,0 +1,220 @@
+#ifndef SPHERE_BINS_HPP
+#define SPHERE_BINS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "camera.hpp"
+#include "config.hpp"
+#include "frustum.hpp"
+#include "instrumentation.hpp"
+#include "ray_packet.hpp"
+#include "scene.hpp"
+#include "simd.hpp"
+
+// Screen-space binning of the spheres for primary rays. Every sphere's
+// projection is bounded on the image and the sphere is listed in each
+// tile-sized cell the bound touches, nearest first. A packet then tests
+// only its cell's list, front to back, and stops at the first sphere that
+// starts beyond every ray's current hit; cells no sphere reaches skip
+// sphere intersection altogether.
+class SphereBins
+{
+public:
+    // Bins the spheres of scene.soa() for a width x height image of camera
+    // in tile_size x tile_size cells. Bounds cover jittered samples too, so
+    // the lists are kept while scene, view, size and cell size are unchanged.
+    void build(const Scene &scene, const CameraSnapshot &camera, int width, int height, int tile_size);
+
+    // Whether no sphere reaches the cell holding pixel (x, y)
+    bool empty(int x, int y) const
+    {
+        const size_t cell = cell_index(x, y);
+        return first_[cell] == first_[cell + 1];
+    }
+
+    // Like Scene::hit_packet, limited to the spheres of the cell holding
+    // pixel (x, y); every ray of the packet must lie in that cell
+    void hit_packet(const Scene &scene, int x, int y, RayPacket &packet, const PacketFrustum &frustum) const;
+
+private:
+    struct Entry
+    {
+        Real near; // no point of the sphere is closer to the camera
+        uint32_t slot;
+    };
+
+    // A sphere and the cells [x0, x1] x [y0, y1] it may cover
+    struct Candidate
+    {
+        Entry entry;
+        int x0, y0, x1, y1;
+    };
+
+    std::vector<Candidate> candidates_;
+    std::vector<uint32_t> first_; // per cell, where its list starts in entries_; one more at the end
+    std::vector<Entry> entries_;  // the cells' lists back to back
+    int columns_ = 0;
+    int rows_ = 0;
+    int tile_size_ = 0;
+
+    // What the lists were built for
+    const Scene *scene_ = nullptr;
+    uint64_t scene_revision_ = 0;
+    CameraSnapshot camera_;
+    int width_ = 0;
+    int height_ = 0;
+
+    size_t cell_index(int x, int y) const
+    {
+        return static_cast<size_t>(y / tile_size_) * columns_ + static_cast<size_t>(x / tile_size_);
+    }
+
+    // Pixel coordinates a * v / (b * v) can reach over the sphere of radius r
+    // at offset c from the camera, which must lie in front of it
+    static void coordinate_range(const Vec3T<double> &a, const Vec3T<double> &b, const Vec3T<double> &c, double r,
+                                 double &low, double &high);
+};
+
+inline void SphereBins::coordinate_range(const Vec3T<double> &a, const Vec3T<double> &b, const Vec3T<double> &c,
+                                         double r, double &low, double &high)
+{
+    // The extremes k lie on planes (a - k b) * v = 0 tangent to the sphere:
+    // ((a - k b) * c)^2 = r^2 |a - k b|^2, a quadratic in k
+    const double ac = a.dot(c);
+    const double bc = b.dot(c);
+    const double r2 = r * r;
+    const double qa = bc * bc - r2 * b.dot(b);
+    const double qb = ac * bc - r2 * a.dot(b);
+    const double qc = ac * ac - r2 * a.dot(a);
+    const double root = std::sqrt(std::max(0.0, qb * qb - qa * qc));
+    low = (qb - root) / qa;
+    high = (qb + root) / qa;
+}
+
+inline void SphereBins::build(const Scene &scene, const CameraSnapshot &camera, int width, int height, int tile_size)
+{
+    auto same = [](const Vec3T<double> &a, const Vec3T<double> &b)
+    {
+        return a.x == b.x && a.y == b.y && a.z == b.z;
+    };
+    if (&scene == scene_ && scene.revision() == scene_revision_ && width == width_ && height == height_ &&
+        tile_size == tile_size_ && camera.position.x == camera_.position.x && camera.position.y == camera_.position.y &&
+        camera.position.z == camera_.position.z && same(camera.corner, camera_.corner) &&
+        same(camera.step_x, camera_.step_x) && same(camera.step_y, camera_.step_y))
+        return;
+
+    scene_ = &scene;
+    scene_revision_ = scene.revision();
+    camera_ = camera;
+    width_ = width;
+    height_ = height;
+    tile_size_ = tile_size;
+    columns_ = (width + tile_size - 1) / tile_size;
+    rows_ = (height + tile_size - 1) / tile_size;
+
+    Vec3T<double> r0, r1, r2;
+    camera.projection_rows(r0, r1, r2);
+    const double r0_length = r0.length();
+    const Vec3T<double> eye(camera.position);
+
+    // Jitter moves samples up to half a pixel; one more covers rounding
+    const double margin = 1.5;
+    const SphereSpan span = scene.soa().span();
+    candidates_.clear();
+    candidates_.reserve(scene.soa().size());
+    for (size_t slot = 0; slot < scene.soa().size(); ++slot)
+    {
+        const Vec3T<double> c = Vec3T<double>(span.cx[slot], span.cy[slot], span.cz[slot]) - eye;
+        const double r = span.radius[slot];
+        if (!(r >= 0.0))
+            continue; // slot of a removed sphere
+        const double depth = c.dot(r0);
+        if (depth < -r * r0_length)
+            continue; // wholly behind the camera
+
+        Candidate candidate{Entry{0, static_cast<uint32_t>(slot)}, 0, 0, columns_ - 1, rows_ - 1};
+        const double distance = c.length();
+        // Slightly low, so rounding in the hit never lands in front of it
+        candidate.entry.near = static_cast<Real>(std::max(0.0, distance - r) * (1.0 - 1e-5));
+
+        // Straddling the plane of the camera, the projection is unbounded
+        if (depth > r * r0_length)
+        {
+            double x_low, x_high, y_low, y_high;
+            coordinate_range(r1, r0, c, r, x_low, x_high);
+            coordinate_range(r2, r0, c, r, y_low, y_high);
+            x_low -= margin;
+            y_low -= margin;
+            x_high += margin;
+            y_high += margin;
+            if (!(x_high >= 0.0 && y_high >= 0.0 && x_low < width && y_low < height))
+                continue;
+
+            candidate.x0 = std::max(0, static_cast<int>(std::max(0.0, x_low) / tile_size));
+            candidate.y0 = std::max(0, static_cast<int>(std::max(0.0, y_low) / tile_size));
+            candidate.x1 = std::min(columns_ - 1, static_cast<int>(std::min<double>(width, x_high) / tile_size));
+            candidate.y1 = std::min(rows_ - 1, static_cast<int>(std::min<double>(height, y_high) / tile_size));
+        }
+        candidates_.push_back(candidate);
+    }
+
+    std::sort(candidates_.begin(), candidates_.end(), [](const Candidate &a, const Candidate &b)
+              { return a.entry.near < b.entry.near || (a.entry.near == b.entry.near && a.entry.slot < b.entry.slot); });
+
+    // Counting sort into the cells; sorted input keeps every list nearest first
+    const size_t cells = static_cast<size_t>(columns_) * rows_;
+    first_.assign(cells + 1, 0);
+    for (const Candidate &candidate : candidates_)
+    {
+        for (int y = candidate.y0; y <= candidate.y1; ++y)
+            for (int x = candidate.x0; x <= candidate.x1; ++x)
+                first_[static_cast<size_t>(y) * columns_ + x + 1]++;
+    }
+    for (size_t cell = 0; cell < cells; ++cell)
+        first_[cell + 1] += first_[cell];
+
+    // Headroom, since the lists grow and shrink as the camera moves
+    if (entries_.capacity() < first_[cells])
+        entries_.reserve(first_[cells] + first_[cells] / 2);
+    entries_.resize(first_[cells]);
+    for (const Candidate &candidate : candidates_)
+    {
+        for (int y = candidate.y0; y <= candidate.y1; ++y)
+            for (int x = candidate.x0; x <= candidate.x1; ++x)
+                entries_[first_[static_cast<size_t>(y) * columns_ + x]++] = candidate.entry;
+    }
+    // Filling moved every start to the next cell's; shift them back
+    for (size_t cell = cells; cell > 0; --cell)
+        first_[cell] = first_[cell - 1];
+    first_[0] = 0;
+}
+
+inline void SphereBins::hit_packet(const Scene &scene, int x, int y, RayPacket &packet, const PacketFrustum &frustum) const
+{
+    const size_t cell = cell_index(x, y);
+    const SphereSpan span = scene.soa().span();
+    const PacketSphereFn packet_sphere = simd_kernels().packet_sphere;
+
+    // Farthest current hit of the packet, refreshed every few tests
+    Real farthest = static_cast<Real>(Config::RAY_T_MAX);
+    int tested = 0;
+    for (uint32_t i = first_[cell]; i < first_[cell + 1]; ++i)
+    {
+        const Entry &entry = entries_[i];
+        if (entry.near > farthest)
+            break;
+
+        const Vec3 center(span.cx[entry.slot], span.cy[entry.slot], span.cz[entry.slot]);
+        if (frustum.cull_sphere(center, span.radius[entry.slot]))
+            continue;
+        packet_sphere(span, entry.slot, packet);
+        Instrumentation::count_sphere_tests(packet.count);
+
+        if (++tested % 4 == 0)
+            farthest = *std::max_element(packet.t, packet.t + packet.count);
+    }
+}
+
+#endif
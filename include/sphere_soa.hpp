@@ -0,0 +1,136 @@
+#ifndef SPHERE_SOA_HPP
+#define SPHERE_SOA_HPP
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "aligned_allocator.hpp"
+#include "array_store.hpp"
+#include "sphere.hpp"
+
+// Raw view of the SoA arrays handed to the SIMD kernels
+struct SphereSpan
+{
+    const Real *cx;
+    const Real *cy;
+    const Real *cz;
+    const Real *radius;
+};
+
+// Sphere centers and radii in structure-of-arrays form. Arrays are padded
+// with never-hit spheres (NaN radius) to a multiple of PADDING that leaves a
+// full block after the last real sphere, so a kernel may load a whole SIMD
+// block starting at any slot, as BVH leaves start at any slot. Kernels track
+// slots in Real lanes, exact up to 2^24 spheres in the float build.
+class SphereSoA
+{
+public:
+    static constexpr size_t PADDING = 64 / sizeof(Real); // widest kernel: one AVX-512 register
+
+    // order, when given, lists which sphere goes in each slot (BVH leaf order)
+    void build(const Sphere *spheres, size_t count, const uint32_t *order = nullptr);
+    void clear();
+
+    // Reads arrays of padded_size() elements aligned to 64 bytes, and count
+    // ids, that stay alive elsewhere (a mapped scene file) instead of copying
+    void borrow(const SphereSpan &span, const uint32_t *ids, size_t count);
+
+    // Editing owned arrays in place, for spheres that move between frames
+    void set(size_t slot, const Sphere &sphere, uint32_t id);
+    void set_id(size_t slot, uint32_t id) { ids_.vector()[slot] = id; }
+    // The slot is never hit again but keeps its place
+    void kill(size_t slot) { radius_.vector()[slot] = std::numeric_limits<Real>::quiet_NaN(); }
+    // Adds a slot at size() and returns it
+    size_t append(const Sphere &sphere, uint32_t id);
+
+    size_t size() const { return ids_.size(); }
+    size_t padded_size() const { return cx_.size(); }
+    bool empty() const { return ids_.empty(); }
+    bool borrowed() const { return ids_.borrowed(); }
+    uint32_t id(size_t slot) const { return ids_[slot]; }
+    const uint32_t *ids() const { return ids_.data(); }
+    SphereSpan span() const { return SphereSpan{cx_.data(), cy_.data(), cz_.data(), radius_.data()}; }
+
+    // At least count + PADDING - 1 slots
+    static size_t padded_size(size_t count) { return count == 0 ? 0 : (count + 2 * PADDING - 2) / PADDING * PADDING; }
+
+private:
+    ArrayStore<Real, AlignedAllocator<Real>> cx_;
+    ArrayStore<Real, AlignedAllocator<Real>> cy_;
+    ArrayStore<Real, AlignedAllocator<Real>> cz_;
+    ArrayStore<Real, AlignedAllocator<Real>> radius_;
+    ArrayStore<uint32_t> ids_; // sphere index stored in each slot
+};
+
+inline void SphereSoA::build(const Sphere *spheres, size_t count, const uint32_t *order)
+{
+    const size_t padded = padded_size(count);
+
+    AlignedVector<Real> &cx = cx_.vector();
+    AlignedVector<Real> &cy = cy_.vector();
+    AlignedVector<Real> &cz = cz_.vector();
+    AlignedVector<Real> &radius = radius_.vector();
+    std::vector<uint32_t> &ids = ids_.vector();
+    cx.assign(padded, Real(0));
+    cy.assign(padded, Real(0));
+    cz.assign(padded, Real(0));
+    radius.assign(padded, std::numeric_limits<Real>::quiet_NaN());
+    ids.resize(count);
+
+    for (size_t slot = 0; slot < count; ++slot)
+    {
+        uint32_t id = order ? order[slot] : static_cast<uint32_t>(slot);
+        const Sphere &s = spheres[id];
+        cx[slot] = s.center.x;
+        cy[slot] = s.center.y;
+        cz[slot] = s.center.z;
+        radius[slot] = s.radius;
+        ids[slot] = id;
+    }
+}
+
+inline void SphereSoA::set(size_t slot, const Sphere &sphere, uint32_t id)
+{
+    cx_.vector()[slot] = sphere.center.x;
+    cy_.vector()[slot] = sphere.center.y;
+    cz_.vector()[slot] = sphere.center.z;
+    radius_.vector()[slot] = sphere.radius;
+    ids_.vector()[slot] = id;
+}
+
+inline size_t SphereSoA::append(const Sphere &sphere, uint32_t id)
+{
+    const size_t slot = ids_.size();
+    ids_.vector().push_back(id);
+    const size_t padded = padded_size(slot + 1);
+    if (padded > cx_.size())
+    {
+        cx_.vector().resize(padded, Real(0));
+        cy_.vector().resize(padded, Real(0));
+        cz_.vector().resize(padded, Real(0));
+        radius_.vector().resize(padded, std::numeric_limits<Real>::quiet_NaN());
+    }
+    set(slot, sphere, id);
+    return slot;
+}
+
+inline void SphereSoA::clear()
+{
+    cx_.clear();
+    cy_.clear();
+    cz_.clear();
+    radius_.clear();
+    ids_.clear();
+}
+
+inline void SphereSoA::borrow(const SphereSpan &span, const uint32_t *ids, size_t count)
+{
+    const size_t padded = padded_size(count);
+    cx_.borrow(span.cx, padded);
+    cy_.borrow(span.cy, padded);
+    cz_.borrow(span.cz, padded);
+    radius_.borrow(span.radius, padded);
+    ids_.borrow(ids, count);
+}
+
+#endif
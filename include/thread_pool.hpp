@@ -1,6 +1,7 @@
 #ifndef THREAD_POOL_HPP
 #define THREAD_POOL_HPP
 
+#include <algorithm>
 #include <vector>
 #include <queue>
 #include <memory>
@@ -10,7 +11,18 @@
 #include <future>
 #include <functional>
 #include <stdexcept>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include "instrumentation.hpp"
+#include "work_stealing_deque.hpp"
 
+// Worker threads with two ways in:
+//  - parallel_for: fork/join over an index range. Ranges are split lazily and
+//    the halves pushed onto per-worker Chase-Lev deques, where idle workers
+//    steal them. The calling thread works too and waits on a counter, so
+//    nothing is allocated or locked per chunk.
+//  - enqueue: one-off tasks through a locked queue, returning a future.
 class ThreadPool
 {
 public:
@@ -23,38 +35,321 @@ public:
 
     void wait_for_all();
 
+    // Calls fn(chunk_begin, chunk_end) over [begin, end) in chunks of at
+    // most grain indices and returns when every chunk has run. Safe to
+    // nest: a worker calling it keeps helping until its own range is done.
+    template <class Fn>
+    void parallel_for(size_t begin, size_t end, size_t grain, Fn &&fn);
+
+    // Grows the calling thread's chunk slots for parallel_for calls of up to
+    // chunk_count chunks, so later calls that size don't allocate
+    void reserve_chunks(size_t chunk_count) const { item_buffer(chunk_count); }
+
+    size_t size() const { return workers.size(); }
+
+    // 0..size()-1 on a worker, size() on any other thread. Lets callers keep
+    // per-thread data in an array of size() + 1.
+    size_t current_thread_index() const;
+
 private:
+    struct ForJob;
+
+    // A range of chunk indices of one parallel_for call
+    struct WorkItem
+    {
+        ForJob *job;
+        size_t begin;
+        size_t end;
+    };
+
+    struct ForJob
+    {
+        void (*invoke)(void *context, size_t begin, size_t end);
+        void *context;
+        size_t range_begin;
+        size_t range_end;
+        size_t grain;
+        WorkItem *items; // one slot per chunk, indexed by the first chunk of the item
+        std::atomic<size_t> remaining;
+    };
+
     std::vector<std::thread> workers;
     std::queue<std::function<void()>> tasks;
     std::mutex queue_mutex;
     std::condition_variable condition;
     std::condition_variable finished;
     std::atomic<size_t> busy_threads{0};
+    std::atomic<size_t> queued_tasks{0}; // lets idle workers skip the lock
     bool stop;
+
+    // One deque per worker plus one shared by outside threads, which take
+    // external_mutex while they own it
+    std::vector<std::unique_ptr<WorkStealingDeque<WorkItem>>> deques;
+    std::mutex external_mutex;
+    std::atomic<int> sleeping{0};
+    std::atomic<uint64_t> wake_epoch{0};
+
+    void worker_loop(size_t index);
+    WorkItem *find_work(size_t self, uint32_t &seed);
+    bool has_work() const;
+    void run_item(WorkItem *item, size_t self);
+    void wake_one();
+    void help_until_done(ForJob &job, size_t self);
+
+    static std::vector<WorkItem> &item_buffer(size_t chunk_count);
+
+    template <class Fn>
+    static void invoke_chunk(void *context, size_t begin, size_t end)
+    {
+        (*static_cast<Fn *>(context))(begin, end);
+    }
+
+    static thread_local const ThreadPool *current_pool;
+    static thread_local const ThreadPool *external_owner;
+    static thread_local size_t current_index;
+    static thread_local size_t nesting_depth;
 };
 
+inline thread_local const ThreadPool *ThreadPool::current_pool = nullptr;
+inline thread_local const ThreadPool *ThreadPool::external_owner = nullptr;
+inline thread_local size_t ThreadPool::current_index = 0;
+inline thread_local size_t ThreadPool::nesting_depth = 0;
+
 inline ThreadPool::ThreadPool(size_t threads) : stop(false)
 {
+    for (size_t i = 0; i <= threads; ++i)
+    {
+        deques.push_back(std::make_unique<WorkStealingDeque<WorkItem>>());
+    }
+
     for (size_t i = 0; i < threads; ++i)
     {
-        workers.emplace_back([this]
-                             {
-            for(;;) {
-                std::function<void()> task;
-                {
-                    std::unique_lock<std::mutex> lock(this->queue_mutex);
-                    this->condition.wait(lock, [this]{ return this->stop || !this->tasks.empty(); });
-                    if(this->stop && this->tasks.empty())
-                        return;
-                    task = std::move(this->tasks.front());
-                    this->tasks.pop();
-                    ++busy_threads;
-                }
-                task();
-                --busy_threads;
-                finished.notify_one();
-            } });
+        workers.emplace_back([this, i]
+                             { worker_loop(i); });
+    }
+}
+
+inline size_t ThreadPool::current_thread_index() const
+{
+    return current_pool == this ? current_index : workers.size();
+}
+
+inline void ThreadPool::worker_loop(size_t index)
+{
+    current_pool = this;
+    current_index = index;
+    Instrumentation::name_thread("pool worker");
+    uint32_t seed = static_cast<uint32_t>(index) * 2654435761u + 1;
+    const int spin_limit = 64;
+    int idle_spins = 0;
+
+    for (;;)
+    {
+        if (WorkItem *item = find_work(index, seed))
+        {
+            run_item(item, index);
+            idle_spins = 0;
+            continue;
+        }
+
+        std::function<void()> task;
+        if (queued_tasks.load(std::memory_order_relaxed) > 0)
+        {
+            std::unique_lock<std::mutex> lock(this->queue_mutex);
+            if (!this->tasks.empty())
+            {
+                task = std::move(this->tasks.front());
+                this->tasks.pop();
+                --queued_tasks;
+                ++busy_threads;
+            }
+        }
+        if (task)
+        {
+            task();
+            --busy_threads;
+            finished.notify_all();
+            idle_spins = 0;
+            continue;
+        }
+
+        // Spin briefly so back-to-back parallel_for calls don't pay for a wakeup
+        if (++idle_spins < spin_limit)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Announce we are going to sleep, then look once more; a pusher that
+        // missed us in sleeping has its work visible to this check
+        uint64_t epoch = wake_epoch.load(std::memory_order_seq_cst);
+        sleeping.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!has_work())
+        {
+            std::unique_lock<std::mutex> lock(this->queue_mutex);
+            this->condition.wait(lock, [this, epoch]
+                                 { return this->stop || !this->tasks.empty() ||
+                                          wake_epoch.load(std::memory_order_seq_cst) != epoch; });
+            if (this->stop && this->tasks.empty())
+            {
+                sleeping.fetch_sub(1, std::memory_order_seq_cst);
+                return;
+            }
+        }
+        sleeping.fetch_sub(1, std::memory_order_seq_cst);
+        idle_spins = 0;
+    }
+}
+
+inline ThreadPool::WorkItem *ThreadPool::find_work(size_t self, uint32_t &seed)
+{
+    if (WorkItem *item = deques[self]->pop())
+        return item;
+
+    // Start stealing at a random victim so thieves spread out
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    const size_t count = deques.size();
+    const size_t start = seed % count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t victim = (start + i) % count;
+        if (victim == self)
+            continue;
+        if (WorkItem *item = deques[victim]->steal())
+            return item;
+    }
+    return nullptr;
+}
+
+inline bool ThreadPool::has_work() const
+{
+    for (const auto &deque : deques)
+    {
+        if (!deque->empty())
+            return true;
     }
+    return false;
+}
+
+inline void ThreadPool::wake_one()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) == 0)
+        return;
+
+    wake_epoch.fetch_add(1, std::memory_order_seq_cst);
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+    }
+    condition.notify_one();
+}
+
+inline void ThreadPool::run_item(WorkItem *item, size_t self)
+{
+    ForJob &job = *item->job;
+    size_t begin = item->begin;
+    size_t end = item->end;
+
+    // Keep half of the range for ourselves and offer the other half for
+    // stealing, until a single chunk is left (or the deque is full)
+    while (end - begin > 1)
+    {
+        size_t mid = begin + (end - begin) / 2;
+        WorkItem &right = job.items[mid];
+        right.job = &job;
+        right.begin = mid;
+        right.end = end;
+        if (!deques[self]->push(&right))
+            break;
+        wake_one();
+        end = mid;
+    }
+
+    for (size_t chunk = begin; chunk < end; ++chunk)
+    {
+        size_t chunk_begin = job.range_begin + chunk * job.grain;
+        size_t chunk_end = std::min(chunk_begin + job.grain, job.range_end);
+        job.invoke(job.context, chunk_begin, chunk_end);
+    }
+
+    // Last touch of job: once remaining hits zero the owner may return
+    job.remaining.fetch_sub(end - begin, std::memory_order_acq_rel);
+}
+
+inline void ThreadPool::help_until_done(ForJob &job, size_t self)
+{
+    uint32_t seed = static_cast<uint32_t>(self) * 2246822519u + 7;
+    while (job.remaining.load(std::memory_order_acquire) > 0)
+    {
+        if (WorkItem *item = find_work(self, seed))
+            run_item(item, self);
+        else
+            std::this_thread::yield();
+    }
+}
+
+// Chunk slots for each nesting level of parallel_for on this thread. Reused
+// across calls, so they only allocate while growing.
+inline std::vector<ThreadPool::WorkItem> &ThreadPool::item_buffer(size_t chunk_count)
+{
+    thread_local std::vector<std::vector<WorkItem>> buffers;
+    if (buffers.size() <= nesting_depth)
+        buffers.resize(nesting_depth + 1);
+    std::vector<WorkItem> &buffer = buffers[nesting_depth];
+    if (buffer.size() < chunk_count)
+        buffer.resize(chunk_count);
+    return buffer;
+}
+
+template <class Fn>
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain, Fn &&fn)
+{
+    if (end <= begin)
+        return;
+    grain = std::max<size_t>(grain, 1);
+    const size_t chunk_count = (end - begin + grain - 1) / grain;
+
+    using FnType = std::remove_reference_t<Fn>;
+    if (workers.empty() || chunk_count == 1)
+    {
+        for (size_t b = begin; b < end; b += grain)
+            fn(b, std::min(b + grain, end));
+        return;
+    }
+
+    // Outside threads share the last deque, one at a time (nested calls on
+    // the owning thread keep using it)
+    const bool on_worker = current_pool == this;
+    std::unique_lock<std::mutex> external_lock(external_mutex, std::defer_lock);
+    const bool take_external = !on_worker && external_owner != this;
+    if (take_external)
+    {
+        external_lock.lock();
+        external_owner = this;
+    }
+    const size_t self = on_worker ? current_index : workers.size();
+
+    std::vector<WorkItem> &items = item_buffer(chunk_count);
+    ForJob job;
+    job.invoke = &invoke_chunk<FnType>;
+    job.context = const_cast<void *>(static_cast<const void *>(&fn));
+    job.range_begin = begin;
+    job.range_end = end;
+    job.grain = grain;
+    job.items = items.data();
+    job.remaining.store(chunk_count, std::memory_order_relaxed);
+
+    nesting_depth++;
+    items[0] = WorkItem{&job, 0, chunk_count};
+    run_item(&items[0], self);
+    help_until_done(job, self);
+    nesting_depth--;
+
+    if (take_external)
+        external_owner = nullptr;
 }
 
 template <class F, class... Args>
@@ -69,12 +364,19 @@ auto ThreadPool::enqueue(F &&f, Args &&...args)
         });
 
     std::future<return_type> res = task->get_future();
+    if (workers.empty())
+    {
+        // Nobody would pick it up (a pool of size 0 is the caller alone)
+        (*task)();
+        return res;
+    }
     {
         std::unique_lock<std::mutex> lock(queue_mutex);
         if (stop)
             throw std::runtime_error("enqueue on stopped ThreadPool");
         tasks.emplace([task]()
                       { (*task)(); });
+        ++queued_tasks;
     }
     condition.notify_one();
     return res;
@@ -98,4 +400,4 @@ inline ThreadPool::~ThreadPool()
         worker.join();
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,130 @@
+#ifndef TILES_HPP
+#define TILES_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Screen-space rectangle [x0, x1) x [y0, y1) handed to one worker at a time
+struct Tile
+{
+    int x0, y0, x1, y1;
+};
+
+enum class TileOrder
+{
+    Scanline,
+    Morton,
+    Hilbert
+};
+
+inline const char *tile_order_name(TileOrder order)
+{
+    switch (order)
+    {
+    case TileOrder::Scanline:
+        return "scanline";
+    case TileOrder::Hilbert:
+        return "hilbert";
+    case TileOrder::Morton:
+    default:
+        return "morton";
+    }
+}
+
+inline bool parse_tile_order(const std::string &name, TileOrder &order)
+{
+    for (TileOrder candidate : {TileOrder::Scanline, TileOrder::Morton, TileOrder::Hilbert})
+    {
+        if (name == tile_order_name(candidate))
+        {
+            order = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Interleaves the bits of x and y (Z-order curve)
+inline uint64_t morton_key(uint32_t x, uint32_t y)
+{
+    auto spread = [](uint64_t v)
+    {
+        v &= 0xffffffffull;
+        v = (v | (v << 16)) & 0x0000ffff0000ffffull;
+        v = (v | (v << 8)) & 0x00ff00ff00ff00ffull;
+        v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0full;
+        v = (v | (v << 2)) & 0x3333333333333333ull;
+        v = (v | (v << 1)) & 0x5555555555555555ull;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+// Distance along a Hilbert curve filling an n x n grid, n a power of two
+inline uint64_t hilbert_key(uint32_t n, uint32_t x, uint32_t y)
+{
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2)
+    {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+
+        // Rotate the quadrant so the curve stays continuous
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+// Splits the image into tile_size squares (clipped at the edges), in the
+// given order. Curve orders keep consecutive tiles close on screen, so the
+// tiles a worker grabs back to back touch nearby scene data.
+inline std::vector<Tile> make_tiles(int width, int height, int tile_size, TileOrder order)
+{
+    const int tiles_x = (width + tile_size - 1) / tile_size;
+    const int tiles_y = (height + tile_size - 1) / tile_size;
+
+    uint32_t grid = 1;
+    while (grid < static_cast<uint32_t>(std::max(tiles_x, tiles_y)))
+        grid *= 2;
+
+    std::vector<std::pair<uint64_t, Tile>> keyed;
+    keyed.reserve(tiles_x * tiles_y);
+    for (int ty = 0; ty < tiles_y; ++ty)
+    {
+        for (int tx = 0; tx < tiles_x; ++tx)
+        {
+            uint64_t key = static_cast<uint64_t>(ty) * tiles_x + tx;
+            if (order == TileOrder::Morton)
+                key = morton_key(tx, ty);
+            else if (order == TileOrder::Hilbert)
+                key = hilbert_key(grid, tx, ty);
+
+            Tile tile{tx * tile_size, ty * tile_size,
+                      std::min((tx + 1) * tile_size, width), std::min((ty + 1) * tile_size, height)};
+            keyed.emplace_back(key, tile);
+        }
+    }
+
+    std::sort(keyed.begin(), keyed.end(),
+              [](const auto &a, const auto &b)
+              { return a.first < b.first; });
+
+    std::vector<Tile> tiles;
+    tiles.reserve(keyed.size());
+    for (const auto &entry : keyed)
+        tiles.push_back(entry.second);
+    return tiles;
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef TRANSFORM_HPP
+#define TRANSFORM_HPP
+
+#include <cmath>
+#include "aabb.hpp"
+#include "vec3.hpp"
+
+// Affine transform: rows of a 3x3 linear part with the translation in the
+// last column
+struct Transform
+{
+    Real m[3][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}};
+
+    static Transform translation(const Vec3 &offset)
+    {
+        Transform t;
+        t.m[0][3] = offset.x;
+        t.m[1][3] = offset.y;
+        t.m[2][3] = offset.z;
+        return t;
+    }
+
+    static Transform scale(Real factor)
+    {
+        Transform t;
+        t.m[0][0] = t.m[1][1] = t.m[2][2] = factor;
+        return t;
+    }
+
+    // Counterclockwise about +y looking down from above
+    static Transform rotation_y(double degrees)
+    {
+        const double radians = degrees * M_PI / 180.0;
+        Transform t;
+        t.m[0][0] = static_cast<Real>(std::cos(radians));
+        t.m[0][2] = static_cast<Real>(std::sin(radians));
+        t.m[2][0] = static_cast<Real>(-std::sin(radians));
+        t.m[2][2] = static_cast<Real>(std::cos(radians));
+        return t;
+    }
+
+    // Applies other first, then this
+    Transform operator*(const Transform &other) const
+    {
+        Transform t;
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                t.m[i][j] = m[i][0] * other.m[0][j] + m[i][1] * other.m[1][j] + m[i][2] * other.m[2][j] +
+                            (j == 3 ? m[i][3] : Real(0));
+            }
+        }
+        return t;
+    }
+
+    Vec3 point(const Vec3 &p) const
+    {
+        return Vec3(m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                    m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                    m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+    }
+
+    Vec3 vector(const Vec3 &v) const
+    {
+        return Vec3(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                    m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                    m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+    }
+
+    // Multiplies by the transposed linear part. Called on the inverse, this
+    // carries a normal from the space the transform maps into back out.
+    Vec3 transpose_vector(const Vec3 &v) const
+    {
+        return Vec3(m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z,
+                    m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z,
+                    m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z);
+    }
+
+    // Computed in double, so rays moved into object space stay accurate
+    Transform inverse() const
+    {
+        double a[3][3];
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 3; ++j)
+                a[i][j] = m[i][j];
+
+        const double c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+        const double c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+        const double c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+        const double inv_det = 1.0 / (a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02);
+
+        double r[3][3];
+        r[0][0] = c00 * inv_det;
+        r[1][0] = c01 * inv_det;
+        r[2][0] = c02 * inv_det;
+        r[0][1] = (a[0][2] * a[2][1] - a[0][1] * a[2][2]) * inv_det;
+        r[1][1] = (a[0][0] * a[2][2] - a[0][2] * a[2][0]) * inv_det;
+        r[2][1] = (a[0][1] * a[2][0] - a[0][0] * a[2][1]) * inv_det;
+        r[0][2] = (a[0][1] * a[1][2] - a[0][2] * a[1][1]) * inv_det;
+        r[1][2] = (a[0][2] * a[1][0] - a[0][0] * a[1][2]) * inv_det;
+        r[2][2] = (a[0][0] * a[1][1] - a[0][1] * a[1][0]) * inv_det;
+
+        Transform t;
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+                t.m[i][j] = static_cast<Real>(r[i][j]);
+            t.m[i][3] = static_cast<Real>(-(r[i][0] * m[0][3] + r[i][1] * m[1][3] + r[i][2] * m[2][3]));
+        }
+        return t;
+    }
+
+    // Bounds of the transformed box
+    AABB box(const AABB &b) const
+    {
+        AABB result;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            result.grow(point(Vec3(corner & 1 ? b.max.x : b.min.x,
+                                   corner & 2 ? b.max.y : b.min.y,
+                                   corner & 4 ? b.max.z : b.min.z)));
+        }
+        return result;
+    }
+};
+
+#endif
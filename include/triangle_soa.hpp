@@ -0,0 +1,87 @@
+#ifndef TRIANGLE_SOA_HPP
+#define TRIANGLE_SOA_HPP
+
+#include <cstdint>
+#include <vector>
+#include "aligned_allocator.hpp"
+#include "vec3.hpp"
+
+// Raw view of the SoA arrays handed to the SIMD kernels: the three corners
+// a, b and c of every triangle
+struct TriangleSpan
+{
+    const Real *ax;
+    const Real *ay;
+    const Real *az;
+    const Real *bx;
+    const Real *by;
+    const Real *bz;
+    const Real *cx;
+    const Real *cy;
+    const Real *cz;
+};
+
+// Triangle corners in structure-of-arrays form, gathered from a mesh's
+// vertex and index buffers in BLAS leaf order. Padded like SphereSoA, with
+// degenerate triangles that are never hit, so a block loaded at any leaf's
+// start stays inside the arrays.
+class TriangleSoA
+{
+public:
+    static constexpr size_t PADDING = 64 / sizeof(Real);
+
+    // order lists which triangle goes in each slot
+    void build(const std::vector<Vec3> &positions, const std::vector<uint32_t> &indices,
+               const uint32_t *order, size_t count);
+    void clear();
+
+    size_t size() const { return ids_.size(); }
+    uint32_t id(size_t slot) const { return ids_[slot]; }
+    Vec3 corner(size_t slot, int corner) const;
+    TriangleSpan span() const
+    {
+        return TriangleSpan{coords_[0].data(), coords_[1].data(), coords_[2].data(),
+                            coords_[3].data(), coords_[4].data(), coords_[5].data(),
+                            coords_[6].data(), coords_[7].data(), coords_[8].data()};
+    }
+
+private:
+    AlignedVector<Real> coords_[9]; // ax, ay, az, bx, by, bz, cx, cy, cz
+    std::vector<uint32_t> ids_;     // triangle index stored in each slot
+};
+
+inline void TriangleSoA::build(const std::vector<Vec3> &positions, const std::vector<uint32_t> &indices,
+                               const uint32_t *order, size_t count)
+{
+    const size_t padded = count == 0 ? 0 : (count + 2 * PADDING - 2) / PADDING * PADDING;
+    for (AlignedVector<Real> &coord : coords_)
+        coord.assign(padded, Real(0));
+    ids_.resize(count);
+
+    for (size_t slot = 0; slot < count; ++slot)
+    {
+        const uint32_t id = order[slot];
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            const Vec3 &p = positions[indices[3 * id + corner]];
+            coords_[3 * corner][slot] = p.x;
+            coords_[3 * corner + 1][slot] = p.y;
+            coords_[3 * corner + 2][slot] = p.z;
+        }
+        ids_[slot] = id;
+    }
+}
+
+inline void TriangleSoA::clear()
+{
+    for (AlignedVector<Real> &coord : coords_)
+        coord.clear();
+    ids_.clear();
+}
+
+inline Vec3 TriangleSoA::corner(size_t slot, int corner) const
+{
+    return Vec3(coords_[3 * corner][slot], coords_[3 * corner + 1][slot], coords_[3 * corner + 2][slot]);
+}
+
+#endif
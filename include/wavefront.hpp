@@ -0,0 +1,390 @@
+#ifndef WAVEFRONT_HPP
+#define WAVEFRONT_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "camera.hpp"
+#include "config.hpp"
+#include "denoiser.hpp"
+#include "framebuffer.hpp"
+#include "instrumentation.hpp"
+#include "ray.hpp"
+#include "sampling.hpp"
+#include "scene.hpp"
+#include "tiles.hpp"
+#include "vec3.hpp"
+
+// Sky seen by rays that leave the scene; also the light paths pick up there
+inline Vec3 sky_color(const Vec3 &direction)
+{
+    Real t = Real(0.5) * (direction.y + 1);
+    return Vec3(1, 1, 1) * (1 - t) + Vec3(0.5, 0.7, 1.0) * t;
+}
+
+struct PathSettings
+{
+    int max_depth;      // surface hits per path, 1 for direct light only
+    int roulette_depth; // hits before Russian roulette may end a path
+    Vec3 light_direction;
+};
+
+// Paths in structure-of-arrays form, one entry per live path
+struct PathQueue
+{
+    std::vector<Real> ox, oy, oz;
+    std::vector<Real> dx, dy, dz;
+    std::vector<Real> throughput_r, throughput_g, throughput_b;
+    std::vector<uint32_t> pixel; // index within the tile
+    std::vector<uint32_t> rng;
+    size_t count = 0;
+
+    void reserve(size_t capacity);
+    void push(const Vec3 &origin, const Vec3 &direction, Real r, Real g, Real b, uint32_t pixel_index, uint32_t state);
+    void copy(size_t to, const PathQueue &from, size_t index);
+};
+
+// Wavefront path tracer (Laine, Karras and Aila, "Megakernels Considered
+// Harmful", HPG 2013) for one thread. Instead of following each path to its
+// end, every path of a tile sample advances together through short stages:
+// generate camera rays, extend them to their next hit, gather the hits'
+// surface attributes, shade them, and connect the ones the sun reaches. Each stage is one tight loop over arrays,
+// so the BVH and shading code stay in cache and the branches stay
+// predictable. Survivors are compacted and sorted by direction between
+// bounces, so neighbouring rays walk the BVH alike.
+//
+// Surfaces are Lambertian, lit by the sky and a sun of irradiance pi, which
+// makes the first bounce's sun term the same as the direct renderer's.
+class WavefrontTracer
+{
+public:
+    // Adds samples new paths through every pixel of the tile to the buffer,
+    // and their first hits to guides when given
+    void render_tile(const Scene &scene, const CameraSnapshot &camera, const PathSettings &settings,
+                     const Tile &tile, uint32_t first_sample, int samples, Framebuffer &buffer, Denoiser *guides);
+
+    // Sizes the queues for tiles of up to capacity pixels, so frames don't
+    // allocate; render_tile() grows them for anything larger
+    void reserve(size_t capacity);
+
+private:
+    // Keys of sort_paths: octant of the direction times its major axis
+    static constexpr int SORT_BUCKETS = 24;
+
+    PathQueue paths_;   // live paths, extended by the next extend()
+    PathQueue bounces_; // survivors of shade(), in no particular order
+
+    // Results of extend(), indexed like paths_, and the attributes gather()
+    // fetches for the hits
+    std::vector<uint8_t> hit_;
+    std::vector<Hit> hits_;
+    std::vector<Real> px_, py_, pz_;
+    std::vector<Real> nx_, ny_, nz_;
+    std::vector<Real> albedo_r_, albedo_g_, albedo_b_;
+
+    // Shadow rays toward the sun and what they add if nothing blocks them
+    std::vector<Real> shadow_x_, shadow_y_, shadow_z_;
+    std::vector<Real> shadow_r_, shadow_g_, shadow_b_;
+    std::vector<uint32_t> shadow_pixel_;
+    size_t shadow_count_ = 0;
+
+    std::vector<Vec3> radiance_; // per tile pixel, of the sample in flight
+    std::vector<Vec3> sums_;      // per tile pixel, summed over samples
+    std::vector<float> squares_;  // per tile pixel, squared luminances summed over samples
+    std::vector<PixelGuides> guides_; // per tile pixel, first hits summed over samples
+    std::vector<uint8_t> sort_keys_;
+
+    void generate(const CameraSnapshot &camera, const Tile &tile, uint32_t sample);
+    void extend(const Scene &scene);
+    void gather(const Scene &scene);
+    void add_guides();
+    void shade(const PathSettings &settings, int depth);
+    void connect(const Scene &scene, const Vec3 &light_direction);
+    void sort_paths();
+};
+
+inline void PathQueue::reserve(size_t capacity)
+{
+    for (std::vector<Real> *field : {&ox, &oy, &oz, &dx, &dy, &dz, &throughput_r, &throughput_g, &throughput_b})
+        field->resize(capacity);
+    pixel.resize(capacity);
+    rng.resize(capacity);
+}
+
+inline void PathQueue::push(const Vec3 &origin, const Vec3 &direction, Real r, Real g, Real b,
+                            uint32_t pixel_index, uint32_t state)
+{
+    const size_t i = count++;
+    ox[i] = origin.x;
+    oy[i] = origin.y;
+    oz[i] = origin.z;
+    dx[i] = direction.x;
+    dy[i] = direction.y;
+    dz[i] = direction.z;
+    throughput_r[i] = r;
+    throughput_g[i] = g;
+    throughput_b[i] = b;
+    pixel[i] = pixel_index;
+    rng[i] = state;
+}
+
+inline void PathQueue::copy(size_t to, const PathQueue &from, size_t index)
+{
+    ox[to] = from.ox[index];
+    oy[to] = from.oy[index];
+    oz[to] = from.oz[index];
+    dx[to] = from.dx[index];
+    dy[to] = from.dy[index];
+    dz[to] = from.dz[index];
+    throughput_r[to] = from.throughput_r[index];
+    throughput_g[to] = from.throughput_g[index];
+    throughput_b[to] = from.throughput_b[index];
+    pixel[to] = from.pixel[index];
+    rng[to] = from.rng[index];
+}
+
+inline void WavefrontTracer::render_tile(const Scene &scene, const CameraSnapshot &camera, const PathSettings &settings,
+                                         const Tile &tile, uint32_t first_sample, int samples, Framebuffer &buffer,
+                                         Denoiser *guides)
+{
+    const int width = tile.x1 - tile.x0;
+    const size_t pixels = static_cast<size_t>(width) * (tile.y1 - tile.y0);
+    reserve(pixels);
+    std::fill(sums_.begin(), sums_.begin() + pixels, Vec3(0, 0, 0));
+    std::fill(squares_.begin(), squares_.begin() + pixels, 0.0f);
+    if (guides)
+        std::fill(guides_.begin(), guides_.begin() + pixels, PixelGuides{});
+
+    for (int s = 0; s < samples; ++s)
+    {
+        std::fill(radiance_.begin(), radiance_.begin() + pixels, Vec3(0, 0, 0));
+        generate(camera, tile, first_sample + s);
+        for (int depth = 0; depth < settings.max_depth && paths_.count > 0; ++depth)
+        {
+            extend(scene);
+            gather(scene);
+            if (guides && depth == 0)
+                add_guides();
+            shade(settings, depth);
+            connect(scene, settings.light_direction);
+            sort_paths();
+        }
+
+        for (size_t k = 0; k < pixels; ++k)
+        {
+            sums_[k] = sums_[k] + radiance_[k];
+            const float l = luminance(radiance_[k]);
+            squares_[k] += l * l;
+        }
+    }
+
+    for (size_t k = 0; k < pixels; ++k)
+    {
+        const int x = tile.x0 + static_cast<int>(k % width), y = tile.y0 + static_cast<int>(k / width);
+        if (guides)
+            guides->accumulate_guides(buffer, x, y, guides_[k], samples);
+        buffer.accumulate_pixel(x, y, sums_[k], samples, squares_[k]);
+    }
+}
+
+inline void WavefrontTracer::reserve(size_t capacity)
+{
+    if (radiance_.size() >= capacity)
+        return;
+
+    paths_.reserve(capacity);
+    bounces_.reserve(capacity);
+    hit_.resize(capacity);
+    hits_.resize(capacity);
+    for (std::vector<Real> *field : {&px_, &py_, &pz_, &nx_, &ny_, &nz_, &albedo_r_, &albedo_g_, &albedo_b_,
+                                     &shadow_x_, &shadow_y_, &shadow_z_, &shadow_r_, &shadow_g_, &shadow_b_})
+        field->resize(capacity);
+    shadow_pixel_.resize(capacity);
+    radiance_.resize(capacity);
+    sums_.resize(capacity);
+    squares_.resize(capacity);
+    guides_.resize(capacity);
+    sort_keys_.resize(capacity);
+}
+
+inline void WavefrontTracer::generate(const CameraSnapshot &camera, const Tile &tile, uint32_t sample)
+{
+    const int width = tile.x1 - tile.x0;
+    Vec3 directions[CameraSnapshot::BATCH];
+    paths_.count = 0;
+    for (int j = tile.y0; j < tile.y1; ++j)
+    {
+        for (int i0 = tile.x0; i0 < tile.x1; i0 += CameraSnapshot::BATCH)
+        {
+            const int i1 = std::min(i0 + CameraSnapshot::BATCH, tile.x1);
+            camera.row_directions(i0, i1, j, sample, directions);
+            for (int i = i0; i < i1; ++i)
+            {
+                const uint32_t pixel = static_cast<uint32_t>((j - tile.y0) * width + (i - tile.x0));
+                paths_.push(camera.position, directions[i - i0], 1, 1, 1, pixel, path_seed(i, j, sample));
+            }
+        }
+    }
+}
+
+inline void WavefrontTracer::extend(const Scene &scene)
+{
+    const size_t count = paths_.count;
+    Instrumentation::count_rays(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Ray ray = Ray::from_unit(Vec3(paths_.ox[i], paths_.oy[i], paths_.oz[i]),
+                                       Vec3(paths_.dx[i], paths_.dy[i], paths_.dz[i]));
+        const bool hit = scene.intersect(ray, static_cast<Real>(Config::RAY_T_MIN), static_cast<Real>(Config::RAY_T_MAX), hits_[i]);
+        Instrumentation::count_hit(hit);
+        hit_[i] = hit;
+    }
+}
+
+// Point, normal and albedo of every hit, as arrays for shade()
+inline void WavefrontTracer::gather(const Scene &scene)
+{
+    for (size_t i = 0; i < paths_.count; ++i)
+    {
+        if (!hit_[i])
+            continue;
+
+        const Ray ray = Ray::from_unit(Vec3(paths_.ox[i], paths_.oy[i], paths_.oz[i]),
+                                       Vec3(paths_.dx[i], paths_.dy[i], paths_.dz[i]));
+        const HitRecord rec = scene.surface(ray, hits_[i]);
+        const Vec3 &albedo = scene.material(rec.material).albedo;
+        px_[i] = rec.point.x;
+        py_[i] = rec.point.y;
+        pz_[i] = rec.point.z;
+        nx_[i] = rec.normal.x;
+        ny_[i] = rec.normal.y;
+        nz_[i] = rec.normal.z;
+        albedo_r_[i] = albedo.x;
+        albedo_g_[i] = albedo.y;
+        albedo_b_[i] = albedo.z;
+    }
+}
+
+// The camera paths' first hits, one per pixel
+inline void WavefrontTracer::add_guides()
+{
+    for (size_t i = 0; i < paths_.count; ++i)
+    {
+        PixelGuides &guides = guides_[paths_.pixel[i]];
+        if (hit_[i])
+            guides.add_hit(Vec3(nx_[i], ny_[i], nz_[i]), hits_[i].t, Vec3(albedo_r_[i], albedo_g_[i], albedo_b_[i]));
+        else
+            guides.add_miss();
+    }
+}
+
+inline void WavefrontTracer::shade(const PathSettings &settings, int depth)
+{
+    const Vec3 &light = settings.light_direction;
+    const bool last = depth + 1 >= settings.max_depth;
+    const bool roulette = depth + 1 >= settings.roulette_depth;
+    shadow_count_ = 0;
+    bounces_.count = 0;
+
+    for (size_t i = 0; i < paths_.count; ++i)
+    {
+        const uint32_t pixel = paths_.pixel[i];
+        if (!hit_[i])
+        {
+            const Vec3 sky = sky_color(Vec3(paths_.dx[i], paths_.dy[i], paths_.dz[i]));
+            radiance_[pixel] = radiance_[pixel] + Vec3(paths_.throughput_r[i] * sky.x, paths_.throughput_g[i] * sky.y,
+                                                       paths_.throughput_b[i] * sky.z);
+            continue;
+        }
+
+        // Throughput after this bounce; cosine-weighted sampling cancels the
+        // Lambertian BRDF's cos / pi against its pdf
+        Real r = paths_.throughput_r[i] * albedo_r_[i];
+        Real g = paths_.throughput_g[i] * albedo_g_[i];
+        Real b = paths_.throughput_b[i] * albedo_b_[i];
+        const Vec3 normal(nx_[i], ny_[i], nz_[i]);
+        const Vec3 origin = offset_ray_origin(Vec3(px_[i], py_[i], pz_[i]), normal);
+
+        const Real cos_light = normal.dot(light);
+        if (cos_light > 0)
+        {
+            const size_t k = shadow_count_++;
+            shadow_x_[k] = origin.x;
+            shadow_y_[k] = origin.y;
+            shadow_z_[k] = origin.z;
+            shadow_r_[k] = r * cos_light;
+            shadow_g_[k] = g * cos_light;
+            shadow_b_[k] = b * cos_light;
+            shadow_pixel_[k] = pixel;
+        }
+        if (last)
+            continue;
+
+        uint32_t state = paths_.rng[i];
+        if (roulette)
+        {
+            const Real survive = std::min(Real(0.95), std::max(r, std::max(g, b)));
+            if (next_random(state) >= survive)
+                continue;
+            r /= survive;
+            g /= survive;
+            b /= survive;
+        }
+
+        // Orthonormal basis around the normal (Duff et al., "Building an
+        // Orthonormal Basis, Revisited", JCGT 2017)
+        const Real sign = std::copysign(Real(1), normal.z);
+        const Real a = -1 / (sign + normal.z);
+        const Real c = normal.x * normal.y * a;
+        const Vec3 tangent(1 + sign * normal.x * normal.x * a, sign * c, -sign * normal.x);
+        const Vec3 bitangent(c, sign + normal.y * normal.y * a, -normal.y);
+
+        const double u1 = next_random(state);
+        const double u2 = next_random(state);
+        const Real radius = static_cast<Real>(std::sqrt(u1));
+        const Real phi = static_cast<Real>(2.0 * M_PI * u2);
+        const Vec3 direction = tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi)) +
+                               normal * static_cast<Real>(std::sqrt(1.0 - u1));
+        bounces_.push(origin, direction, r, g, b, pixel, state);
+    }
+}
+
+// Shadow rays only ask whether anything blocks the sun
+inline void WavefrontTracer::connect(const Scene &scene, const Vec3 &light_direction)
+{
+    Instrumentation::count_rays(shadow_count_);
+    for (size_t k = 0; k < shadow_count_; ++k)
+    {
+        const Ray ray = Ray::from_unit(Vec3(shadow_x_[k], shadow_y_[k], shadow_z_[k]), light_direction);
+        if (scene.occluded(ray, static_cast<Real>(Config::RAY_T_MAX)))
+            continue;
+
+        Vec3 &sum = radiance_[shadow_pixel_[k]];
+        sum = sum + Vec3(shadow_r_[k], shadow_g_[k], shadow_b_[k]);
+    }
+}
+
+// Counting sort of the survivors back into paths_, grouped by direction
+inline void WavefrontTracer::sort_paths()
+{
+    size_t offsets[SORT_BUCKETS + 1] = {};
+    const size_t count = bounces_.count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Real x = bounces_.dx[i], y = bounces_.dy[i], z = bounces_.dz[i];
+        const Real ax = std::abs(x), ay = std::abs(y), az = std::abs(z);
+        const int axis = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+        const int key = axis * 8 + (x < 0) + 2 * (y < 0) + 4 * (z < 0);
+        sort_keys_[i] = static_cast<uint8_t>(key);
+        offsets[key + 1]++;
+    }
+    for (int bucket = 0; bucket < SORT_BUCKETS; ++bucket)
+        offsets[bucket + 1] += offsets[bucket];
+
+    for (size_t i = 0; i < count; ++i)
+        paths_.copy(offsets[sort_keys_[i]]++, bounces_, i);
+    paths_.count = count;
+}
+
+#endif
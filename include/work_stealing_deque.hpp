@@ -0,0 +1,115 @@
+#ifndef WORK_STEALING_DEQUE_HPP
+#define WORK_STEALING_DEQUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Chase-Lev work-stealing deque of pointers (the C11 formulation from Le,
+// Pop, Cohen and Zappa Nardelli, "Correct and Efficient Work-Stealing for
+// Weak Memory Models"). The owning thread pushes and pops at the bottom
+// without locking; other threads steal from the top with a single CAS.
+// Capacity is fixed, so push() reports a full deque instead of growing and
+// the caller runs the work inline.
+template <class T>
+class WorkStealingDeque
+{
+public:
+    explicit WorkStealingDeque(size_t capacity = 1024);
+
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    // Owner only
+    bool push(T *item);
+    T *pop();
+
+    // Any thread
+    T *steal();
+    bool empty() const;
+
+private:
+    // Top and bottom on separate cache lines: thieves hammer top, the owner bottom
+    alignas(64) std::atomic<int64_t> top_;
+    alignas(64) std::atomic<int64_t> bottom_;
+    alignas(64) size_t mask_;
+    std::unique_ptr<std::atomic<T *>[]> buffer_;
+};
+
+template <class T>
+WorkStealingDeque<T>::WorkStealingDeque(size_t capacity)
+    : top_(0), bottom_(0)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size *= 2;
+    mask_ = size - 1;
+    buffer_.reset(new std::atomic<T *>[size]);
+    for (size_t i = 0; i < size; ++i)
+        buffer_[i].store(nullptr, std::memory_order_relaxed);
+}
+
+template <class T>
+bool WorkStealingDeque<T>::push(T *item)
+{
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    if (b - t > static_cast<int64_t>(mask_))
+        return false;
+
+    buffer_[b & mask_].store(item, std::memory_order_relaxed);
+    bottom_.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+template <class T>
+T *WorkStealingDeque<T>::pop()
+{
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+
+    if (t > b)
+    {
+        // Empty
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    T *item = buffer_[b & mask_].load(std::memory_order_relaxed);
+    if (t == b)
+    {
+        // Last item: race thieves for it
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            item = nullptr;
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+}
+
+template <class T>
+T *WorkStealingDeque<T>::steal()
+{
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b)
+        return nullptr;
+
+    T *item = buffer_[t & mask_].load(std::memory_order_relaxed);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr; // lost to the owner or another thief
+    return item;
+}
+
+template <class T>
+bool WorkStealingDeque<T>::empty() const
+{
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    return b <= t;
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include "alloc_counter.hpp"
+
+#ifdef RAYTRACER_COUNT_ALLOCS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+
+std::atomic<uint64_t> allocations{0};
+
+void *counted_alloc(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void *counted_aligned_alloc(std::size_t size, std::align_val_t alignment)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    std::size_t align = static_cast<std::size_t>(alignment);
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+#ifdef _WIN32
+    return _aligned_malloc(size ? size : 1, align);
+#else
+    void *p = nullptr;
+    return posix_memalign(&p, align, size ? size : 1) == 0 ? p : nullptr;
+#endif
+}
+
+void aligned_free(void *p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+} // namespace
+
+void *operator new(std::size_t size)
+{
+    if (void *p = counted_alloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_alloc(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_alloc(size);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    if (void *p = counted_aligned_alloc(size, alignment))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return counted_aligned_alloc(size, alignment);
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return counted_aligned_alloc(size, alignment);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { aligned_free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { aligned_free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { aligned_free(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { aligned_free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { aligned_free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { aligned_free(p); }
+
+bool allocation_counting_enabled()
+{
+    return true;
+}
+
+uint64_t allocation_count()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+#else
+
+bool allocation_counting_enabled()
+{
+    return false;
+}
+
+uint64_t allocation_count()
+{
+    return 0;
+}
+
+#endif
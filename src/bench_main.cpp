@@ -0,0 +1,608 @@
+#include "camera.hpp"
+#include "config.hpp"
+#include "framebuffer.hpp"
+#include "renderer.hpp"
+#include "scenes.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    bool quick = false;
+    std::string filter;
+    std::string output;
+    std::string simd;
+    std::vector<int> threads; // empty: powers of two up to the hardware count
+    std::vector<int> spheres = {3, 1000, 100000, 1000000};
+    std::vector<std::pair<int, int>> resolutions = {{320, 240}, {1280, 720}, {1920, 1080}};
+    int frames = 8;
+    double min_ms = 250.0;
+};
+
+struct MicroResult
+{
+    std::string name;
+    double ns_per_op;
+};
+
+struct RenderResult
+{
+    std::string name;
+    int spheres;
+    int width;
+    int height;
+    int threads;
+    int frames;
+    double build_ms;
+    double frame_ms_min;
+    double frame_ms_median;
+    double rays_per_s;
+    double ns_per_pixel;
+    double scaling_efficiency;
+};
+
+// Results feed this so the optimizer cannot drop the measured work
+volatile double sink = 0.0;
+
+void print_usage(const char *argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [options]\n"
+              << "  --quick            small run: 3 and 1000 spheres at 320x240, fewer samples\n"
+              << "  --filter TEXT      only run benchmarks whose name contains TEXT\n"
+              << "  --threads LIST     thread counts, e.g. 1,2,4 (default powers of two up to\n"
+              << "                     hardware concurrency, plus hardware concurrency)\n"
+              << "  --spheres LIST     scene sizes (default 3,1000,100000,1000000; 3 is the\n"
+              << "                     default scene, others random sphere fields)\n"
+              << "  --res LIST         resolutions (default 320x240,1280x720,1920x1080)\n"
+              << "  --frames N         timed frames per render benchmark (default 8)\n"
+              << "  --min-ms MS        sampling time per micro benchmark (default 250)\n"
+              << "  --simd ISA         scalar, sse4.1, avx2 or avx512 (default: best supported)\n"
+              << "  -o, --output PATH  write the JSON report to PATH instead of stdout\n";
+}
+
+bool parse_int_list(const std::string &text, std::vector<int> &out)
+{
+    out.clear();
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        int value = std::stoi(item);
+        if (value < 1)
+            return false;
+        out.push_back(value);
+    }
+    return !out.empty();
+}
+
+bool parse_resolutions(const std::string &text, std::vector<std::pair<int, int>> &out)
+{
+    out.clear();
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        int width, height;
+        if (std::sscanf(item.c_str(), "%dx%d", &width, &height) != 2 || width < 2 || height < 2)
+            return false;
+        out.emplace_back(width, height);
+    }
+    return !out.empty();
+}
+
+bool parse_args(int argc, char **argv, Options &opts)
+{
+    bool spheres_set = false;
+    bool resolutions_set = false;
+    bool frames_set = false;
+    bool min_ms_set = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+            return false;
+        if (arg == "--quick")
+        {
+            opts.quick = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+
+        try
+        {
+            bool ok = true;
+            if (arg == "--filter")
+                opts.filter = value;
+            else if (arg == "--threads")
+                ok = parse_int_list(value, opts.threads);
+            else if (arg == "--spheres")
+                ok = spheres_set = parse_int_list(value, opts.spheres);
+            else if (arg == "--res")
+                ok = resolutions_set = parse_resolutions(value, opts.resolutions);
+            else if (arg == "--frames")
+            {
+                opts.frames = std::stoi(value);
+                ok = frames_set = opts.frames >= 1;
+            }
+            else if (arg == "--min-ms")
+            {
+                opts.min_ms = std::stod(value);
+                ok = min_ms_set = opts.min_ms > 0.0;
+            }
+            else if (arg == "--simd")
+                opts.simd = value;
+            else if (arg == "-o" || arg == "--output")
+                opts.output = value;
+            else
+            {
+                std::cerr << "Unknown option " << arg << std::endl;
+                return false;
+            }
+            if (!ok)
+            {
+                std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+                return false;
+            }
+        }
+        catch (const std::exception &)
+        {
+            std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+            return false;
+        }
+    }
+
+    // --quick only shrinks what was not given explicitly
+    if (opts.quick)
+    {
+        if (!spheres_set)
+            opts.spheres = {3, 1000};
+        if (!resolutions_set)
+            opts.resolutions = {{320, 240}};
+        if (!frames_set)
+            opts.frames = 4;
+        if (!min_ms_set)
+            opts.min_ms = 50.0;
+    }
+
+    if (opts.threads.empty())
+    {
+        const int hardware = std::max(1, Config::NUM_THREADS);
+        for (int count = 1; count < hardware; count *= 2)
+            opts.threads.push_back(count);
+        opts.threads.push_back(hardware);
+    }
+    std::sort(opts.threads.begin(), opts.threads.end());
+    opts.threads.erase(std::unique(opts.threads.begin(), opts.threads.end()), opts.threads.end());
+    return true;
+}
+
+bool selected(const Options &opts, const std::string &name)
+{
+    return opts.filter.empty() || name.find(opts.filter) != std::string::npos;
+}
+
+double elapsed_ms(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Median over five batches of the time per operation. Each batch calls fn
+// (which performs ops_per_call operations) until a fifth of min_ms passes.
+template <class Fn>
+double measure_ns_per_op(Fn &&fn, size_t ops_per_call, double min_ms)
+{
+    const int batches = 5;
+    fn(); // warm caches and lazy initialization
+
+    std::vector<double> samples;
+    for (int batch = 0; batch < batches; ++batch)
+    {
+        size_t calls = 0;
+        const Clock::time_point start = Clock::now();
+        double ms;
+        do
+        {
+            fn();
+            calls++;
+            ms = elapsed_ms(start);
+        } while (ms < min_ms / batches);
+        samples.push_back(ms * 1e6 / (static_cast<double>(calls) * ops_per_call));
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[batches / 2];
+}
+
+// Primary rays of the default camera over a grid, shared by the
+// intersection benchmarks
+std::vector<Ray> make_rays(int grid)
+{
+    Camera camera(Vec3(0.0, 0.0, 3.0));
+    std::vector<Ray> rays;
+    rays.reserve(grid * grid);
+    for (int j = 0; j < grid; ++j)
+    {
+        for (int i = 0; i < grid; ++i)
+        {
+            double u = 2.0 * i / (grid - 1.0) - 1.0;
+            double v = 1.0 - 2.0 * j / (grid - 1.0);
+            rays.push_back(camera.get_ray(u, v));
+        }
+    }
+    return rays;
+}
+
+void run_micro(const Options &opts, std::vector<MicroResult> &results)
+{
+    auto report = [&](const std::string &name, double ns_per_op)
+    {
+        results.push_back(MicroResult{name, ns_per_op});
+        std::fprintf(stderr, "%-40s %10.3f ns/op\n", name.c_str(), ns_per_op);
+    };
+
+    // Ray-sphere intersection: one operation is one ray against one sphere
+    Scene field = create_sphere_field(64);
+    field.build_acceleration(false);
+    const std::vector<Ray> rays = make_rays(32);
+    const size_t tests = rays.size() * field.spheres.size();
+
+    if (selected(opts, "sphere_hit"))
+    {
+        report("sphere_hit", measure_ns_per_op([&]
+                                               {
+            int hits = 0;
+            Real t;
+            for (const Ray &ray : rays)
+            {
+                for (const Sphere &sphere : field.spheres)
+                    hits += sphere.intersect(ray, Config::RAY_T_MIN, Config::RAY_T_MAX, t);
+            }
+            sink = sink + hits; }, tests, opts.min_ms));
+    }
+
+    for (SimdIsa isa : {SimdIsa::Scalar, SimdIsa::SSE41, SimdIsa::AVX2, SimdIsa::AVX512})
+    {
+        const std::string name = std::string("nearest_sphere/") + simd_isa_name(isa);
+        if (!simd_isa_supported(isa) || !selected(opts, name))
+            continue;
+
+        const SimdKernels *kernels = isa == SimdIsa::Scalar ? simd_kernels_scalar()
+                                     : isa == SimdIsa::SSE41 ? simd_kernels_sse41()
+                                     : isa == SimdIsa::AVX2  ? simd_kernels_avx2()
+                                                             : simd_kernels_avx512();
+        const SphereSpan span = field.soa().span();
+        const size_t count = field.soa().size();
+        report(name, measure_ns_per_op([&]
+                                       {
+            Real total = 0;
+            for (const Ray &ray : rays)
+            {
+                Real t = static_cast<Real>(Config::RAY_T_MAX);
+                size_t slot = 0;
+                kernels->nearest_sphere(span, 0, count, ray, static_cast<Real>(Config::RAY_T_MIN), t, slot);
+                total += t;
+            }
+            sink = sink + total; }, tests, opts.min_ms));
+    }
+
+    // Ray-triangle intersection: one operation is one ray against one
+    // triangle of a 4x8 quad grid spanning the rays
+    std::vector<Vec3> grid_positions;
+    std::vector<uint32_t> grid_indices;
+    for (int j = 0; j <= 4; ++j)
+    {
+        for (int i = 0; i <= 8; ++i)
+            grid_positions.push_back(Vec3(-4.0 + i, -2.0 + j, -5.0 - 0.1 * ((i + j) % 3)));
+    }
+    for (uint32_t j = 0; j < 4; ++j)
+    {
+        for (uint32_t i = 0; i < 8; ++i)
+        {
+            const uint32_t corner = j * 9 + i;
+            grid_indices.insert(grid_indices.end(), {corner, corner + 1, corner + 10, corner, corner + 10, corner + 9});
+        }
+    }
+    const size_t triangle_count = grid_indices.size() / 3;
+    std::vector<uint32_t> triangle_order(triangle_count);
+    for (size_t i = 0; i < triangle_count; ++i)
+        triangle_order[i] = static_cast<uint32_t>(i);
+    TriangleSoA triangles;
+    triangles.build(grid_positions, grid_indices, triangle_order.data(), triangle_count);
+
+    for (SimdIsa isa : {SimdIsa::Scalar, SimdIsa::SSE41, SimdIsa::AVX2, SimdIsa::AVX512})
+    {
+        const std::string name = std::string("nearest_triangle/") + simd_isa_name(isa);
+        if (!simd_isa_supported(isa) || !selected(opts, name))
+            continue;
+
+        const SimdKernels *kernels = isa == SimdIsa::Scalar ? simd_kernels_scalar()
+                                     : isa == SimdIsa::SSE41 ? simd_kernels_sse41()
+                                     : isa == SimdIsa::AVX2  ? simd_kernels_avx2()
+                                                             : simd_kernels_avx512();
+        const TriangleSpan span = triangles.span();
+        report(name, measure_ns_per_op([&]
+                                       {
+            Real total = 0;
+            for (const Ray &ray : rays)
+            {
+                Real t = static_cast<Real>(Config::RAY_T_MAX);
+                size_t slot = 0;
+                kernels->nearest_triangle(span, 0, triangle_count, ray, static_cast<Real>(Config::RAY_T_MIN), t, slot);
+                total += t;
+            }
+            sink = sink + total; }, rays.size() * triangle_count, opts.min_ms));
+    }
+
+    if (selected(opts, "camera_get_ray"))
+    {
+        Camera camera(Vec3(0.0, 0.0, 3.0));
+        camera.aspect_ratio = 16.0 / 9.0;
+        const int grid = 64;
+        report("camera_get_ray", measure_ns_per_op([&]
+                                                   {
+            Real total = 0;
+            for (int j = 0; j < grid; ++j)
+            {
+                for (int i = 0; i < grid; ++i)
+                    total += camera.get_ray(2.0 * i / (grid - 1.0) - 1.0, 1.0 - 2.0 * j / (grid - 1.0)).direction.x;
+            }
+            sink = sink + total; }, grid * grid, opts.min_ms));
+    }
+
+    // The renderer's path: one snapshot per frame, then rows of directions
+    if (selected(opts, "camera_row_directions"))
+    {
+        Camera camera(Vec3(0.0, 0.0, 3.0));
+        camera.aspect_ratio = 16.0 / 9.0;
+        const int grid = 64;
+        report("camera_row_directions", measure_ns_per_op([&]
+                                                          {
+            const CameraSnapshot snapshot = camera.snapshot(grid, grid);
+            Vec3 directions[CameraSnapshot::BATCH];
+            Real total = 0;
+            for (int j = 0; j < grid; ++j)
+            {
+                snapshot.row_directions(0, grid, j, 0, directions);
+                for (int i = 0; i < grid; ++i)
+                    total += directions[i].x;
+            }
+            sink = sink + total; }, grid * grid, opts.min_ms));
+    }
+
+    // Scheduling overhead with trivial tasks, one worker per hardware thread
+    const int workers = std::max(1, Config::NUM_THREADS);
+    const size_t task_count = 256;
+    if (selected(opts, "thread_pool_enqueue"))
+    {
+        ThreadPool pool(workers);
+        std::vector<std::future<int>> futures(task_count);
+        report("thread_pool_enqueue", measure_ns_per_op([&]
+                                                        {
+            for (size_t i = 0; i < task_count; ++i)
+                futures[i] = pool.enqueue([i] { return static_cast<int>(i); });
+            int total = 0;
+            for (std::future<int> &future : futures)
+                total += future.get();
+            sink = sink + total; }, task_count, opts.min_ms));
+    }
+
+    if (selected(opts, "thread_pool_parallel_for"))
+    {
+        ThreadPool pool(workers - 1);
+        std::vector<double> values(task_count, 1.0);
+        report("thread_pool_parallel_for", measure_ns_per_op([&]
+                                                             {
+            pool.parallel_for(0, task_count, 1, [&](size_t begin, size_t end)
+                              {
+                for (size_t i = begin; i < end; ++i)
+                    values[i] += 1.0; });
+            sink = sink + values[0]; }, task_count, opts.min_ms));
+    }
+}
+
+std::string render_name(int spheres, int width, int height, int threads)
+{
+    return "render/spheres=" + std::to_string(spheres) + "/" + std::to_string(width) + "x" +
+           std::to_string(height) + "/threads=" + std::to_string(threads);
+}
+
+// Renders every scene, resolution and thread count along the camera path.
+// Accumulation is off so every frame traces one fresh sample per pixel.
+void run_render(const Options &opts, std::vector<RenderResult> &results)
+{
+    for (int spheres : opts.spheres)
+    {
+        const std::string prefix = "render/spheres=" + std::to_string(spheres) + "/";
+        bool any = false;
+        for (const auto &res : opts.resolutions)
+        {
+            for (int threads : opts.threads)
+                any = any || selected(opts, render_name(spheres, res.first, res.second, threads));
+        }
+        if (!any)
+            continue;
+
+        Scene scene = spheres == 3 ? create_default_scene() : create_sphere_field(spheres);
+        const Clock::time_point build_start = Clock::now();
+        scene.build_acceleration();
+        const double build_ms = elapsed_ms(build_start);
+
+        for (const auto &res : opts.resolutions)
+        {
+            const int width = res.first;
+            const int height = res.second;
+            const size_t first = results.size();
+
+            for (int threads : opts.threads)
+            {
+                const std::string name = render_name(spheres, width, height, threads);
+                if (!selected(opts, name))
+                    continue;
+
+                Renderer renderer(threads);
+                renderer.set_accumulation(false);
+                // Every pixel is traced and shaded, so the numbers track the tracer
+                renderer.set_reprojection(false);
+                Framebuffer buffer(width, height);
+                Camera camera;
+                camera.aspect_ratio = static_cast<double>(width) / height;
+
+                std::vector<double> frame_ms;
+                // Frame -1 is a warm-up at the start of the path
+                for (int frame = -1; frame < opts.frames; ++frame)
+                {
+                    const CameraPose pose = camera_path_pose(opts.frames > 1 ? std::max(frame, 0) / (opts.frames - 1.0) : 0.0);
+                    camera.position = pose.position;
+                    camera.set_orientation(pose.yaw, pose.pitch);
+
+                    const Clock::time_point start = Clock::now();
+                    renderer.render(scene, camera, buffer);
+                    if (frame >= 0)
+                        frame_ms.push_back(elapsed_ms(start));
+                }
+                std::sort(frame_ms.begin(), frame_ms.end());
+
+                RenderResult result;
+                result.name = name;
+                result.spheres = spheres;
+                result.width = width;
+                result.height = height;
+                result.threads = threads;
+                result.frames = opts.frames;
+                result.build_ms = build_ms;
+                result.frame_ms_min = frame_ms.front();
+                result.frame_ms_median = frame_ms[frame_ms.size() / 2];
+                const double pixels = static_cast<double>(width) * height;
+                result.rays_per_s = pixels * renderer.get_samples_per_frame() / (result.frame_ms_median / 1000.0);
+                result.ns_per_pixel = result.frame_ms_median * 1e6 / pixels;
+                result.scaling_efficiency = 1.0;
+                results.push_back(result);
+
+                std::fprintf(stderr, "%-40s %10.3f ms/frame %10.2f Mrays/s\n", name.c_str(),
+                             result.frame_ms_median, result.rays_per_s / 1e6);
+            }
+
+            // Throughput per thread relative to the smallest thread count run
+            for (size_t i = first; i < results.size(); ++i)
+            {
+                const RenderResult &base = results[first];
+                RenderResult &result = results[i];
+                result.scaling_efficiency = (result.rays_per_s / base.rays_per_s) /
+                                            (static_cast<double>(result.threads) / base.threads);
+            }
+        }
+    }
+}
+
+std::string json_string(const std::string &text)
+{
+    std::string out = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20)
+            out += c;
+    }
+    return out + "\"";
+}
+
+void write_json(std::FILE *file, const Options &opts, const std::vector<MicroResult> &micro,
+                const std::vector<RenderResult> &render)
+{
+#if defined(__VERSION__)
+    const char *compiler = __VERSION__;
+#else
+    const char *compiler = "unknown";
+#endif
+
+    std::fprintf(file, "{\n");
+    std::fprintf(file, "  \"schema\": 1,\n");
+    std::fprintf(file, "  \"environment\": {\n");
+    std::fprintf(file, "    \"precision\": \"%s\",\n", sizeof(Real) == 4 ? "float" : "double");
+    std::fprintf(file, "    \"simd\": \"%s\",\n", simd_isa_name(simd_kernels().isa));
+    std::fprintf(file, "    \"hardware_threads\": %d,\n", Config::NUM_THREADS);
+    std::fprintf(file, "    \"compiler\": %s,\n", json_string(compiler).c_str());
+    std::fprintf(file, "    \"quick\": %s\n", opts.quick ? "true" : "false");
+    std::fprintf(file, "  },\n");
+
+    std::fprintf(file, "  \"micro\": [");
+    for (size_t i = 0; i < micro.size(); ++i)
+    {
+        std::fprintf(file, "%s\n    {\"name\": %s, \"ns_per_op\": %.4f, \"ops_per_s\": %.6g}",
+                     i ? "," : "", json_string(micro[i].name).c_str(), micro[i].ns_per_op, 1e9 / micro[i].ns_per_op);
+    }
+    std::fprintf(file, "%s],\n", micro.empty() ? "" : "\n  ");
+
+    std::fprintf(file, "  \"render\": [");
+    for (size_t i = 0; i < render.size(); ++i)
+    {
+        const RenderResult &r = render[i];
+        std::fprintf(file,
+                     "%s\n    {\"name\": %s, \"spheres\": %d, \"width\": %d, \"height\": %d, \"threads\": %d, "
+                     "\"frames\": %d, \"build_ms\": %.3f, \"frame_ms_min\": %.3f, \"frame_ms_median\": %.3f, "
+                     "\"rays_per_s\": %.6g, \"ns_per_pixel\": %.3f, \"scaling_efficiency\": %.4f}",
+                     i ? "," : "", json_string(r.name).c_str(), r.spheres, r.width, r.height, r.threads, r.frames,
+                     r.build_ms, r.frame_ms_min, r.frame_ms_median, r.rays_per_s, r.ns_per_pixel, r.scaling_efficiency);
+    }
+    std::fprintf(file, "%s]\n", render.empty() ? "" : "\n  ");
+    std::fprintf(file, "}\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opts;
+    if (!parse_args(argc, argv, opts))
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (!opts.simd.empty())
+    {
+        SimdIsa isa;
+        if (!parse_simd_isa(opts.simd, isa) || !set_simd_isa(isa))
+        {
+            std::cerr << "SIMD instruction set " << opts.simd << " is not available" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<MicroResult> micro;
+    std::vector<RenderResult> render;
+    run_micro(opts, micro);
+    run_render(opts, render);
+
+    std::FILE *file = opts.output.empty() ? stdout : std::fopen(opts.output.c_str(), "w");
+    if (!file)
+    {
+        std::cerr << "Cannot write " << opts.output << std::endl;
+        return 1;
+    }
+    write_json(file, opts, micro, render);
+    if (file != stdout)
+        std::fclose(file);
+    return 0;
+}
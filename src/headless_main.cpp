@@ -0,0 +1,625 @@
+#include "alloc_counter.hpp"
+#include "camera.hpp"
+#include "config.hpp"
+#include "framebuffer.hpp"
+#include "image_io.hpp"
+#include "instrumentation.hpp"
+#include "renderer.hpp"
+#include "resolution_controller.hpp"
+#include "scene_io.hpp"
+#include "scenes.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct Options
+{
+    int width = Config::DEFAULT_WIDTH;
+    int height = Config::DEFAULT_HEIGHT;
+    Vec3 position = Vec3(0.0, 0.0, 3.0);
+    double yaw = -90.0;
+    double pitch = 0.0;
+    double fov = Config::DEFAULT_FOV;
+    int threads = Config::NUM_THREADS;
+    int frames = 1;
+    int spheres = 0;
+    std::string scene;
+    std::string save_scene;
+    std::string mesh;
+    int instances = 1;
+    std::string accel = "bvh";
+    std::string simd;
+    int packet = Config::PACKET_SIZE;
+    int tile = Config::TILE_SIZE;
+    TileOrder tile_order = TileOrder::Morton;
+    int samples = Config::SAMPLES_PER_PIXEL;
+    bool accumulate = true;
+    bool path_trace = false;
+    bool shadows = true;
+    bool reprojection = true;
+    bool camera_path = false;
+    bool binning = true;
+    bool adaptive = true;
+    bool denoise = false;
+    int animate = 0;
+    int churn = 0;
+    ToneMapping tone_mapping;
+    int max_depth = Config::MAX_PATH_DEPTH;
+    double target_ms = 0.0;
+    bool verify = false;
+    std::string output;
+    std::string trace;
+};
+
+void print_usage(const char *argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [options]\n"
+              << "  --width N          render width in pixels (default " << Config::DEFAULT_WIDTH << ")\n"
+              << "  --height N         render height in pixels (default " << Config::DEFAULT_HEIGHT << ")\n"
+              << "  --pos X,Y,Z        camera position (default 0,0,3)\n"
+              << "  --yaw DEG          camera yaw (default -90)\n"
+              << "  --pitch DEG        camera pitch (default 0)\n"
+              << "  --fov DEG          vertical field of view (default " << Config::DEFAULT_FOV << ")\n"
+              << "  --threads N        worker threads (default hardware concurrency)\n"
+              << "  --frames N         frames to render (default 1)\n"
+              << "  --spheres N        render N random spheres instead of the default scene\n"
+              << "  --scene PATH       load a .rtscene file (mapped, no rebuild) or a text\n"
+              << "                     scene with one \"x y z radius [r g b]\" per line\n"
+              << "  --save-scene PATH  write the scene and its acceleration as .rtscene\n"
+              << "  --mesh PATH        add instances of the triangle mesh in an OBJ file\n"
+              << "  --instances N      instances of --mesh to scatter (default 1)\n"
+              << "  --accel MODE       bvh (default), soa (flat SIMD loop) or linear\n"
+              << "  --simd ISA         scalar, sse4.1, avx2 or avx512 (default: best supported)\n"
+              << "  --packet N         primary ray packet size: 1 (off), 2, 4 or 8 (default " << Config::PACKET_SIZE << ")\n"
+              << "  --tile N           tile size in pixels (default " << Config::TILE_SIZE << ")\n"
+              << "  --tile-order ORDER scanline, morton (default) or hilbert\n"
+              << "  --samples N        new samples per pixel each frame (default " << Config::SAMPLES_PER_PIXEL << ")\n"
+              << "  --path-trace       bounced light and shadows from the wavefront path\n"
+              << "                     tracer instead of direct lighting\n"
+              << "  --max-depth N      surface hits per path (default " << Config::MAX_PATH_DEPTH << ")\n"
+              << "  --no-shadows       skip shadow rays in direct lighting\n"
+              << "  --no-reprojection  shade every pixel of a moving camera's frames instead\n"
+              << "                     of reusing colors from the last frame\n"
+              << "  --no-binning       trace primary packets through the BVH instead of\n"
+              << "                     per-tile sphere lists\n"
+              << "  --camera-path      fly the camera along the built-in path over --frames\n"
+              << "  --animate N        bob N spheres up and down every frame, refitting the\n"
+              << "                     acceleration instead of rebuilding it\n"
+              << "  --churn N          remove N random spheres and insert N new ones every frame\n"
+              << "  --no-adaptive      give every pixel the same samples instead of spending\n"
+              << "                     them on noisy pixels once the image has a few\n"
+              << "  --denoise          filter every frame with the edge-aware denoiser,\n"
+              << "                     guided by normals, depths and albedos\n"
+              << "  --no-accumulate    render every frame from scratch instead of\n"
+              << "                     averaging samples while the camera is still\n"
+              << "  --exposure E       scale colors by E before quantizing (default 1)\n"
+              << "  --gamma            encode the 8-bit output with gamma 2\n"
+              << "  --dither           ordered dithering when quantizing to 8 bits\n"
+              << "  --target-ms MS     scale the resolution (up to --width x --height) so\n"
+              << "                     frames render in MS milliseconds\n"
+              << "  --verify           compare every pixel against the linear reference,\n"
+              << "                     once per supported SIMD instruction set\n"
+              << "  -o, --output PATH  write the last frame as .ppm or .pfm; a printf\n"
+              << "                     pattern such as out_%04d.ppm writes every frame\n"
+              << "  --trace PATH       record hot-path counters and write a Chrome trace\n"
+              << "                     (chrome://tracing, ui.perfetto.dev) to PATH\n";
+}
+
+bool parse_vec3(const std::string &text, Vec3 &out)
+{
+    double x, y, z;
+    if (std::sscanf(text.c_str(), "%lf,%lf,%lf", &x, &y, &z) != 3)
+        return false;
+    out = Vec3(x, y, z);
+    return true;
+}
+
+bool parse_args(int argc, char **argv, Options &opts)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+            return false;
+        if (arg == "--verify")
+        {
+            opts.verify = true;
+            continue;
+        }
+        if (arg == "--no-accumulate")
+        {
+            opts.accumulate = false;
+            continue;
+        }
+        if (arg == "--path-trace")
+        {
+            opts.path_trace = true;
+            continue;
+        }
+        if (arg == "--no-shadows")
+        {
+            opts.shadows = false;
+            continue;
+        }
+        if (arg == "--no-reprojection")
+        {
+            opts.reprojection = false;
+            continue;
+        }
+        if (arg == "--camera-path")
+        {
+            opts.camera_path = true;
+            continue;
+        }
+        if (arg == "--no-binning")
+        {
+            opts.binning = false;
+            continue;
+        }
+        if (arg == "--no-adaptive")
+        {
+            opts.adaptive = false;
+            continue;
+        }
+        if (arg == "--denoise")
+        {
+            opts.denoise = true;
+            continue;
+        }
+        if (arg == "--gamma")
+        {
+            opts.tone_mapping.gamma = true;
+            continue;
+        }
+        if (arg == "--dither")
+        {
+            opts.tone_mapping.dither = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+
+        try
+        {
+            if (arg == "--width")
+                opts.width = std::stoi(value);
+            else if (arg == "--height")
+                opts.height = std::stoi(value);
+            else if (arg == "--pos")
+            {
+                if (!parse_vec3(value, opts.position))
+                {
+                    std::cerr << "Expected X,Y,Z for --pos, got " << value << std::endl;
+                    return false;
+                }
+            }
+            else if (arg == "--yaw")
+                opts.yaw = std::stod(value);
+            else if (arg == "--pitch")
+                opts.pitch = std::stod(value);
+            else if (arg == "--fov")
+                opts.fov = std::stod(value);
+            else if (arg == "--threads")
+                opts.threads = std::stoi(value);
+            else if (arg == "--frames")
+                opts.frames = std::stoi(value);
+            else if (arg == "--spheres")
+                opts.spheres = std::stoi(value);
+            else if (arg == "--animate")
+                opts.animate = std::stoi(value);
+            else if (arg == "--churn")
+                opts.churn = std::stoi(value);
+            else if (arg == "--scene")
+                opts.scene = value;
+            else if (arg == "--save-scene")
+                opts.save_scene = value;
+            else if (arg == "--mesh")
+                opts.mesh = value;
+            else if (arg == "--instances")
+                opts.instances = std::stoi(value);
+            else if (arg == "--accel")
+            {
+                if (value != "bvh" && value != "soa" && value != "linear")
+                {
+                    std::cerr << "Expected bvh, soa or linear for --accel, got " << value << std::endl;
+                    return false;
+                }
+                opts.accel = value;
+            }
+            else if (arg == "--packet")
+                opts.packet = std::stoi(value);
+            else if (arg == "--tile")
+                opts.tile = std::stoi(value);
+            else if (arg == "--tile-order")
+            {
+                if (!parse_tile_order(value, opts.tile_order))
+                {
+                    std::cerr << "Expected scanline, morton or hilbert for --tile-order, got " << value << std::endl;
+                    return false;
+                }
+            }
+            else if (arg == "--target-ms")
+                opts.target_ms = std::stod(value);
+            else if (arg == "--exposure")
+                opts.tone_mapping.exposure = std::stof(value);
+            else if (arg == "--samples")
+                opts.samples = std::stoi(value);
+            else if (arg == "--max-depth")
+                opts.max_depth = std::stoi(value);
+            else if (arg == "--simd")
+                opts.simd = value;
+            else if (arg == "-o" || arg == "--output")
+                opts.output = value;
+            else if (arg == "--trace")
+                opts.trace = value;
+            else
+            {
+                std::cerr << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+        catch (const std::exception &)
+        {
+            std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+            return false;
+        }
+    }
+
+    if (opts.width < 2 || opts.height < 2 || opts.frames < 1 || opts.threads < 1 || opts.spheres < 0 || opts.tile < 1 ||
+        opts.samples < 1 || opts.instances < 1 || opts.max_depth < 1 || opts.target_ms < 0.0 || opts.animate < 0 ||
+        opts.churn < 0)
+    {
+        std::cerr << "Width and height must be at least 2, frames, threads, tile size, samples, instances and depth at least 1" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::string frame_path(const std::string &pattern, int frame)
+{
+    if (pattern.find('%') == std::string::npos)
+        return pattern;
+
+    char path[4096];
+    std::snprintf(path, sizeof(path), pattern.c_str(), frame);
+    return path;
+}
+
+// Leaves acceleration loaded from a scene file alone when it is the kind asked for
+void build_acceleration(Scene &scene, const std::string &accel)
+{
+    if (accel != "linear" && scene.has_acceleration() && scene.bvh().empty() == (accel == "soa"))
+        return;
+    if (accel == "linear")
+        scene.clear_acceleration();
+    else
+        scene.build_acceleration(accel == "bvh");
+}
+
+// Renders the frame with the linear reference and then with the requested
+// acceleration once per supported instruction set, and reports pixels whose
+// unclamped color differs.
+bool verify_against_reference(Scene &scene, const Camera &camera, Renderer &renderer,
+                              const std::string &accel, int width, int height)
+{
+    Framebuffer reference(width, height);
+    Framebuffer accelerated(width, height);
+    // Every render must be the same single center sample
+    const bool accumulate = renderer.get_accumulation();
+    const int samples = renderer.get_samples_per_frame();
+    renderer.set_accumulation(false);
+    renderer.set_samples_per_frame(1);
+
+    scene.clear_acceleration();
+    renderer.render(scene, camera, reference);
+    build_acceleration(scene, accel);
+
+    const SimdIsa selected = simd_kernels().isa;
+    bool all_match = true;
+    for (SimdIsa isa : {SimdIsa::Scalar, SimdIsa::SSE41, SimdIsa::AVX2, SimdIsa::AVX512})
+    {
+        if (!set_simd_isa(isa))
+            continue;
+        renderer.render(scene, camera, accelerated);
+
+        size_t mismatches = 0;
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                const Vec3 a = accelerated.get_color(x, y);
+                const Vec3 b = reference.get_color(x, y);
+                if (a.x != b.x || a.y != b.y || a.z != b.z)
+                    mismatches++;
+            }
+        }
+
+        std::printf("verify %s/%s: %zu of %d pixels differ from the linear reference\n",
+                    accel.c_str(), simd_isa_name(isa), mismatches, width * height);
+        all_match = all_match && mismatches == 0;
+    }
+    set_simd_isa(selected);
+    renderer.set_accumulation(accumulate);
+    renderer.set_samples_per_frame(samples);
+    return all_match;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opts;
+    if (!parse_args(argc, argv, opts))
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    const bool per_frame_output = opts.output.find('%') != std::string::npos;
+
+    if (!opts.simd.empty())
+    {
+        SimdIsa isa;
+        if (!parse_simd_isa(opts.simd, isa) || !set_simd_isa(isa))
+        {
+            std::cerr << "SIMD instruction set " << opts.simd << " is not available" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!opts.trace.empty())
+    {
+#ifdef RAYTRACER_INSTRUMENTATION
+        Instrumentation::name_thread("main");
+        Instrumentation::set_enabled(true);
+#else
+        std::cerr << "--trace needs a build with -DRAYTRACER_INSTRUMENTATION=ON" << std::endl;
+        return 1;
+#endif
+    }
+
+    Camera camera(opts.position);
+    camera.set_orientation(opts.yaw, opts.pitch);
+    camera.zoom = opts.fov;
+    camera.aspect_ratio = static_cast<double>(opts.width) / opts.height;
+
+    auto load_start = std::chrono::steady_clock::now();
+    Scene scene;
+    if (!opts.scene.empty())
+    {
+        if (!open_scene(opts.scene, scene))
+            return 1;
+    }
+    else
+    {
+        scene = opts.spheres > 0 ? create_sphere_field(opts.spheres) : create_default_scene();
+    }
+    if (!opts.mesh.empty())
+    {
+        Mesh mesh;
+        if (!load_obj(opts.mesh, mesh))
+            return 1;
+        add_mesh_field(scene, scene.add_mesh(std::move(mesh)), opts.instances);
+    }
+    const double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count();
+    Renderer renderer(opts.threads);
+    if (!renderer.set_packet_size(opts.packet))
+    {
+        std::cerr << "Packet size must be 1, 2, 4 or 8" << std::endl;
+        return 1;
+    }
+    renderer.set_tile_size(opts.tile);
+    renderer.set_tile_order(opts.tile_order);
+    renderer.set_accumulation(opts.accumulate);
+    renderer.set_samples_per_frame(opts.samples);
+    renderer.set_render_mode(opts.path_trace ? RenderMode::PathTrace : RenderMode::Direct);
+    renderer.set_max_depth(opts.max_depth);
+    renderer.set_shadows(opts.shadows);
+    renderer.set_reprojection(opts.reprojection);
+    renderer.set_binning(opts.binning);
+    renderer.set_adaptive_sampling(opts.adaptive);
+    renderer.set_denoising(opts.denoise);
+    Framebuffer buffer(opts.width, opts.height);
+    buffer.set_tone_mapping(opts.tone_mapping);
+
+    if (opts.verify)
+    {
+        return verify_against_reference(scene, camera, renderer, opts.accel, opts.width, opts.height) ? 0 : 2;
+    }
+
+    auto build_start = std::chrono::steady_clock::now();
+    build_acceleration(scene, opts.accel);
+    auto build_end = std::chrono::steady_clock::now();
+    const double build_ms = std::chrono::duration<double, std::milli>(build_end - build_start).count();
+    if (!opts.save_scene.empty() && !save_scene(scene, opts.save_scene))
+        return 1;
+
+    std::vector<double> frame_ms;
+    frame_ms.reserve(opts.frames);
+    double imbalance_sum = 0.0;
+    double worst_imbalance = 0.0;
+    // The first frame builds the tiles and per-thread buffers; later ones should not allocate
+    uint64_t steady_allocations = 0;
+    double pixels_rendered = 0.0;
+    double reuse_sum = 0.0;
+    double traced_samples = 0.0;
+    TraceCounters counters;
+
+    // --animate bobs the first spheres about where they started; --churn
+    // replaces random others, so the bobbing ones keep their indices
+    std::vector<Sphere> animated;
+    std::vector<uint32_t> animated_handles;
+    for (size_t i = 0; i < std::min<size_t>(opts.animate, scene.sphere_count()); ++i)
+    {
+        animated_handles.push_back(scene.sphere_handle(i));
+        animated.push_back(scene.sphere_data()[i]);
+    }
+    uint32_t churn_state = 1;
+    auto churn_random = [&churn_state]()
+    {
+        // xorshift32
+        churn_state ^= churn_state << 13;
+        churn_state ^= churn_state >> 17;
+        churn_state ^= churn_state << 5;
+        return churn_state;
+    };
+    std::vector<double> update_ms;
+    update_ms.reserve(opts.frames);
+    std::vector<double> denoise_ms;
+    denoise_ms.reserve(opts.frames);
+    int rebuilds = 0;
+
+    // --width x --height is the largest size the controller may pick
+    ResolutionController resolution(opts.target_ms > 0.0 ? opts.target_ms : Config::TARGET_FRAME_MS,
+                                    Config::MIN_RENDER_SCALE, 1.0, 1.0);
+
+    for (int frame = 0; frame < opts.frames; ++frame)
+    {
+        if (opts.camera_path)
+        {
+            const CameraPose pose = camera_path_pose(opts.frames > 1 ? frame / (opts.frames - 1.0) : 0.0);
+            camera.position = pose.position;
+            camera.set_orientation(pose.yaw, pose.pitch);
+        }
+
+        const uint64_t allocations_before = allocation_count();
+        if (opts.animate > 0 || opts.churn > 0)
+        {
+            for (size_t i = 0; i < animated.size(); ++i)
+            {
+                Sphere sphere = animated[i];
+                sphere.center.y += static_cast<Real>(0.5 * std::sin(0.2 * frame + static_cast<double>(i)));
+                scene.update_sphere(animated_handles[i], sphere);
+            }
+            for (int i = 0; i < opts.churn && scene.sphere_count() > animated.size(); ++i)
+            {
+                // Reappears within two units of another sphere, so density holds
+                const size_t count = scene.sphere_count();
+                const size_t removed = animated.size() + churn_random() % (count - animated.size());
+                // Through sphere_data(): a mapped scene has no spheres until the
+                // first edit copies them out
+                Sphere sphere = scene.sphere_data()[removed];
+                const Vec3 near = scene.sphere_data()[churn_random() % count].center;
+                const Vec3 offset(churn_random() / 2147483648.0 - 1.0, churn_random() / 2147483648.0 - 1.0,
+                                  churn_random() / 2147483648.0 - 1.0);
+                sphere.center = near + offset * Real(2);
+                scene.remove_sphere(scene.sphere_handle(removed));
+                scene.insert_sphere(sphere);
+            }
+
+            auto update_start = std::chrono::steady_clock::now();
+            if (renderer.update_scene(scene))
+                rebuilds++;
+            update_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - update_start).count());
+        }
+        auto start = std::chrono::steady_clock::now();
+        renderer.render(scene, camera, buffer);
+        auto end = std::chrono::steady_clock::now();
+        if (frame > 0)
+            steady_allocations += allocation_count() - allocations_before;
+        frame_ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        pixels_rendered += static_cast<double>(buffer.get_width()) * buffer.get_height();
+
+        const RenderStats &stats = renderer.get_last_stats();
+        imbalance_sum += stats.imbalance();
+        reuse_sum += stats.reuse_ratio();
+        traced_samples += static_cast<double>(stats.traced_samples);
+        counters.rays += stats.counters.rays;
+        counters.sphere_tests += stats.counters.sphere_tests;
+        counters.triangle_tests += stats.counters.triangle_tests;
+        counters.hits += stats.counters.hits;
+        counters.misses += stats.counters.misses;
+        worst_imbalance = std::max(worst_imbalance, stats.imbalance());
+        if (opts.denoise && stats.tile_count > 0)
+            denoise_ms.push_back(stats.denoise_ms);
+
+        if (opts.target_ms > 0.0 && stats.tile_count > 0 && resolution.add_frame(stats.frame_ms))
+        {
+            const double scale = resolution.get_scale();
+            buffer.resize(std::max(2, static_cast<int>(opts.width * scale)), std::max(2, static_cast<int>(opts.height * scale)));
+        }
+
+        if (per_frame_output && !write_image(frame_path(opts.output, frame), buffer, renderer.get_denoised()))
+            return 1;
+    }
+
+    if (!opts.output.empty() && !per_frame_output && !write_image(opts.output, buffer, renderer.get_denoised()))
+        return 1;
+
+    if (!opts.trace.empty() && !Instrumentation::write_chrome_trace(opts.trace))
+    {
+        std::cerr << "Cannot write " << opts.trace << std::endl;
+        return 1;
+    }
+
+    std::vector<double> sorted = frame_ms;
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0.0;
+    for (double ms : frame_ms)
+        total += ms;
+    const double mean = total / frame_ms.size();
+
+    std::printf("%dx%d, %d threads, %d frames, %zu spheres\n", opts.width, opts.height,
+                renderer.get_thread_count(), opts.frames, scene.sphere_count());
+    if (opts.path_trace)
+        std::printf("path tracing, max depth %d\n", renderer.get_max_depth());
+    std::printf("accel %s, simd %s, packet %d, scene loaded in %.3f ms, built in %.3f ms", opts.accel.c_str(),
+                simd_isa_name(simd_kernels().isa), renderer.get_packet_size(), load_ms, build_ms);
+    if (!scene.bvh().empty())
+        std::printf(", %zu bvh nodes", scene.bvh().nodes().size());
+    std::printf("\n");
+    std::printf("frame ms: min %.3f  median %.3f  mean %.3f  max %.3f\n",
+                sorted.front(), sorted[sorted.size() / 2], mean, sorted.back());
+    if (!update_ms.empty())
+    {
+        std::sort(update_ms.begin(), update_ms.end());
+        std::printf("scene update ms: min %.3f  median %.3f  max %.3f, rebuilt %d of %d frames\n", update_ms.front(),
+                    update_ms[update_ms.size() / 2], update_ms.back(), rebuilds, opts.frames);
+    }
+    if (!denoise_ms.empty())
+    {
+        std::sort(denoise_ms.begin(), denoise_ms.end());
+        std::printf("denoise ms: min %.3f  median %.3f  max %.3f\n", denoise_ms.front(),
+                    denoise_ms[denoise_ms.size() / 2], denoise_ms.back());
+    }
+    std::printf("%.1f fps, %.2f Mpix/s\n", 1000.0 / mean, pixels_rendered / (total * 1000.0));
+    std::printf("tiles: %d of %dx%d, %s order; worker busy max/mean %.3f avg, %.3f worst\n",
+                renderer.get_last_stats().tile_count, opts.tile, opts.tile, tile_order_name(opts.tile_order),
+                imbalance_sum / opts.frames, worst_imbalance);
+    if (opts.target_ms > 0.0)
+    {
+        std::printf("dynamic resolution: target %.1f ms, final scale %.2f (%dx%d), recent render ms:",
+                    opts.target_ms, resolution.get_scale(), buffer.get_width(), buffer.get_height());
+        const size_t history = resolution.get_history_size();
+        for (size_t i = history > 8 ? history - 8 : 0; i < history; ++i)
+            std::printf(" %.1f", resolution.get_history(i));
+        std::printf("\n");
+    }
+    std::printf("samples per pixel: %d%s; %.2f traced per pixel per frame on average\n", renderer.get_last_stats().samples,
+                !opts.accumulate ? "" : opts.adaptive ? " or more accumulated" : " accumulated", traced_samples / pixels_rendered);
+    if (opts.frames > 1 && renderer.get_reprojection())
+        std::printf("reprojection: %.1f%% of pixels reused per frame on average\n", 100.0 * reuse_sum / opts.frames);
+    if (!opts.trace.empty() && counters.rays > 0)
+        std::printf("rays %llu, %.2f sphere and %.2f triangle tests per ray, %.1f%% hit; trace written to %s\n",
+                    static_cast<unsigned long long>(counters.rays),
+                    static_cast<double>(counters.sphere_tests) / counters.rays,
+                    static_cast<double>(counters.triangle_tests) / counters.rays,
+                    100.0 * counters.hits / std::max<uint64_t>(1, counters.hits + counters.misses), opts.trace.c_str());
+    if (allocation_counting_enabled() && opts.frames > 1)
+        std::printf("allocations per frame after the first: %.2f\n",
+                    static_cast<double>(steady_allocations) / (opts.frames - 1));
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include "instrumentation.hpp"
+
+#ifdef RAYTRACER_INSTRUMENTATION
+
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+
+using Clock = Instrumentation::Clock;
+
+struct Event
+{
+    const char *name;
+    int64_t start_ns;    // since epoch
+    int64_t duration_ns; // -1 for values
+    int64_t arg;
+};
+
+// Ring of one thread's most recent events. Buffers outlive their threads and
+// are handed to the next thread that starts recording.
+struct ThreadEvents
+{
+    std::vector<Event> ring;
+    uint64_t recorded = 0;
+    const char *name = nullptr;
+    int id = 0;
+    bool in_use = false;
+};
+
+const Clock::time_point epoch = Clock::now();
+
+std::mutex &registry_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::vector<std::unique_ptr<ThreadEvents>> &registry()
+{
+    static std::vector<std::unique_ptr<ThreadEvents>> buffers;
+    return buffers;
+}
+
+struct ThreadSlot
+{
+    ThreadEvents *events = nullptr;
+    const char *name = nullptr;
+
+    ~ThreadSlot()
+    {
+        if (events)
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            events->in_use = false;
+            events->name = nullptr;
+        }
+    }
+};
+
+thread_local ThreadSlot slot;
+
+// Takes the lock only the first time a thread records
+ThreadEvents &thread_events()
+{
+    if (slot.events)
+        return *slot.events;
+
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    for (const auto &buffer : registry())
+    {
+        if (!buffer->in_use)
+        {
+            slot.events = buffer.get();
+            break;
+        }
+    }
+    if (!slot.events)
+    {
+        auto buffer = std::make_unique<ThreadEvents>();
+        buffer->ring.resize(Instrumentation::EVENTS_PER_THREAD);
+        buffer->id = static_cast<int>(registry().size()) + 1;
+        slot.events = buffer.get();
+        registry().push_back(std::move(buffer));
+    }
+    slot.events->in_use = true;
+    slot.events->name = slot.name;
+    return *slot.events;
+}
+
+void push(const Event &event)
+{
+    ThreadEvents &events = thread_events();
+    events.ring[events.recorded % events.ring.size()] = event;
+    events.recorded++;
+}
+
+int64_t since_epoch_ns(Clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time - epoch).count();
+}
+
+} // namespace
+
+void Instrumentation::set_enabled(bool enabled)
+{
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void Instrumentation::record_span(const char *name, Clock::time_point start, Clock::time_point end, int64_t arg)
+{
+    push(Event{name, since_epoch_ns(start), std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(), arg});
+}
+
+void Instrumentation::record_value(const char *name, int64_t value)
+{
+    if (enabled())
+        push(Event{name, since_epoch_ns(Clock::now()), -1, value});
+}
+
+// Applied when the thread first records, so naming alone allocates nothing
+void Instrumentation::name_thread(const char *name)
+{
+    slot.name = name;
+    if (slot.events)
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        slot.events->name = name;
+    }
+}
+
+bool Instrumentation::write_chrome_trace(const std::string &path)
+{
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    std::fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    auto separator = [&]
+    {
+        const char *text = first ? "" : ",\n";
+        first = false;
+        return text;
+    };
+
+    std::fprintf(file, "%s{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"raytracer\"}}",
+                 separator());
+    for (const auto &buffer : registry())
+    {
+        const ThreadEvents &events = *buffer;
+        if (events.name)
+        {
+            std::fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                         separator(), events.id, events.name);
+        }
+
+        const uint64_t size = events.ring.size();
+        const uint64_t begin = events.recorded > size ? events.recorded - size : 0;
+        for (uint64_t i = begin; i < events.recorded; ++i)
+        {
+            const Event &event = events.ring[i % size];
+            if (event.duration_ns < 0)
+            {
+                std::fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"C\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"args\": {\"%s\": %" PRId64 "}}",
+                             separator(), event.name, events.id, event.start_ns / 1000.0, event.name, event.arg);
+            }
+            else
+            {
+                std::fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"arg\": %" PRId64 "}}",
+                             separator(), event.name, events.id, event.start_ns / 1000.0, event.duration_ns / 1000.0, event.arg);
+            }
+        }
+    }
+    std::fprintf(file, "\n]}\n");
+    return std::fclose(file) == 0;
+}
+
+void Instrumentation::clear_events()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    for (const auto &buffer : registry())
+        buffer->recorded = 0;
+}
+
+#endif
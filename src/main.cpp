@@ -2,9 +2,11 @@
 #include "application.hpp"
 #include <iostream>
 
-int main()
+int main(int argc, char **argv)
 {
     Application app;
+    if (argc > 1)
+        app.set_scene_path(argv[1]);
     if (!app.initialize())
     {
         std::cerr << "Failed to initialize application" << std::endl;
@@ -0,0 +1,97 @@
+#include "mapped_file.hpp"
+
+#include <cstring>
+#include <iostream>
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+#include <fstream>
+#include <new>
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in)
+    {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    const size_t size = static_cast<size_t>(in.tellg());
+    unsigned char *buffer = static_cast<unsigned char *>(::operator new(size ? size : 1, std::align_val_t(64)));
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char *>(buffer), size))
+    {
+        ::operator delete(buffer, std::align_val_t(64));
+        std::cerr << "Failed to read " << path << std::endl;
+        return false;
+    }
+    data_ = buffer;
+    size_ = size;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data_)
+        ::operator delete(const_cast<unsigned char *>(data_), std::align_val_t(64));
+    data_ = nullptr;
+    size_ = 0;
+}
+
+#else
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to open " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0)
+    {
+        std::cerr << "Failed to map " << path << ": empty or unreadable" << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    const size_t size = static_cast<size_t>(info.st_size);
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        std::cerr << "Failed to map " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    data_ = static_cast<const unsigned char *>(mapping);
+    size_ = size;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data_)
+        munmap(const_cast<unsigned char *>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+}
+
+#endif
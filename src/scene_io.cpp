@@ -0,0 +1,435 @@
+#include "scene_io.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "mapped_file.hpp"
+
+namespace
+{
+
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+constexpr uint64_t SECTION_ALIGNMENT = 64;
+// Text is read this many bytes at a time; also the longest line accepted
+constexpr size_t TEXT_CHUNK_SIZE = 1 << 20;
+
+uint64_t align_up(uint64_t offset)
+{
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+bool has_extension(const std::string &path, const std::string &ext)
+{
+    return path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+constexpr uint32_t NO_MATERIAL = UINT32_MAX;
+
+// Parses one line of the text format into spheres, with a material for each
+// color given. Spheres without one share default_material, added on first
+// use. The line is NUL terminated; blank and comment-only lines are skipped.
+bool parse_sphere_line(char *line, size_t line_number, const std::string &path, std::vector<Sphere> &spheres,
+                       std::vector<Material> &materials, uint32_t &default_material)
+{
+    if (char *comment = std::strchr(line, '#'))
+        *comment = '\0';
+
+    double values[8];
+    int count = 0;
+    char *cursor = line;
+    while (count < 8)
+    {
+        char *next = nullptr;
+        const double value = std::strtod(cursor, &next);
+        if (next == cursor)
+            break;
+        values[count++] = value;
+        cursor = next;
+    }
+    while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')
+        cursor++;
+
+    if (count == 0 && *cursor == '\0')
+        return true;
+    if ((count != 4 && count != 7) || *cursor != '\0')
+    {
+        std::cerr << path << ":" << line_number << ": expected x y z radius [r g b]" << std::endl;
+        return false;
+    }
+    if (!(values[3] > 0.0) || !std::isfinite(values[0] + values[1] + values[2] + values[3]))
+    {
+        std::cerr << path << ":" << line_number << ": radius must be positive and coordinates finite" << std::endl;
+        return false;
+    }
+
+    uint32_t material = default_material;
+    if (count == 7)
+    {
+        material = static_cast<uint32_t>(materials.size());
+        materials.push_back(Material{Vec3(static_cast<Real>(values[4]), static_cast<Real>(values[5]), static_cast<Real>(values[6]))});
+    }
+    else if (default_material == NO_MATERIAL)
+    {
+        material = default_material = static_cast<uint32_t>(materials.size());
+        materials.push_back(Material{Vec3(Real(0.8), Real(0.8), Real(0.8))});
+    }
+    spheres.push_back(Sphere(Vec3(static_cast<Real>(values[0]), static_cast<Real>(values[1]), static_cast<Real>(values[2])),
+                             static_cast<Real>(values[3]), material));
+    return true;
+}
+
+// Calls parse(line, line_number) for every line of a text file, NUL
+// terminated and without its newline, reading TEXT_CHUNK_SIZE bytes at a
+// time. Stops at the first line parse rejects.
+template <class Parse>
+bool read_lines(const std::string &path, Parse &&parse)
+{
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    std::vector<char> chunk(TEXT_CHUNK_SIZE + 1);
+    size_t filled = 0; // bytes in chunk, starting with the unfinished line of the last read
+    size_t line_number = 0;
+    bool ok = true;
+    for (;;)
+    {
+        const size_t read = std::fread(chunk.data() + filled, 1, TEXT_CHUNK_SIZE - filled, file);
+        filled += read;
+        const bool at_end = read == 0;
+
+        char *line = chunk.data();
+        char *end = chunk.data() + filled;
+        while (ok)
+        {
+            char *newline = static_cast<char *>(std::memchr(line, '\n', end - line));
+            if (!newline)
+                break;
+            *newline = '\0';
+            ok = parse(line, ++line_number);
+            line = newline + 1;
+        }
+        if (!ok)
+            break;
+
+        filled = end - line;
+        if (at_end)
+        {
+            // Last line without a newline
+            if (filled > 0)
+            {
+                *end = '\0';
+                ok = parse(line, ++line_number);
+            }
+            break;
+        }
+        if (filled == TEXT_CHUNK_SIZE)
+        {
+            std::cerr << path << ":" << line_number + 1 << ": line longer than " << TEXT_CHUNK_SIZE << " bytes" << std::endl;
+            ok = false;
+            break;
+        }
+        std::memmove(chunk.data(), line, filled);
+    }
+
+    if (ok && std::ferror(file))
+    {
+        std::cerr << "Failed to read " << path << std::endl;
+        ok = false;
+    }
+    std::fclose(file);
+    return ok;
+}
+
+// Parses one line of an OBJ file into mesh. Only "v" and "f" matter; faces
+// refer to positions by 1-based or, when negative, relative index, and any
+// texture or normal indices after a slash are skipped. Polygons are split
+// into a fan of triangles.
+bool parse_obj_line(char *line, size_t line_number, const std::string &path, Mesh &mesh)
+{
+    if (char *comment = std::strchr(line, '#'))
+        *comment = '\0';
+    while (*line == ' ' || *line == '\t')
+        line++;
+
+    if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t'))
+    {
+        double values[3];
+        char *cursor = line + 1;
+        for (double &value : values)
+        {
+            char *next = nullptr;
+            value = std::strtod(cursor, &next);
+            if (next == cursor)
+            {
+                std::cerr << path << ":" << line_number << ": expected v x y z" << std::endl;
+                return false;
+            }
+            cursor = next;
+        }
+        mesh.positions.push_back(Vec3(static_cast<Real>(values[0]), static_cast<Real>(values[1]),
+                                      static_cast<Real>(values[2])));
+        return true;
+    }
+    if (line[0] != 'f' || (line[1] != ' ' && line[1] != '\t'))
+        return true;
+
+    const long vertex_count = static_cast<long>(mesh.positions.size());
+    uint32_t first = 0;
+    uint32_t previous = 0;
+    int corners = 0;
+    char *cursor = line + 1;
+    for (;;)
+    {
+        char *next = nullptr;
+        const long index = std::strtol(cursor, &next, 10);
+        if (next == cursor)
+            break;
+        cursor = next;
+        while (*cursor != '\0' && *cursor != ' ' && *cursor != '\t' && *cursor != '\r')
+            cursor++;
+
+        const long resolved = index < 0 ? vertex_count + index : index - 1;
+        if (index == 0 || resolved < 0 || resolved >= vertex_count)
+        {
+            std::cerr << path << ":" << line_number << ": vertex " << index << " does not exist" << std::endl;
+            return false;
+        }
+        const uint32_t vertex = static_cast<uint32_t>(resolved);
+        if (corners == 0)
+            first = vertex;
+        else if (corners >= 2)
+            mesh.indices.insert(mesh.indices.end(), {first, previous, vertex});
+        previous = vertex;
+        corners++;
+    }
+    while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')
+        cursor++;
+    if (corners < 3 || *cursor != '\0')
+    {
+        std::cerr << path << ":" << line_number << ": expected a face of three or more vertices" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool save_scene(const Scene &scene, const std::string &path)
+{
+    if (!scene.instances.empty())
+    {
+        std::cerr << "Scene files hold spheres only; " << path << " not written" << std::endl;
+        return false;
+    }
+
+    const size_t count = scene.sphere_count();
+    const SphereSoA &soa = scene.soa();
+    const BVH &bvh = scene.bvh();
+    // Spheres inserted or removed since the last build leave slots that no
+    // longer line up with the spheres; such a scene is saved without them
+    const bool accelerated = scene.has_acceleration() && soa.size() == count;
+
+    SceneFileHeader header{};
+    std::memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_FILE_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.real_size = sizeof(Real);
+    header.sphere_size = sizeof(Sphere);
+    header.material_size = sizeof(Material);
+    header.node_size = sizeof(BVHNode);
+    header.soa_padding = SphereSoA::PADDING;
+    header.sphere_count = count;
+    header.material_count = scene.material_count();
+    header.slot_count = accelerated ? soa.padded_size() : 0;
+    header.node_count = accelerated ? bvh.nodes().size() : 0;
+
+    uint64_t offset = align_up(sizeof(header));
+    auto place = [&offset](uint64_t bytes)
+    {
+        const uint64_t at = offset;
+        offset = align_up(offset + bytes);
+        return at;
+    };
+    const uint64_t slot_bytes = header.slot_count * sizeof(Real);
+    header.spheres_offset = place(count * sizeof(Sphere));
+    header.materials_offset = place(header.material_count * sizeof(Material));
+    header.cx_offset = place(slot_bytes);
+    header.cy_offset = place(slot_bytes);
+    header.cz_offset = place(slot_bytes);
+    header.radius_offset = place(slot_bytes);
+    header.ids_offset = place(accelerated ? count * sizeof(uint32_t) : 0);
+    header.nodes_offset = place(header.node_count * sizeof(BVHNode));
+    header.file_size = offset;
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+    {
+        std::cerr << "Failed to open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    uint64_t written = 0;
+    auto write_section = [&](uint64_t at, const void *data, uint64_t bytes)
+    {
+        static const char zeros[SECTION_ALIGNMENT] = {};
+        while (written < at)
+        {
+            const uint64_t pad = std::min<uint64_t>(at - written, sizeof(zeros));
+            out.write(zeros, static_cast<std::streamsize>(pad));
+            written += pad;
+        }
+        out.write(static_cast<const char *>(data), static_cast<std::streamsize>(bytes));
+        written += bytes;
+    };
+
+    write_section(0, &header, sizeof(header));
+    write_section(header.spheres_offset, scene.sphere_data(), count * sizeof(Sphere));
+    write_section(header.materials_offset, scene.material_data(), header.material_count * sizeof(Material));
+    if (accelerated)
+    {
+        const SphereSpan span = soa.span();
+        write_section(header.cx_offset, span.cx, slot_bytes);
+        write_section(header.cy_offset, span.cy, slot_bytes);
+        write_section(header.cz_offset, span.cz, slot_bytes);
+        write_section(header.radius_offset, span.radius, slot_bytes);
+        write_section(header.ids_offset, soa.ids(), count * sizeof(uint32_t));
+        write_section(header.nodes_offset, bvh.nodes().data(), header.node_count * sizeof(BVHNode));
+    }
+    write_section(header.file_size, nullptr, 0);
+
+    if (!out.flush())
+    {
+        std::cerr << "Failed to write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool load_scene(const std::string &path, Scene &scene)
+{
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(path))
+        return false;
+
+    SceneFileHeader header;
+    if (file->size() < sizeof(header))
+    {
+        std::cerr << path << " is not a scene file" << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        std::cerr << path << " is not a scene file" << std::endl;
+        return false;
+    }
+    if (header.version != SCENE_FILE_VERSION)
+    {
+        std::cerr << path << " is scene file version " << header.version << ", this build reads version "
+                  << SCENE_FILE_VERSION << std::endl;
+        return false;
+    }
+    if (header.byte_order != BYTE_ORDER_MARK || header.real_size != sizeof(Real) ||
+        header.sphere_size != sizeof(Sphere) || header.material_size != sizeof(Material) ||
+        header.node_size != sizeof(BVHNode) ||
+        header.soa_padding != SphereSoA::PADDING)
+    {
+        std::cerr << path << " was written by a build with a different precision or memory layout; "
+                  << "import the text scene again" << std::endl;
+        return false;
+    }
+
+    const uint64_t count = header.sphere_count;
+    const uint64_t slot_bytes = header.slot_count * sizeof(Real);
+    auto section_ok = [&](uint64_t offset, uint64_t bytes)
+    {
+        return offset % SECTION_ALIGNMENT == 0 && offset <= file->size() && bytes <= file->size() - offset;
+    };
+    const bool accelerated = header.slot_count > 0;
+    bool valid = header.file_size == file->size() && count <= UINT32_MAX && header.material_count <= UINT32_MAX &&
+                 section_ok(header.spheres_offset, count * sizeof(Sphere)) &&
+                 section_ok(header.materials_offset, header.material_count * sizeof(Material));
+    if (accelerated)
+    {
+        valid = valid && header.slot_count == SphereSoA::padded_size(count) &&
+                header.node_count < 2 * count &&
+                section_ok(header.cx_offset, slot_bytes) && section_ok(header.cy_offset, slot_bytes) &&
+                section_ok(header.cz_offset, slot_bytes) && section_ok(header.radius_offset, slot_bytes) &&
+                section_ok(header.ids_offset, count * sizeof(uint32_t)) &&
+                section_ok(header.nodes_offset, header.node_count * sizeof(BVHNode));
+    }
+    else
+    {
+        valid = valid && header.node_count == 0;
+    }
+    if (!valid)
+    {
+        std::cerr << path << " is truncated or corrupt" << std::endl;
+        return false;
+    }
+
+    const unsigned char *base = file->data();
+    const Sphere *spheres = reinterpret_cast<const Sphere *>(base + header.spheres_offset);
+    const Material *materials = reinterpret_cast<const Material *>(base + header.materials_offset);
+    SphereSoA soa;
+    BVH bvh;
+    if (accelerated)
+    {
+        const uint32_t *ids = reinterpret_cast<const uint32_t *>(base + header.ids_offset);
+        const SphereSpan span{reinterpret_cast<const Real *>(base + header.cx_offset),
+                              reinterpret_cast<const Real *>(base + header.cy_offset),
+                              reinterpret_cast<const Real *>(base + header.cz_offset),
+                              reinterpret_cast<const Real *>(base + header.radius_offset)};
+        soa.borrow(span, ids, count);
+        if (header.node_count > 0)
+            bvh.borrow(reinterpret_cast<const BVHNode *>(base + header.nodes_offset), header.node_count, ids, count);
+    }
+    scene.borrow(std::move(file), spheres, count, materials, header.material_count, soa, bvh);
+    return true;
+}
+
+bool import_scene_text(const std::string &path, Scene &scene)
+{
+    std::vector<Sphere> spheres;
+    std::vector<Material> materials;
+    uint32_t default_material = NO_MATERIAL;
+    if (!read_lines(path, [&](char *line, size_t line_number)
+                    { return parse_sphere_line(line, line_number, path, spheres, materials, default_material); }))
+        return false;
+
+    scene.set_spheres(std::move(spheres), std::move(materials));
+    return true;
+}
+
+bool load_obj(const std::string &path, Mesh &mesh)
+{
+    Mesh loaded;
+    if (!read_lines(path, [&](char *line, size_t line_number)
+                    { return parse_obj_line(line, line_number, path, loaded); }))
+        return false;
+    if (loaded.indices.empty())
+    {
+        std::cerr << path << " has no faces" << std::endl;
+        return false;
+    }
+
+    mesh = std::move(loaded);
+    return true;
+}
+
+bool open_scene(const std::string &path, Scene &scene)
+{
+    if (has_extension(path, ".rtscene"))
+        return load_scene(path, scene);
+    return import_scene_text(path, scene);
+}
@@ -0,0 +1,125 @@
+#include "simd.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+
+const SimdKernels *kernels_for(SimdIsa isa)
+{
+    switch (isa)
+    {
+    case SimdIsa::SSE41:
+        return simd_kernels_sse41();
+    case SimdIsa::AVX2:
+        return simd_kernels_avx2();
+    case SimdIsa::AVX512:
+        return simd_kernels_avx512();
+    case SimdIsa::Scalar:
+    default:
+        return simd_kernels_scalar();
+    }
+}
+
+bool cpu_supports(SimdIsa isa)
+{
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    switch (isa)
+    {
+    case SimdIsa::SSE41:
+        return __builtin_cpu_supports("sse4.1");
+    case SimdIsa::AVX2:
+        return __builtin_cpu_supports("avx2");
+    case SimdIsa::AVX512:
+        return __builtin_cpu_supports("avx512f");
+    case SimdIsa::Scalar:
+    default:
+        return true;
+    }
+#else
+    return isa == SimdIsa::Scalar;
+#endif
+}
+
+const SimdKernels *initial_kernels()
+{
+    SimdIsa isa = best_simd_isa();
+    if (const char *env = std::getenv("RAYTRACER_SIMD"))
+    {
+        SimdIsa requested;
+        if (!parse_simd_isa(env, requested))
+            std::cerr << "Ignoring unknown RAYTRACER_SIMD=" << env << std::endl;
+        else if (!simd_isa_supported(requested))
+            std::cerr << "RAYTRACER_SIMD=" << env << " is not supported here, using "
+                      << simd_isa_name(isa) << std::endl;
+        else
+            isa = requested;
+    }
+    return kernels_for(isa);
+}
+
+std::atomic<const SimdKernels *> &active_kernels()
+{
+    static std::atomic<const SimdKernels *> active{initial_kernels()};
+    return active;
+}
+
+} // namespace
+
+bool simd_isa_supported(SimdIsa isa)
+{
+    return kernels_for(isa) != nullptr && cpu_supports(isa);
+}
+
+SimdIsa best_simd_isa()
+{
+    for (SimdIsa isa : {SimdIsa::AVX512, SimdIsa::AVX2, SimdIsa::SSE41})
+    {
+        if (simd_isa_supported(isa))
+            return isa;
+    }
+    return SimdIsa::Scalar;
+}
+
+const char *simd_isa_name(SimdIsa isa)
+{
+    switch (isa)
+    {
+    case SimdIsa::SSE41:
+        return "sse4.1";
+    case SimdIsa::AVX2:
+        return "avx2";
+    case SimdIsa::AVX512:
+        return "avx512";
+    case SimdIsa::Scalar:
+    default:
+        return "scalar";
+    }
+}
+
+bool parse_simd_isa(const std::string &name, SimdIsa &isa)
+{
+    for (SimdIsa candidate : {SimdIsa::Scalar, SimdIsa::SSE41, SimdIsa::AVX2, SimdIsa::AVX512})
+    {
+        if (name == simd_isa_name(candidate))
+        {
+            isa = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const SimdKernels &simd_kernels()
+{
+    return *active_kernels().load(std::memory_order_relaxed);
+}
+
+bool set_simd_isa(SimdIsa isa)
+{
+    if (!simd_isa_supported(isa))
+        return false;
+    active_kernels().store(kernels_for(isa), std::memory_order_relaxed);
+    return true;
+}
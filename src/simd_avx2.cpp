@@ -0,0 +1,31 @@
+#define SIMD_TARGET_NAMESPACE simd_avx2
+#include "simd.hpp"
+#include "simd_kernels.hpp"
+
+// Built with the compiler flags for this ISA (see CMakeLists.txt); without
+// them the kernels are left out and the dispatcher never selects it.
+#if defined(__AVX2__)
+
+const SimdKernels *simd_kernels_avx2()
+{
+    static const SimdKernels kernels{
+        SimdIsa::AVX2,
+        simd_avx2::nearest_sphere_kernel<simd_avx2::AVX2Lanes>,
+        simd_avx2::packet_sphere_kernel<simd_avx2::AVX2Lanes>,
+        simd_avx2::nearest_triangle_kernel<simd_avx2::AVX2Lanes>,
+        simd_avx2::occluded_sphere_kernel<simd_avx2::AVX2Lanes>,
+        simd_avx2::occluded_triangle_kernel<simd_avx2::AVX2Lanes>,
+        simd_avx2::resolve_pixels_kernel<simd_avx2::AVX2Pixels>,
+        simd_avx2::denoise_row_kernel<simd_avx2::AVX2Pixels>,
+    };
+    return &kernels;
+}
+
+#else
+
+const SimdKernels *simd_kernels_avx2()
+{
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#define SIMD_TARGET_NAMESPACE simd_avx512
+#include "simd.hpp"
+#include "simd_kernels.hpp"
+
+// Built with the compiler flags for this ISA (see CMakeLists.txt); without
+// them the kernels are left out and the dispatcher never selects it.
+#if defined(__AVX512F__)
+
+const SimdKernels *simd_kernels_avx512()
+{
+    static const SimdKernels kernels{
+        SimdIsa::AVX512,
+        simd_avx512::nearest_sphere_kernel<simd_avx512::AVX512Lanes>,
+        simd_avx512::packet_sphere_kernel<simd_avx512::AVX512Lanes>,
+        simd_avx512::nearest_triangle_kernel<simd_avx512::AVX512Lanes>,
+        simd_avx512::occluded_sphere_kernel<simd_avx512::AVX512Lanes>,
+        simd_avx512::occluded_triangle_kernel<simd_avx512::AVX512Lanes>,
+        simd_avx512::resolve_pixels_kernel<simd_avx512::AVX512Pixels>,
+        simd_avx512::denoise_row_kernel<simd_avx512::AVX512Pixels>,
+    };
+    return &kernels;
+}
+
+#else
+
+const SimdKernels *simd_kernels_avx512()
+{
+    return nullptr;
+}
+
+#endif
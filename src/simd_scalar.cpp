@@ -0,0 +1,18 @@
+#define SIMD_TARGET_NAMESPACE simd_scalar
+#include "simd.hpp"
+#include "simd_kernels.hpp"
+
+const SimdKernels *simd_kernels_scalar()
+{
+    static const SimdKernels kernels{
+        SimdIsa::Scalar,
+        simd_scalar::nearest_sphere_kernel<simd_scalar::ScalarLanes>,
+        simd_scalar::packet_sphere_kernel<simd_scalar::ScalarLanes>,
+        simd_scalar::nearest_triangle_kernel<simd_scalar::ScalarLanes>,
+        simd_scalar::occluded_sphere_kernel<simd_scalar::ScalarLanes>,
+        simd_scalar::occluded_triangle_kernel<simd_scalar::ScalarLanes>,
+        simd_scalar::resolve_pixels_kernel<simd_scalar::ScalarPixels>,
+        simd_scalar::denoise_row_kernel<simd_scalar::ScalarPixels>,
+    };
+    return &kernels;
+}
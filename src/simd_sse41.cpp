@@ -0,0 +1,31 @@
+#define SIMD_TARGET_NAMESPACE simd_sse41
+#include "simd.hpp"
+#include "simd_kernels.hpp"
+
+// Built with the compiler flags for this ISA (see CMakeLists.txt); without
+// them the kernels are left out and the dispatcher never selects it.
+#if defined(__SSE4_1__)
+
+const SimdKernels *simd_kernels_sse41()
+{
+    static const SimdKernels kernels{
+        SimdIsa::SSE41,
+        simd_sse41::nearest_sphere_kernel<simd_sse41::SSE41Lanes>,
+        simd_sse41::packet_sphere_kernel<simd_sse41::SSE41Lanes>,
+        simd_sse41::nearest_triangle_kernel<simd_sse41::SSE41Lanes>,
+        simd_sse41::occluded_sphere_kernel<simd_sse41::SSE41Lanes>,
+        simd_sse41::occluded_triangle_kernel<simd_sse41::SSE41Lanes>,
+        simd_sse41::resolve_pixels_kernel<simd_sse41::SSE41Pixels>,
+        simd_sse41::denoise_row_kernel<simd_sse41::SSE41Pixels>,
+    };
+    return &kernels;
+}
+
+#else
+
+const SimdKernels *simd_kernels_sse41()
+{
+    return nullptr;
+}
+
+#endif